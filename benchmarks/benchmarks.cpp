@@ -0,0 +1,823 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "liquid/liquid.h"
+
+#include "liquid/binary.h"
+#include "liquid/json.h"
+#include "liquid/reflect.h"
+#include "liquid/renderer.h"
+#include "liquid/snapshot.h"
+#include "liquid/value_p.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Allocation counting */
+
+static std::atomic<size_t> g_allocations{ 0 };
+
+void* operator new(size_t size)
+{
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+
+  void* p = std::malloc(size != 0 ? size : 1);
+
+  if (!p)
+    throw std::bad_alloc();
+
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  std::free(p);
+}
+
+/* Harness */
+
+struct Measure
+{
+  std::string name;
+  size_t iterations;
+  std::chrono::steady_clock::time_point start;
+  size_t allocations;
+
+  Measure(std::string n, size_t iters)
+    : name(std::move(n)),
+      iterations(iters)
+  {
+    allocations = g_allocations.load();
+    start = std::chrono::steady_clock::now();
+  }
+
+  ~Measure()
+  {
+    auto end = std::chrono::steady_clock::now();
+    size_t allocs = g_allocations.load() - allocations;
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+    std::cout << "  " << name << ": "
+      << (ns / iterations) << " ns/iter, "
+      << (double(allocs) / iterations) << " allocs/iter" << std::endl;
+  }
+};
+
+/* Benchmarks */
+
+static void bench_conditions()
+{
+  liquid::Template tmplt = liquid::parse(
+    "{% for n in numbers %}"
+    "{% if n > 50 and n != 75 %}+{% elsif n == 10 or n < 5 %}-{% else %}.{% endif %}"
+    "{% if forloop.first or forloop.last %}|{% endif %}"
+    "{% endfor %}"
+  );
+
+  liquid::Array numbers;
+
+  for (int i(0); i < 100; ++i)
+    numbers.push(i);
+
+  liquid::Map data;
+  data["numbers"] = numbers;
+
+  liquid::Renderer renderer;
+  renderer.render(tmplt, data);
+
+  const size_t n = 2000;
+  Measure m{ "render 100 iterations x 6 conditions", n };
+
+  for (size_t i(0); i < n; ++i)
+    renderer.render(tmplt, data);
+}
+
+static void bench_arithmetic()
+{
+  liquid::Template tmplt = liquid::parse(
+    "{% for n in numbers %}"
+    "{% assign t = n * 3 + n / 2 - 1 %}"
+    "{% assign u = t * ratio - n + price * n %}"
+    "{% if t > u - 100 %}{{ t }}{% endif %}"
+    "{% endfor %}"
+  );
+
+  liquid::Array numbers;
+
+  for (int i(0); i < 100; ++i)
+    numbers.push(i);
+
+  liquid::Map data;
+  data["numbers"] = numbers;
+  data["price"] = 1999;
+  data["ratio"] = 1.5;
+
+  liquid::Renderer renderer;
+  renderer.render(tmplt, data);
+
+  const size_t n = 2000;
+  Measure m{ "render 100 iterations x 9 arithmetic operations", n };
+
+  for (size_t i(0); i < n; ++i)
+    renderer.render(tmplt, data);
+}
+
+static void bench_parser()
+{
+  std::string condition = "a";
+  std::string chain = "list";
+
+  for (int i(0); i < 100; ++i)
+  {
+    condition += (i % 2 ? " and " : " or ") + std::string("p.values[") + std::to_string(i) + "] >= " + std::to_string(i) + " + n * 2";
+    chain += " | push: " + std::to_string(i) + " | join: ', '";
+  }
+
+  std::string text;
+
+  for (int i(0); i < 50; ++i)
+    text += "{% if " + condition + " %}{{ " + chain + " }}{% endif %}\n";
+
+  const size_t n = 20;
+  auto start = std::chrono::steady_clock::now();
+
+  {
+    Measure m{ "parse templates with long expressions", n };
+
+    for (size_t i(0); i < n; ++i)
+      liquid::parse(text);
+  }
+
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "    " << (double(text.size()) * n / s / 1e6) << " MB/s" << std::endl;
+
+  // a large page, mostly markup with Windows line endings
+  std::string page;
+
+  while (page.size() < 4 * 1024 * 1024)
+  {
+    page += "<tr>\r\n  <td class=\"name\" style=\"padding: 4px 8px; border-bottom: 1px solid #ddd;\">{{ user.name }}</td>\r\n";
+    page += "  <td class=\"mail\"><a href=\"mailto:{{ user.email }}\">{{ user.email }}</a></td>\r\n";
+    page += "  {% if user.active %}<td class=\"active\">yes</td>{% else %}<td>no</td>{% endif %}\r\n</tr>\r\n";
+    page += "<p>Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua.</p>\r\n";
+  }
+
+  const size_t m = 10;
+  start = std::chrono::steady_clock::now();
+
+  {
+    Measure mes{ "parse a 4 MB page with CRLF line endings", m };
+
+    for (size_t i(0); i < m; ++i)
+      liquid::parse(page);
+  }
+
+  s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "    " << (double(page.size()) * m / s / 1e6) << " MB/s" << std::endl;
+}
+
+static void bench_moves()
+{
+  {
+    const size_t n = 100000;
+    Measure m{ "push 100k string values into an array", n };
+
+    liquid::Array array;
+
+    for (size_t i(0); i < n; ++i)
+      array.push(liquid::Value(std::string(32, 'x')));
+  }
+
+  liquid::Template tmplt = liquid::parse(
+    "{% for p in products %}"
+    "{% assign name = p.name %}"
+    "{% assign price = p.price %}"
+    "{% if price > 10 %}{{ name }}{% endif %}"
+    "{% endfor %}"
+  );
+
+  liquid::Array products;
+
+  for (int i(0); i < 100; ++i)
+  {
+    liquid::Map p;
+    p["name"] = "product #" + std::to_string(i);
+    p["price"] = i;
+    products.push(p);
+  }
+
+  liquid::Map data;
+  data["products"] = products;
+
+  liquid::Renderer renderer;
+
+  const size_t n = 2000;
+  Measure m{ "render 100 iterations x 2 assignments", n };
+
+  for (size_t i(0); i < n; ++i)
+    renderer.render(tmplt, data);
+}
+
+template<typename M, typename K>
+static size_t lookup_all(const M& map, const std::vector<K>& keys, size_t rounds)
+{
+  size_t found = 0;
+
+  for (size_t r(0); r < rounds; ++r)
+  {
+    for (const K& k : keys)
+      found += map.find(k) != map.end() ? 1 : 0;
+  }
+
+  return found;
+}
+
+static void bench_maps()
+{
+  const std::vector<std::string> names = {
+    "index", "first", "last", "product", "id", "title", "price", "url", 
+    "description", "vendor", "sku", "stock", "weight", "tags", "image", "variant",
+  };
+
+  for (size_t size : { 1, 3, 8, 40 })
+  {
+    std::map<std::string, liquid::Value> tree;
+    liquid::FlatMap flat;
+    std::vector<std::string> keys;
+
+    for (size_t i(0); i < size; ++i)
+    {
+      std::string key = names.at(i % names.size()) + (i >= names.size() ? std::to_string(i) : std::string());
+      tree[key] = int(i);
+      flat[key] = int(i);
+      keys.push_back(key);
+    }
+
+    keys.push_back("missing");
+
+    std::vector<liquid::Atom> atoms;
+
+    for (const std::string& k : keys)
+      atoms.push_back(liquid::Atom(k));
+
+    const size_t rounds = 200000 / keys.size();
+    const size_t n = rounds * keys.size();
+    size_t found = 0;
+
+    {
+      Measure m{ "std::map lookup, " + std::to_string(size) + " keys", n };
+      found += lookup_all(tree, keys, rounds);
+    }
+
+    {
+      Measure m{ "FlatMap lookup, " + std::to_string(size) + " keys", n };
+      found += lookup_all(flat, keys, rounds);
+    }
+
+    {
+      Measure m{ "FlatMap atom lookup, " + std::to_string(size) + " keys", n };
+      found += lookup_all(flat, atoms, rounds);
+    }
+
+    if (found != 3 * rounds * size)
+      std::cout << "  error: unexpected lookup result" << std::endl;
+  }
+
+  liquid::Template tmplt = liquid::parse(
+    "{% for p in products %}"
+    "{{ p.title }} {{ p.price }} {{ forloop.index }} {{ currency }}"
+    "{% endfor %}"
+  );
+
+  liquid::Array products;
+
+  for (int i(0); i < 100; ++i)
+  {
+    liquid::Map p;
+    p["id"] = i;
+    p["title"] = "product #" + std::to_string(i);
+    p["price"] = i;
+    p["vendor"] = "ACME";
+    products.push(p);
+  }
+
+  liquid::Map data;
+  data["products"] = products;
+  data["currency"] = "EUR";
+
+  liquid::Renderer renderer;
+
+  const size_t n = 2000;
+  Measure m{ "render 100 iterations x 4 variables", n };
+
+  for (size_t i(0); i < n; ++i)
+    renderer.render(tmplt, data);
+}
+
+static void bench_strings()
+{
+  liquid::Template tmplt = liquid::parse(
+    "{% assign s = '' %}"
+    "{% for w in words %}{% assign s = s + w + ', ' %}{% endfor %}"
+    "{{ s }}"
+    "{% capture c %}{% for w in words %}{{ w }}{% endfor %}{% endcapture %}{{ c }}"
+  );
+
+  liquid::Array words;
+
+  for (int i(0); i < 2000; ++i)
+    words.push("word #" + std::to_string(i));
+
+  liquid::Map data;
+  data["words"] = words;
+
+  liquid::Renderer renderer;
+
+  const size_t n = 100;
+  Measure m{ "render 2000 concatenations + capture", n };
+
+  for (size_t i(0); i < n; ++i)
+    renderer.render(tmplt, data);
+}
+
+static void render_in_threads(const liquid::Template& tmplt, const liquid::Map& data, size_t nb_threads, size_t n, bool arena)
+{
+  std::vector<std::thread> threads;
+
+  for (size_t t(0); t < nb_threads; ++t)
+  {
+    threads.emplace_back([&tmplt, &data, n, arena]() {
+      liquid::Renderer renderer;
+      renderer.setArenaEnabled(arena);
+
+      for (size_t i(0); i < n; ++i)
+        renderer.render(tmplt, data);
+    });
+  }
+
+  for (std::thread& t : threads)
+    t.join();
+}
+
+static void bench_arena()
+{
+  liquid::Template tmplt = liquid::parse(
+    "{% for p in products %}"
+    "{% assign label = p.title + ' by ' + p.vendor %}"
+    "{% assign tags = p.tags | push: 'all' %}"
+    "{{ label }}: {{ tags | join: ', ' }} {{ p.price * 2 }}"
+    "{% endfor %}"
+  );
+
+  liquid::Array products;
+
+  for (int i(0); i < 100; ++i)
+  {
+    liquid::Map p;
+    p["title"] = "product #" + std::to_string(i);
+    p["vendor"] = "ACME";
+    p["price"] = i;
+    p["tags"] = liquid::Array({ "new", "sale" });
+    products.push(p);
+  }
+
+  liquid::Map data;
+  data["products"] = products;
+
+  const size_t n = 1000;
+
+  for (size_t nb_threads : { 1, 4 })
+  {
+    {
+      Measure m{ "render, " + std::to_string(nb_threads) + " thread(s), heap", n * nb_threads };
+      render_in_threads(tmplt, data, nb_threads, n, false);
+    }
+
+    {
+      Measure m{ "render, " + std::to_string(nb_threads) + " thread(s), arena", n * nb_threads };
+      render_in_threads(tmplt, data, nb_threads, n, true);
+    }
+  }
+}
+
+static std::string make_catalog_json(int size)
+{
+  std::string text = "[";
+
+  for (int i(0); i < size; ++i)
+  {
+    if (i > 0)
+      text += ",\n";
+
+    text += "{\"id\": " + std::to_string(i) + ", \"title\": \"product #" + std::to_string(i) + "\", "
+      "\"description\": \"A rather long description of the product, as found in most catalogs, with \\\"quotes\\\"\", "
+      "\"price\": " + std::to_string(i) + ".99, \"available\": true, \"vendor\": null, "
+      "\"tags\": [\"new\", \"sale\", \"summer collection\"]}";
+  }
+
+  text += "]";
+  return text;
+}
+
+static void bench_json()
+{
+  std::string text = make_catalog_json(50000);
+
+  const size_t n = 10;
+
+  auto run = [&text, n](const std::string& name, const liquid::json::ParseOptions& opts) {
+    auto start = std::chrono::steady_clock::now();
+
+    {
+      Measure m{ name, n };
+
+      for (size_t i(0); i < n; ++i)
+        liquid::json::parse(text, opts);
+    }
+
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "    " << (double(text.size()) * n / s / 1e9) << " GB/s" << std::endl;
+  };
+
+  liquid::json::ParseOptions options;
+  run("parse " + std::to_string(text.size() / 1000000) + " MB", options);
+
+  options.stringSlices = true;
+  run("parse with string slices", options);
+
+  liquid::Arena* arena = new liquid::Arena{ 1 << 20 };
+  options.arena = arena;
+  run("parse with string slices in an arena", options);
+  arena->deref();
+}
+
+static void bench_streams()
+{
+  const std::string json = make_catalog_json(50000);
+  std::string ndjson = json.substr(1, json.size() - 2);
+
+  for (size_t pos = ndjson.find(",\n"); pos != std::string::npos; pos = ndjson.find(",\n", pos))
+    ndjson.erase(pos, 1);
+
+  liquid::Renderer renderer;
+  liquid::Template tmplt = liquid::parse("{% for p in products %}{{ p.id }};{{ p.title }};{{ p.price }}{% if forloop.last %}.{% endif %}\n{% endfor %}");
+
+  {
+    Measure m{ "materialize 50k records, then render", 50000 };
+
+    liquid::Map data;
+    data["products"] = liquid::json::parse(json);
+    renderer.render(tmplt, data);
+  }
+
+  {
+    Measure m{ "stream 50k NDJSON records while rendering", 50000 };
+
+    liquid::Map data;
+    data["products"] = liquid::json::stream(std::make_shared<std::istringstream>(ndjson));
+    renderer.render(tmplt, data);
+  }
+}
+
+struct Benchmark
+{
+  const char* name;
+  void(*run)();
+};
+
+static void bench_arrays()
+{
+  liquid::Array numbers;
+
+  for (int i(0); i < 100000; ++i)
+    numbers.push(i);
+
+  liquid::Map data;
+  data["numbers"] = numbers;
+
+  liquid::Renderer renderer;
+
+  {
+    liquid::Template tmplt = liquid::parse("{% for n in numbers %}{% endfor %}");
+
+    const size_t n = 20;
+    Measure m{ "iterate over 100k elements", n * 100000 };
+
+    for (size_t i(0); i < n; ++i)
+      renderer.render(tmplt, data);
+  }
+
+  {
+    std::vector<int> source(100000, 1);
+    liquid::Template tmplt = liquid::parse("{% for n in numbers %}{% endfor %}");
+
+    const size_t n = 20;
+    Measure m{ "copy a std::vector of 100k ints and iterate", n * 100000 };
+
+    for (size_t i(0); i < n; ++i)
+    {
+      liquid::Array array;
+
+      for (int x : source)
+        array.push(x);
+
+      liquid::Map copied;
+      copied["numbers"] = array;
+      renderer.render(tmplt, copied);
+    }
+  }
+
+  {
+    std::vector<int> source(100000, 1);
+    liquid::Template tmplt = liquid::parse("{% for n in numbers %}{% endfor %}");
+
+    const size_t n = 20;
+    Measure m{ "borrow a std::vector of 100k ints and iterate", n * 100000 };
+
+    for (size_t i(0); i < n; ++i)
+    {
+      liquid::Map borrowed;
+      borrowed["numbers"] = liquid::borrow(source);
+      renderer.render(tmplt, borrowed);
+    }
+  }
+
+  {
+    liquid::Template tmplt = liquid::parse("{% assign copy = numbers | push: 1 | pop %}");
+
+    const size_t n = 20;
+    Measure m{ "push and pop on 100k elements", n * 100000 };
+
+    for (size_t i(0); i < n; ++i)
+      renderer.render(tmplt, data);
+  }
+}
+
+struct Product
+{
+  int id;
+  std::string name;
+  int price;
+};
+
+LIQUID_REFLECT(Product, id, name, price)
+
+static void bench_persistent()
+{
+  liquid::Array numbers;
+
+  for (int i(0); i < 10000; ++i)
+    numbers.push(i);
+
+  liquid::Map data;
+  data["numbers"] = numbers;
+
+  liquid::Renderer renderer;
+  liquid::Template tmplt = liquid::parse("{% assign list = numbers | push: 1 | push: 2 | pop | push: 3 %}");
+
+  {
+    const size_t n = 200;
+    Measure m{ "push/pop filters on 10k elements", n };
+
+    for (size_t i(0); i < n; ++i)
+      renderer.render(tmplt, data);
+  }
+
+  data["numbers"] = numbers.fork();
+
+  {
+    const size_t n = 200;
+    Measure m{ "push/pop filters on 10k persistent elements", n };
+
+    for (size_t i(0); i < n; ++i)
+      renderer.render(tmplt, data);
+  }
+
+  liquid::Map globals;
+
+  for (int i(0); i < 1000; ++i)
+    globals[std::to_string(i)] = i;
+
+  {
+    const size_t n = 1000;
+    Measure m{ "copy a map of 1000 properties and insert one", n };
+
+    for (size_t i(0); i < n; ++i)
+    {
+      liquid::Map copy{ std::make_shared<liquid::MapValue>(static_cast<liquid::MapValue*>(globals.impl().get())->dict) };
+      copy["foo"] = true;
+    }
+  }
+
+  liquid::Map persistent = globals.fork();
+
+  {
+    const size_t n = 1000;
+    Measure m{ "fork a map of 1000 properties and insert one", n };
+
+    for (size_t i(0); i < n; ++i)
+    {
+      liquid::Map copy = persistent.fork();
+      copy["foo"] = true;
+    }
+  }
+}
+
+static void bench_reflection()
+{
+  std::vector<Product> products;
+
+  for (int i(0); i < 1000; ++i)
+    products.push_back(Product{ i, "product #" + std::to_string(i), i % 20 });
+
+  liquid::Template tmplt = liquid::parse(
+    "{% for p in products %}"
+    "{% if p.price > 10 %}{{ p.id }}: {{ p.name }}{% endif %}"
+    "{% endfor %}"
+  );
+
+  liquid::Renderer renderer;
+  const size_t n = 200;
+
+  {
+    Measure m{ "convert 1000 structs to maps and render", n };
+
+    for (size_t i(0); i < n; ++i)
+    {
+      liquid::Array array;
+
+      for (const Product& p : products)
+      {
+        liquid::Map map;
+        map["id"] = p.id;
+        map["name"] = p.name;
+        map["price"] = p.price;
+        array.push(map);
+      }
+
+      liquid::Map data;
+      data["products"] = array;
+      renderer.render(tmplt, data);
+    }
+  }
+
+  {
+    auto shared = std::make_shared<const std::vector<Product>>(products);
+    Measure m{ "render 1000 reflected structs", n };
+
+    for (size_t i(0); i < n; ++i)
+    {
+      liquid::Map data;
+      data["products"] = liquid::reflect(shared);
+      renderer.render(tmplt, data);
+    }
+  }
+}
+
+static void render_from_threads(const std::string& name, const liquid::Template& tmplt, const liquid::Value& catalog, size_t nbThreads)
+{
+  const size_t n = 40;
+  Measure m{ name + ", " + std::to_string(nbThreads) + " thread(s)", n * nbThreads };
+
+  std::vector<std::thread> threads;
+
+  for (size_t i(0); i < nbThreads; ++i)
+  {
+    threads.emplace_back([&tmplt, &catalog]() {
+      liquid::Renderer renderer;
+      liquid::Map data;
+      data["catalog"] = catalog;
+
+      for (size_t j(0); j < n; ++j)
+        renderer.render(tmplt, data);
+    });
+  }
+
+  for (std::thread& t : threads)
+    t.join();
+}
+
+static void bench_threads()
+{
+  liquid::Array products;
+
+  for (int i(0); i < 1000; ++i)
+  {
+    liquid::Map p;
+    p["name"] = "product #" + std::to_string(i);
+    p["price"] = i % 20;
+    products.push(p);
+  }
+
+  liquid::Map catalog;
+  catalog["products"] = products;
+
+  liquid::Template tmplt = liquid::parse(
+    "{% for p in catalog.products %}"
+    "{% if p.price > 10 %}{{ p.name }}{% endif %}"
+    "{% endfor %}"
+  );
+
+  liquid::Snapshot snapshot = liquid::freeze(catalog);
+  const size_t max_threads = std::max<size_t>(4, std::thread::hardware_concurrency());
+
+  for (size_t t = 1; t <= max_threads; t *= 2)
+  {
+    render_from_threads("render a shared map", tmplt, catalog, t);
+    render_from_threads("render a snapshot", tmplt, snapshot.root(), t);
+  }
+}
+
+static void bench_binary()
+{
+  const std::string text = make_catalog_json(50000);
+  const std::string path = "liquid-bench-snapshot.bin";
+  liquid::binary::save(liquid::json::parse(text), path);
+
+  const size_t n = 5;
+  liquid::Template tmplt = liquid::parse(
+    "{% for p in catalog %}{% if p.id < 1000 %}{{ p.title }}{% endif %}{% endfor %}"
+  );
+
+  auto render = [&tmplt](const liquid::Value& catalog) {
+    liquid::Map data;
+    data["catalog"] = catalog;
+    return tmplt.render(data);
+  };
+
+  {
+    Measure m{ "load " + std::to_string(text.size() / 1000000) + " MB of JSON and render", n };
+
+    for (size_t i(0); i < n; ++i)
+      render(liquid::json::parse(text));
+  }
+
+  {
+    Measure m{ "load a validated binary snapshot and render", n };
+
+    for (size_t i(0); i < n; ++i)
+      render(liquid::binary::Document::open(path).root());
+  }
+
+  {
+    Measure m{ "load a trusted binary snapshot and render", n };
+
+    for (size_t i(0); i < n; ++i)
+      render(liquid::binary::Document::open(path, false).root());
+  }
+
+  std::remove(path.c_str());
+}
+
+static const Benchmark benchmarks[] = {
+  { "conditions", &bench_conditions },
+  { "arithmetic", &bench_arithmetic },
+  { "parser", &bench_parser },
+  { "moves", &bench_moves },
+  { "maps", &bench_maps },
+  { "strings", &bench_strings },
+  { "arena", &bench_arena },
+  { "json", &bench_json },
+  { "streams", &bench_streams },
+  { "arrays", &bench_arrays },
+  { "persistent", &bench_persistent },
+  { "reflection", &bench_reflection },
+  { "threads", &bench_threads },
+  { "binary", &bench_binary },
+};
+
+int main(int argc, char* argv[])
+{
+  for (const Benchmark& b : benchmarks)
+  {
+    bool selected = argc < 2;
+
+    for (int i(1); i < argc; ++i)
+      selected |= std::strcmp(argv[i], b.name) == 0;
+
+    if (!selected)
+      continue;
+
+    std::cout << b.name << std::endl;
+    b.run();
+  }
+
+  return 0;
+}
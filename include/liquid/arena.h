@@ -0,0 +1,168 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef LIQUID_ARENA_H
+#define LIQUID_ARENA_H
+
+#include "liquid/liquid-defs.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace liquid
+{
+
+/*!
+ * \class Arena
+ * \brief a monotonic memory arena
+ *
+ * Memory is obtained by bumping a pointer inside large blocks; it is never
+ * released individually but all at once by \c{reset()} or by the destructor.
+ *
+ * An arena can be made current for a thread with an Arena::Scope.
+ * While an arena is current, the values created by the library are
+ * allocated from it (see \c{allocate_value()}).
+ *
+ * Arenas are reference counted: each object allocated with an ArenaAllocator 
+ * holds a reference to its arena, so that the arena outlives the objects.
+ * An arena created with \c{new} must be released with \c{deref()}.
+ *
+ * Allocating from an arena is not thread-safe: it should only be made 
+ * current on one thread at a time. Objects may be released from any thread.
+ */
+class LIQUID_API Arena
+{
+public:
+  static const size_t default_block_size = 16 * 1024;
+
+  explicit Arena(size_t blockSize = default_block_size);
+  Arena(const Arena&) = delete;
+  ~Arena();
+
+  void* allocate(size_t size, size_t alignment);
+  void reset();
+
+  size_t size() const;
+  size_t capacity() const;
+
+  void ref();
+  void deref();
+  bool isShared() const;
+
+  static Arena* current();
+
+  class LIQUID_API Scope
+  {
+  public:
+    explicit Scope(Arena* arena);
+    Scope(const Scope&) = delete;
+    ~Scope();
+
+  private:
+    Arena* m_previous;
+  };
+
+  Arena& operator=(const Arena&) = delete;
+
+private:
+  struct Block
+  {
+    char* data;
+    size_t size;
+  };
+
+  size_t m_block_size;
+  std::vector<Block> m_blocks;
+  size_t m_current = 0;
+  size_t m_offset = 0;
+  size_t m_size = 0;
+  std::atomic<size_t> m_refs;
+};
+
+/*!
+ * \endclass
+ */
+
+/*!
+ * \class ArenaAllocator
+ * \brief a standard allocator that allocates from an Arena
+ *
+ * Each allocation holds a reference to the arena, which therefore
+ * outlives any object allocated with \c{std::allocate_shared()}.
+ */
+template<typename T>
+class ArenaAllocator
+{
+public:
+  typedef T value_type;
+
+  explicit ArenaAllocator(Arena* arena)
+    : m_arena(arena)
+  {
+
+  }
+
+  template<typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other)
+    : m_arena(other.arena())
+  {
+
+  }
+
+  T* allocate(size_t n)
+  {
+    T* result = static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+    m_arena->ref();
+    return result;
+  }
+
+  void deallocate(T* /* p */, size_t /* n */)
+  {
+    // memory is released when the arena is reset or destroyed
+    m_arena->deref();
+  }
+
+  Arena* arena() const { return m_arena; }
+
+private:
+  Arena* m_arena;
+};
+
+/*!
+ * \endclass
+ */
+
+template<typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs)
+{
+  return lhs.arena() == rhs.arena();
+}
+
+template<typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs)
+{
+  return lhs.arena() != rhs.arena();
+}
+
+/*!
+ * \fn std::shared_ptr<T> allocate_value(Args&&... args)
+ * \brief creates a shared object in the current arena, or on the heap if there is none
+ */
+template<typename T, typename...Args>
+std::shared_ptr<T> allocate_value(Args&&... args)
+{
+  Arena* arena = Arena::current();
+
+  if (arena)
+    return std::allocate_shared<T>(ArenaAllocator<T>(arena), std::forward<Args>(args)...);
+  else
+    return std::make_shared<T>(std::forward<Args>(args)...);
+}
+
+} // namespace liquid
+
+#endif // LIQUID_ARENA_H
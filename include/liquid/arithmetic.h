@@ -0,0 +1,32 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef LIQUID_ARITHMETIC_H
+#define LIQUID_ARITHMETIC_H
+
+#include "liquid/value.h"
+
+namespace liquid
+{
+
+class LIQUID_API Arithmetic
+{
+public:
+  enum Operation
+  {
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Mod,
+  };
+
+  static const size_t OperationCount = Mod + 1;
+
+  static liquid::Value apply(Operation op, const liquid::Value& lhs, const liquid::Value& rhs);
+};
+
+} // namespace liquid
+
+#endif // LIQUID_ARITHMETIC_H
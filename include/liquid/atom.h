@@ -0,0 +1,99 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef LIQUID_ATOM_H
+#define LIQUID_ATOM_H
+
+#include "liquid/liquid-defs.h"
+
+#include <cstdint>
+#include <string>
+
+namespace liquid
+{
+
+/*!
+ * \class Atom
+ * \brief an interned string
+ *
+ * Atoms are used for the names of the variables and properties.
+ * Two atoms created from equal strings share the same storage,
+ * they can therefore be compared by pointer.
+ *
+ * Interning is thread-safe.
+ * Strings interned by the constructors are never released: they should 
+ * be names, not arbitrary data. Keys that come from data, such as the 
+ * keys of a JSON document, use \c{transient()} atoms instead.
+ */
+class LIQUID_API Atom
+{
+public:
+  Atom();
+  Atom(const Atom& other) noexcept;
+  ~Atom();
+
+  explicit Atom(const std::string& str);
+  explicit Atom(const char* str);
+
+  static Atom transient(const std::string& str);
+
+  const std::string& str() const { return data()->str; }
+  size_t hash() const { return data()->hash; }
+  bool isTransient() const { return (m_bits & TransientBit) != 0; }
+
+  Atom& operator=(const Atom& other) noexcept;
+
+  bool operator==(const Atom& other) const { return (m_bits | TransientBit) == (other.m_bits | TransientBit); }
+  bool operator!=(const Atom& other) const { return !(*this == other); }
+
+  struct Data
+  {
+    std::string str;
+    size_t hash;
+  };
+
+private:
+  // the low bit of the pointer marks transient atoms, which hold a reference to the string
+  static const uintptr_t TransientBit = 1;
+
+  const Data* data() const { return reinterpret_cast<const Data*>(m_bits & ~TransientBit); }
+  void ref() const;
+  void deref() const;
+
+private:
+  uintptr_t m_bits;
+};
+
+inline Atom::Atom(const Atom& other) noexcept
+  : m_bits(other.m_bits)
+{
+  if (isTransient())
+    ref();
+}
+
+inline Atom::~Atom()
+{
+  if (isTransient())
+    deref();
+}
+
+inline Atom& Atom::operator=(const Atom& other) noexcept
+{
+  if (other.isTransient())
+    other.ref();
+
+  if (isTransient())
+    deref();
+
+  m_bits = other.m_bits;
+  return *this;
+}
+
+/*!
+ * \endclass
+ */
+
+} // namespace liquid
+
+#endif // LIQUID_ATOM_H
@@ -0,0 +1,68 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef LIQUID_BINARY_H
+#define LIQUID_BINARY_H
+
+#include "liquid/value.h"
+
+#include <memory>
+#include <string>
+
+namespace liquid
+{
+
+namespace binary
+{
+
+LIQUID_API std::string serialize(const Value& value);
+LIQUID_API void save(const Value& value, const std::string& path);
+
+/*!
+ * \class Document
+ * \brief a value tree stored in the binary snapshot format
+ *
+ * The arrays and maps of a document are read directly from its buffer,
+ * which can be a memory-mapped file: nothing is deserialized when the
+ * document is loaded, and processes that map the same file share
+ * its pages.
+ *
+ * The values obtained from a document keep it alive.
+ */
+class LIQUID_API Document
+{
+public:
+  Document();
+  Document(const Document&) = default;
+  Document(Document&&) noexcept = default;
+  ~Document();
+
+  static Document open(const std::string& path, bool validate = true);
+  static Document fromBuffer(std::string buffer, bool validate = true);
+
+  const Value& root() const;
+  size_t size() const;
+
+  Document& operator=(const Document&) = default;
+  Document& operator=(Document&&) noexcept = default;
+
+  struct Data;
+
+private:
+  explicit Document(std::shared_ptr<const Data> data, bool validate);
+
+private:
+  std::shared_ptr<const Data> d;
+  Value m_root;
+};
+
+/*!
+ * \endclass
+ */
+
+} // namespace binary
+
+} // namespace liquid
+
+#endif // LIQUID_BINARY_H
@@ -47,6 +47,7 @@ public:
     ~Scope();
 
     Value& operator[](const std::string& str);
+    Value& operator[](const Atom& name);
 
   private:
     Context* context_;
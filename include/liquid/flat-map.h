@@ -0,0 +1,100 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef LIQUID_FLATMAP_H
+#define LIQUID_FLATMAP_H
+
+#include "liquid/atom.h"
+#include "liquid/value.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace liquid
+{
+
+/*!
+ * \class FlatMap
+ * \brief an insertion-ordered hash map from atoms to values
+ *
+ * Entries are stored contiguously, in insertion order, which is also
+ * the iteration order.
+ * Maps with at most \c{small_size} entries are searched linearly and 
+ * do not compute any hash; larger maps build an open-addressing index 
+ * over the entries.
+ * Looking up an Atom only compares pointers, looking up a string 
+ * compares the hash and the characters but does not intern the string.
+ *
+ * Inserting an element may invalidate iterators and references to
+ * the other elements.
+ */
+class LIQUID_API FlatMap
+{
+public:
+  typedef std::pair<Atom, Value> value_type;
+  typedef std::vector<value_type>::iterator iterator;
+  typedef std::vector<value_type>::const_iterator const_iterator;
+
+  static const size_t small_size = 8;
+
+  FlatMap() = default;
+  FlatMap(const FlatMap&) = default;
+  FlatMap(FlatMap&&) noexcept = default;
+  ~FlatMap() = default;
+
+  template<typename InputIt>
+  FlatMap(InputIt first, InputIt last);
+
+  size_t size() const { return m_entries.size(); }
+  bool empty() const { return m_entries.empty(); }
+
+  iterator begin() { return m_entries.begin(); }
+  iterator end() { return m_entries.end(); }
+  const_iterator begin() const { return m_entries.begin(); }
+  const_iterator end() const { return m_entries.end(); }
+
+  iterator find(const Atom& key);
+  const_iterator find(const Atom& key) const;
+  iterator find(const std::string& key);
+  const_iterator find(const std::string& key) const;
+  size_t count(const Atom& key) const;
+  size_t count(const std::string& key) const;
+
+  std::pair<iterator, bool> emplace(const Atom& key, Value val);
+  Value& operator[](const Atom& key);
+  Value& operator[](const std::string& key);
+
+  void reserve(size_t n);
+  void clear();
+
+  FlatMap& operator=(const FlatMap&) = default;
+  FlatMap& operator=(FlatMap&&) noexcept = default;
+
+private:
+  size_t lookup(const Atom& key) const;
+  size_t lookup(const std::string& key) const;
+  void append(const Atom& key, Value val);
+  void rebuildIndex(size_t capacity);
+
+private:
+  std::vector<value_type> m_entries;
+  std::vector<uint32_t> m_index;
+};
+
+/*!
+ * \endclass
+ */
+
+template<typename InputIt>
+inline FlatMap::FlatMap(InputIt first, InputIt last)
+{
+  for (; first != last; ++first)
+    emplace(Atom::transient(first->first), first->second);
+}
+
+} // namespace liquid
+
+#endif // LIQUID_FLATMAP_H
@@ -0,0 +1,65 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef LIQUID_JSON_H
+#define LIQUID_JSON_H
+
+#include "liquid/value.h"
+
+#include <istream>
+#include <memory>
+#include <string>
+
+namespace liquid
+{
+
+class Arena;
+
+namespace json
+{
+
+/*!
+ * \class ParseOptions
+ * \brief options for the JSON parser
+ */
+struct LIQUID_API ParseOptions
+{
+  /*!
+   * \brief whether strings are stored as slices of the input
+   *
+   * Strings that do not contain escape sequences then share the
+   * buffer of the input instead of being copied; the input is
+   * kept alive as long as one of these strings is.
+   */
+  bool stringSlices = false;
+
+  /*!
+   * \brief the arena from which the values are allocated
+   *
+   * If null, the arena that is current on the calling thread (if any)
+   * is used.
+   */
+  Arena* arena = nullptr;
+
+  /*!
+   * \brief the maximum nesting depth of arrays and objects
+   */
+  size_t maxDepth = 512;
+};
+
+/*!
+ * \endclass
+ */
+
+LIQUID_API Value parse(const std::string& text, const ParseOptions& options = ParseOptions());
+LIQUID_API Value parse(std::string&& text, const ParseOptions& options = ParseOptions());
+
+LIQUID_API Value stream(std::shared_ptr<std::istream> input, const ParseOptions& options = ParseOptions());
+LIQUID_API Value streamFile(const std::string& path, const ParseOptions& options = ParseOptions());
+
+} // namespace json
+
+} // namespace liquid
+
+#endif // LIQUID_JSON_H
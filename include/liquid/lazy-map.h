@@ -0,0 +1,72 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef LIQUID_LAZY_MAP_H
+#define LIQUID_LAZY_MAP_H
+
+#include "liquid/flat-map.h"
+#include "liquid/value.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace liquid
+{
+
+/*!
+ * \class LazyMapValue
+ * \brief a map whose properties can be computed on first access
+ *
+ * A property registered with \c{insertLazy()} is computed by its thunk
+ * the first time it is accessed; the result is cached and returned by
+ * the following accesses.
+ * The thunk is called at most once, even if the map is shared by renders
+ * running concurrently; if it throws, the next access calls it again.
+ *
+ * Properties must be inserted before the map is shared between threads.
+ */
+class LIQUID_API LazyMapValue : public IValue
+{
+public:
+  typedef std::function<Value()> Thunk;
+
+  LazyMapValue();
+  LazyMapValue(const LazyMapValue&) = delete;
+  ~LazyMapValue();
+
+  void insert(const Atom& name, Value val);
+  void insertLazy(const Atom& name, Thunk thunk);
+
+  bool is_map() const override;
+
+  std::type_index type_index() const override;
+  void* data() override;
+
+  std::set<std::string> propertyNames() const override;
+  void forEachProperty(const PropertyCallback& callback) const override;
+  Value property(const std::string& name) const override;
+  Value get(const Atom& name) const override;
+  const Value* find(const std::string& name) const override;
+  const Value* find(const Atom& name) const override;
+
+  LazyMapValue& operator=(const LazyMapValue&) = delete;
+
+private:
+  struct Property;
+  const Value& evaluate(const Property& prop) const;
+  Property& slot(const Atom& name);
+
+private:
+  FlatMap m_index;
+  std::vector<std::unique_ptr<Property>> m_properties;
+};
+
+/*!
+ * \endclass
+ */
+
+} // namespace liquid
+
+#endif // LIQUID_LAZY_MAP_H
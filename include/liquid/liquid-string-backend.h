@@ -6,6 +6,7 @@
 #define LIQUID_STRINGBACKEND_H
 
 
+#include <cstring>
 #include <iterator>
 #include <string>
 
@@ -30,13 +31,33 @@ public:
 
   static string_type normalize(const string_type& str)
   {
-    std::string result = str;
-    size_t pos = result.find("\r\n");
-    while (pos != std::string::npos)
+    return normalize(str.data(), str.size());
+  }
+
+  static string_type normalize(const char_type* str, size_t length)
+  {
+    std::string result;
+    result.reserve(length);
+
+    const char_type* end = str + length;
+
+    // copies the runs between carriage returns at once, memchr() being vectorized
+    for (;;)
     {
-      result.replace(pos, 2, "\n");
-      pos = result.find("\r\n", pos);
+      const char_type* cr = static_cast<const char_type*>(std::memchr(str, '\r', static_cast<size_t>(end - str)));
+
+      if (!cr)
+        break;
+
+      result.append(str, cr);
+
+      if (cr + 1 == end || cr[1] != '\n')
+        result.push_back('\r');
+
+      str = cr + 1;
     }
+
+    result.append(str, end);
     return result;
   }
 
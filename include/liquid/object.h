@@ -16,10 +16,11 @@ class LIQUID_API Object : public templates::Node
 {
 public:
   explicit Object(size_t off = std::numeric_limits<size_t>::max());
+  explicit Object(Kind k, size_t off = std::numeric_limits<size_t>::max());
   ~Object() = default;
 
-  bool isObject() const override { return true; }
   virtual liquid::Value accept(Renderer& renderer) = 0;
+  virtual const liquid::Value* resolve(Renderer& renderer);
 };
 
 } // namespace liquid
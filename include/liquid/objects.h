@@ -13,57 +13,69 @@ namespace liquid
 namespace objects
 {
 
-class Value : public Object
+class Value final : public Object
 {
 public:
   Value(const liquid::Value& val, size_t off = std::numeric_limits<size_t>::max());
   ~Value() = default;
 
+  static const Kind ClassKind = ValueKind;
+
   liquid::Value accept(Renderer& r) override;
+  const liquid::Value* resolve(Renderer& r) override;
 
 public:
   liquid::Value value;
 };
 
-class Variable : public Object
+class Variable final : public Object
 {
 public:
-  Variable(std::string n, size_t off = std::numeric_limits<size_t>::max());
+  Variable(const std::string& n, size_t off = std::numeric_limits<size_t>::max());
   ~Variable() = default;
 
+  static const Kind ClassKind = VariableKind;
+
   liquid::Value accept(Renderer& r) override;
+  const liquid::Value* resolve(Renderer& r) override;
 
 public:
-  std::string name;
+  Atom name;
 };
 
-class ArrayAccess : public Object
+class ArrayAccess final : public Object
 {
 public:
   ArrayAccess(const std::shared_ptr<Object>& obj, const std::shared_ptr<Object>& ind, size_t off = std::numeric_limits<size_t>::max());
   ~ArrayAccess() = default;
 
+  static const Kind ClassKind = ArrayAccessKind;
+
   liquid::Value accept(Renderer& r) override;
+  const liquid::Value* resolve(Renderer& r) override;
 
 public:
   std::shared_ptr<Object> object;
   std::shared_ptr<Object> index;
 };
 
-class MemberAccess : public Object
+class MemberAccess final : public Object
 {
 public:
   MemberAccess(const std::shared_ptr<Object>& obj, const std::string& name, size_t off = std::numeric_limits<size_t>::max());
   ~MemberAccess() = default;
 
+  static const Kind ClassKind = MemberAccessKind;
+
   liquid::Value accept(Renderer& r) override;
+  const liquid::Value* resolve(Renderer& r) override;
 
 public:
   std::shared_ptr<Object> object;
-  std::string name;
+  Atom name;
 };
 
-class BinOp : public Object
+class BinOp final : public Object
 {
 public:
   enum Operation {
@@ -80,11 +92,14 @@ public:
     Sub,
     Mul,
     Div,
+    Mod,
   };
 
   BinOp(Operation op, const std::shared_ptr<Object>& left, const std::shared_ptr<Object>& right, size_t off = std::numeric_limits<size_t>::max());
   ~BinOp() = default;
 
+  static const Kind ClassKind = BinOpKind;
+
   liquid::Value accept(Renderer& r) override;
 
 public:
@@ -93,25 +108,29 @@ public:
   std::shared_ptr<Object> rhs;
 };
 
-class LogicalNot : public Object
+class LogicalNot final : public Object
 {
 public:
   LogicalNot(const std::shared_ptr<Object>& obj, size_t off = std::numeric_limits<size_t>::max());
   ~LogicalNot() = default;
 
+  static const Kind ClassKind = LogicalNotKind;
+
   liquid::Value accept(Renderer& r) override;
 
 public:
   std::shared_ptr<Object> object;
 };
 
-class Pipe : public Object
+class Pipe final : public Object
 {
 public:
   Pipe(const std::shared_ptr<Object>& object, const std::string& filtername, const std::vector<std::shared_ptr<Object>>& args = {}, size_t off = std::numeric_limits<size_t>::max());
   Pipe(const std::shared_ptr<Object>& object, const std::string& filtername, size_t off = std::numeric_limits<size_t>::max());
   ~Pipe() = default;
 
+  static const Kind ClassKind = PipeKind;
+
   liquid::Value accept(Renderer& r) override;
 
 public:
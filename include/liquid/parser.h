@@ -7,6 +7,7 @@
 
 #include "liquid/errors.h"
 #include "liquid/objects.h"
+#include "liquid/tag-registry.h"
 #include "liquid/template.h"
 
 #include <set>
@@ -79,12 +80,40 @@ struct LIQUID_API Token
   inline bool operator!=(const char* str) const { return !(*this == str); }
 };
 
+class LIQUID_API TokenCursor
+{
+public:
+  explicit TokenCursor(const std::vector<Token>& tokens);
+  TokenCursor(const std::vector<Token>& tokens, size_t begin, size_t end);
+
+  bool empty() const { return m_begin == m_end; }
+  size_t size() const { return m_end - m_begin; }
+
+  const Token& front() const;
+  const Token& back() const;
+  const Token& at(size_t index) const;
+
+  const Token& takeFirst();
+  const Token& takeLast();
+
+  TokenCursor mid(size_t offset, size_t count) const;
+  void advance(size_t count);
+
+  size_t endOffset() const;
+
+private:
+  const std::vector<Token>* m_tokens;
+  size_t m_begin;
+  size_t m_end;
+};
+
 class LIQUID_API Tokenizer
 {
 public:
   Tokenizer();
 
   std::vector<Token> tokenize(StringView str);
+  void tokenize(StringView str, std::vector<Token>& tokens);
 
 protected:
   Token read();
@@ -115,54 +144,106 @@ private:
   std::set<char> mPunctuators;
 };
 
+class LIQUID_API DelimiterIndex
+{
+public:
+  enum Kind
+  {
+    ObjectBegin, // {{
+    TagBegin, // {%
+    ObjectEnd, // }}
+    TagEnd, // %}
+  };
+
+  struct Entry
+  {
+    size_t offset;
+    Kind kind;
+  };
+
+  DelimiterIndex();
+
+  void build(const std::string& document);
+
+  size_t findOpening(size_t from, Kind& kind);
+  size_t find(Kind kind, size_t from);
+
+  const std::vector<Entry>& entries() const { return m_entries; }
+
+private:
+  std::vector<Entry> m_entries;
+  size_t m_current;
+};
 
 class LIQUID_API Parser
 {
 public:
   Parser();
+  explicit Parser(std::shared_ptr<const TagRegistry> tags);
   ~Parser();
 
+  const TagRegistry& tags() const { return *mTags; }
+
   std::vector<std::shared_ptr<liquid::templates::Node>> parse(const std::string& document);
+  std::vector<std::shared_ptr<liquid::templates::Node>> parse(const char* document, size_t length);
+
+  const std::shared_ptr<const std::string>& source() const { return mDocument; }
+
+  struct Block
+  {
+    std::shared_ptr<liquid::templates::Node> node;
+    const TagRegistry::Spec* tag;
+  };
+
+  /* Interface for tag handlers */
+  std::shared_ptr<liquid::Object> parseObject(TokenCursor& tokens);
+  virtual void dispatchNode(std::shared_ptr<liquid::templates::Node> n);
+  void openBlock(std::shared_ptr<liquid::templates::Node> block);
+  const Block* currentBlock() const { return mStack.empty() ? nullptr : &mStack.back(); }
+  bool isInBlock(const char* name) const;
 
 protected:
   void readNode();
-  virtual void dispatchNode(std::shared_ptr<liquid::templates::Node> n);
-  inline bool atEnd() const { return mPosition == mDocument.length(); }
+  inline bool atEnd() const { return mPosition == mDocument->length(); }
 
-  virtual void processTag(std::vector<Token> & tokens);
-  std::shared_ptr<liquid::Object> parseObject(std::vector<Token> & tokens);
+  virtual void processTag(TokenCursor& tokens);
+  void closeBlock(const Token& keyword, const TagRegistry::Spec& end);
 
   inline Tokenizer & tokenizer() { return mTokenizer;  }
   inline size_t position() const { return mPosition; }
-  inline const std::string& document() const { return mDocument; }
+  inline const std::string& document() const { return *mDocument; }
 
 protected:
   void process_tag_comment();
   void process_tag_eject();
   void process_tag_discard();
-  void process_tag_assign(const Token& keyword, std::vector<Token>& tokens);
-  void process_tag_if(const Token& keyword, std::vector<Token>& tokens);
-  void process_tag_elsif(const Token& keyword, std::vector<Token>& tokens);
-  void process_tag_else(const Token& keyword, std::vector<Token>& tokens);
-  void process_tag_endif(const Token& keyword, std::vector<Token>& tokens);
-  void process_tag_for(const Token& keyword, std::vector<Token>& tokens);
-  void process_tag_break(const Token& keyword, std::vector<Token>& tokens);
-  void process_tag_continue(const Token& keyword, std::vector<Token>& tokens);
-  void process_tag_endfor(const Token& keyword, std::vector<Token>& tokens);
-  void process_tag_include(const Token& keyword, std::vector<Token>& tokens);
-  void process_tag_capture(const Token& keyword, std::vector<Token>& tokens);
-  void process_tag_endcapture(const Token& keyword, std::vector<Token>& tokens);
-  void process_tag_newline(const Token& keyword, std::vector<Token>& tokens);
+  void process_tag_assign(const Token& keyword, TokenCursor& tokens);
+  void process_tag_if(const Token& keyword, TokenCursor& tokens);
+  void process_tag_elsif(const Token& keyword, TokenCursor& tokens);
+  void process_tag_else(const Token& keyword, TokenCursor& tokens);
+  void process_tag_for(const Token& keyword, TokenCursor& tokens);
+  void process_tag_break(const Token& keyword, TokenCursor& tokens);
+  void process_tag_continue(const Token& keyword, TokenCursor& tokens);
+  void process_tag_include(const Token& keyword, TokenCursor& tokens);
+  void process_tag_capture(const Token& keyword, TokenCursor& tokens);
+  void process_tag_newline(const Token& keyword, TokenCursor& tokens);
 
 protected:
-  const std::vector<std::shared_ptr<liquid::templates::Node>>& stack() const { return mStack; }
+  const std::vector<Block>& stack() const { return mStack; }
+
+private:
+  friend class TagRegistry;
 
 private:
+  std::shared_ptr<const TagRegistry> mTags;
+  const TagRegistry::Spec* mCurrentTag;
   size_t mPosition;
-  std::string mDocument;
+  std::shared_ptr<const std::string> mDocument;
+  DelimiterIndex mDelimiters;
   Tokenizer mTokenizer;
+  std::vector<Token> mTokens;
   std::vector<std::shared_ptr<liquid::templates::Node>> mNodes;
-  std::vector<std::shared_ptr<liquid::templates::Node>> mStack;
+  std::vector<Block> mStack;
 };
 
 } // namespace liquid
@@ -0,0 +1,305 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef LIQUID_REFLECT_H
+#define LIQUID_REFLECT_H
+
+#include "liquid/arena.h"
+#include "liquid/value.h"
+
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/*!
+ * \macro LIQUID_REFLECT(Type, fields...)
+ * \brief exposes the fields of a struct to the renderer
+ *
+ * The macro must be used in the namespace of \c{Type}, after its definition:
+ * \code
+ * struct Product { int id; std::string name; double price; };
+ * LIQUID_REFLECT(Product, id, name, price)
+ * \endcode
+ *
+ * The struct can then be passed to the renderer with \c{liquid::reflect()}.
+ * Up to 16 fields are supported.
+ */
+
+#define LIQUID_REFLECT(Type, ...) \
+  inline const ::liquid::FieldTable<Type>& liquid_fields(const Type*) \
+  { \
+    static const ::liquid::FieldTable<Type> table{ LIQUID_REFLECT_FOR_EACH(LIQUID_REFLECT_FIELD, Type, __VA_ARGS__) }; \
+    return table; \
+  }
+
+#define LIQUID_REFLECT_FIELD(Type, f) \
+  ::liquid::Field<Type>{ ::liquid::Atom(#f), &::liquid::details::get_member<Type, decltype(Type::f), &Type::f> }
+
+#define LIQUID_REFLECT_EXPAND(x) x
+#define LIQUID_REFLECT_FE_1(M, T, x) M(T, x)
+#define LIQUID_REFLECT_FE_2(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_1(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_3(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_2(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_4(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_3(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_5(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_4(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_6(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_5(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_7(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_6(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_8(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_7(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_9(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_8(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_10(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_9(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_11(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_10(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_12(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_11(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_13(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_12(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_14(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_13(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_15(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_14(M, T, __VA_ARGS__))
+#define LIQUID_REFLECT_FE_16(M, T, x, ...) M(T, x), LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_FE_15(M, T, __VA_ARGS__))
+
+#define LIQUID_REFLECT_GET_MACRO(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, NAME, ...) NAME
+
+#define LIQUID_REFLECT_FOR_EACH(M, T, ...) \
+  LIQUID_REFLECT_EXPAND(LIQUID_REFLECT_GET_MACRO(__VA_ARGS__, \
+    LIQUID_REFLECT_FE_16, LIQUID_REFLECT_FE_15, LIQUID_REFLECT_FE_14, LIQUID_REFLECT_FE_13, \
+    LIQUID_REFLECT_FE_12, LIQUID_REFLECT_FE_11, LIQUID_REFLECT_FE_10, LIQUID_REFLECT_FE_9, \
+    LIQUID_REFLECT_FE_8, LIQUID_REFLECT_FE_7, LIQUID_REFLECT_FE_6, LIQUID_REFLECT_FE_5, \
+    LIQUID_REFLECT_FE_4, LIQUID_REFLECT_FE_3, LIQUID_REFLECT_FE_2, LIQUID_REFLECT_FE_1)(M, T, __VA_ARGS__))
+
+namespace liquid
+{
+
+/*!
+ * \class Field
+ * \brief describes a field of a reflected struct
+ */
+template<typename T>
+struct Field
+{
+  Atom name;
+  Value(*get)(const std::shared_ptr<const T>& object);
+};
+
+/*!
+ * \endclass
+ */
+
+/*!
+ * \class FieldTable
+ * \brief the fields of a reflected struct, indexed by a perfect hash
+ *
+ * The table is built once, when the fields are registered.
+ * It looks for a number of slots for which the hashes of the field
+ * names do not collide, so that a lookup costs one hash (already
+ * cached in an Atom), one modulo and one comparison.
+ * If no such number is found, lookups fall back to a linear search.
+ */
+template<typename T>
+class FieldTable
+{
+public:
+  FieldTable(std::initializer_list<Field<T>> fields)
+    : m_fields(fields)
+  {
+    const size_t n = m_fields.size();
+
+    for (size_t size = n; size != 0 && size <= 16 * n + 16; ++size)
+    {
+      std::vector<int> slots(size, -1);
+      bool collision = false;
+
+      for (size_t i(0); i < n && !collision; ++i)
+      {
+        int& slot = slots[m_fields[i].name.hash() % size];
+        collision = slot != -1;
+        slot = static_cast<int>(i);
+      }
+
+      if (!collision)
+      {
+        m_slots = std::move(slots);
+        break;
+      }
+    }
+  }
+
+  const std::vector<Field<T>>& fields() const { return m_fields; }
+
+  const Field<T>* find(const Atom& name) const
+  {
+    if (m_slots.empty())
+    {
+      for (const Field<T>& f : m_fields)
+      {
+        if (f.name == name)
+          return &f;
+      }
+
+      return nullptr;
+    }
+
+    const int i = m_slots[name.hash() % m_slots.size()];
+    return i != -1 && m_fields[i].name == name ? &m_fields[i] : nullptr;
+  }
+
+  const Field<T>* find(const std::string& name) const
+  {
+    if (m_slots.empty())
+    {
+      for (const Field<T>& f : m_fields)
+      {
+        if (f.name.str() == name)
+          return &f;
+      }
+
+      return nullptr;
+    }
+
+    const int i = m_slots[std::hash<std::string>()(name) % m_slots.size()];
+    return i != -1 && m_fields[i].name.str() == name ? &m_fields[i] : nullptr;
+  }
+
+private:
+  std::vector<Field<T>> m_fields;
+  std::vector<int> m_slots;
+};
+
+/*!
+ * \endclass
+ */
+
+template<typename T>
+class ReflectedValue;
+
+namespace details
+{
+
+template<typename T>
+struct is_reflected
+{
+  template<typename U>
+  static auto test(int) -> decltype(liquid_fields(static_cast<const U*>(nullptr)), std::true_type());
+
+  template<typename U>
+  static std::false_type test(...);
+
+  static const bool value = decltype(test<T>(0))::value;
+};
+
+template<typename T, typename M, M T::*Member>
+Value get_member(const std::shared_ptr<const T>& object)
+{
+  return Converter<M>::convert(object, (*object).*Member);
+}
+
+} // namespace details
+
+template<typename T>
+struct Converter<T, typename std::enable_if<details::is_reflected<T>::value>::type>
+{
+  template<typename O>
+  static Value convert(const std::shared_ptr<O>& owner, const T& obj)
+  {
+    return Value(allocate_value<ReflectedValue<T>>(std::shared_ptr<const T>(owner, &obj)));
+  }
+};
+
+/*!
+ * \class ReflectedValue
+ * \brief exposes a struct registered with LIQUID_REFLECT as a map
+ *
+ * Properties are looked up in the FieldTable of the struct and read
+ * directly from its members; the struct is not converted to a Map.
+ */
+template<typename T>
+class ReflectedValue : public IValue
+{
+public:
+  explicit ReflectedValue(std::shared_ptr<const T> object)
+    : m_object(std::move(object))
+  {
+
+  }
+
+  bool is_map() const override
+  {
+    return true;
+  }
+
+  std::type_index type_index() const override
+  {
+    return std::type_index(typeid(T));
+  }
+
+  void* data() override
+  {
+    return const_cast<T*>(m_object.get());
+  }
+
+  std::set<std::string> propertyNames() const override
+  {
+    std::set<std::string> result;
+
+    for (const Field<T>& f : fields().fields())
+      result.insert(f.name.str());
+
+    return result;
+  }
+
+  void forEachProperty(const PropertyCallback& callback) const override
+  {
+    for (const Field<T>& f : fields().fields())
+      callback(f.name.str(), f.get(m_object));
+  }
+
+  Value property(const std::string& name) const override
+  {
+    const Field<T>* f = fields().find(name);
+    return f ? f->get(m_object) : Value();
+  }
+
+  Value get(const Atom& name) const override
+  {
+    const Field<T>* f = fields().find(name);
+    return f ? f->get(m_object) : Value();
+  }
+
+private:
+  static const FieldTable<T>& fields()
+  {
+    return liquid_fields(static_cast<const T*>(nullptr));
+  }
+
+private:
+  std::shared_ptr<const T> m_object;
+};
+
+/*!
+ * \endclass
+ */
+
+/*!
+ * \fn Value reflect(std::shared_ptr<const T> object)
+ * \brief exposes a reflected struct, or a vector of them, without copying it
+ */
+template<typename T>
+Value reflect(std::shared_ptr<const T> object)
+{
+  return share(std::move(object));
+}
+
+/*!
+ * \fn Value reflect(T object)
+ * \brief exposes a reflected struct, or a vector of them, to the renderer
+ *
+ * The object is moved into the returned value.
+ */
+template<typename T>
+Value reflect(T object)
+{
+  return reflect(std::shared_ptr<const T>(std::make_shared<T>(std::move(object))));
+}
+
+} // namespace liquid
+
+#endif // LIQUID_REFLECT_H
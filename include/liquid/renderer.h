@@ -6,6 +6,7 @@
 #define LIQUID_RENDERER_H
 
 #include "liquid/errors.h"
+#include "liquid/arena.h"
 #include "liquid/context.h"
 #include "liquid/objects.h"
 #include "liquid/tags.h"
@@ -27,10 +28,15 @@ class LIQUID_API Renderer
 {
 public:
   Renderer();
+  Renderer(const Renderer&) = delete;
   ~Renderer();
 
   void reset();
 
+  bool isArenaEnabled() const;
+  void setArenaEnabled(bool on = true);
+  Arena* arena() const;
+
   Context& context();
 
   std::map<std::string, Template>& templates();
@@ -39,6 +45,7 @@ public:
   std::string render(const Template& t, const liquid::Map& data);
 
   liquid::Value eval(const std::shared_ptr<Object>& obj);
+  const liquid::Value& eval(const std::shared_ptr<Object>& obj, liquid::Value& storage);
   std::vector<liquid::Value> eval(const std::vector<std::shared_ptr<Object>>& objects);
 
   void process(const std::shared_ptr<Template::Node>& node);
@@ -63,6 +70,8 @@ public:
 
   const std::vector<Error>& errors() const;
 
+  Renderer& operator=(const Renderer&) = delete;
+
   static bool evalCondition(const liquid::Value& val);
 
   /* Tags */
@@ -86,10 +95,18 @@ public:
   liquid::Value visitObject(const objects::LogicalNot& obj);
   liquid::Value visitObject(const objects::Pipe& pipe);
 
+  const liquid::Value* resolveObject(const objects::Value& val);
+  const liquid::Value* resolveObject(const objects::Variable& var);
+  const liquid::Value* resolveObject(const objects::MemberAccess& ma);
+  const liquid::Value* resolveObject(const objects::ArrayAccess& aa);
+
 protected:
   const Template& model() const;
 
   void write(const std::string& str);
+  void write(const char* str, size_t length);
+  virtual void writeString(const liquid::Value& str);
+  void appendString(const liquid::Value& str);
 
   void record(const EvaluationException& ex);
   virtual void log(const EvaluationException& ex);
@@ -110,6 +127,7 @@ protected:
   liquid::Value value_sub(const liquid::Value& lhs, const liquid::Value& rhs) const;
   liquid::Value value_mul(const liquid::Value& lhs, const liquid::Value& rhs) const;
   liquid::Value value_div(const liquid::Value& lhs, const liquid::Value& rhs) const;
+  liquid::Value value_mod(const liquid::Value& lhs, const liquid::Value& rhs) const;
 
   virtual liquid::Value applyFilter(const std::string& name, const liquid::Value& object, const std::vector<liquid::Value>& args);
 
@@ -119,6 +137,8 @@ private:
   std::string m_result;
   std::vector<Error> m_errors;
   std::map<std::string, Template> m_templates;
+  Arena* m_arena;
+  std::vector<std::vector<liquid::Value>> m_arguments_pool;
 };
 
 /*!
@@ -0,0 +1,57 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef LIQUID_SNAPSHOT_H
+#define LIQUID_SNAPSHOT_H
+
+#include "liquid/value.h"
+
+#include <memory>
+
+namespace liquid
+{
+
+/*!
+ * \class Snapshot
+ * \brief an immutable copy of a value tree, for rendering from many threads
+ *
+ * The arrays, maps and strings of a snapshot are laid out in a few large 
+ * blocks owned by the snapshot. The values that refer to them do not own 
+ * them: copying such a value, as the renderer does for variables and 
+ * loop elements, does not modify any reference count. Threads rendering 
+ * the same snapshot therefore do not write to shared memory.
+ *
+ * The values obtained from a snapshot, including \c{root()}, must not 
+ * outlive it. User values that are neither arrays nor maps are not copied 
+ * and keep being shared with their reference count.
+ */
+class LIQUID_API Snapshot
+{
+public:
+  Snapshot();
+  explicit Snapshot(const Value& value);
+  Snapshot(const Snapshot&) = delete;
+  Snapshot(Snapshot&& other) noexcept;
+  ~Snapshot();
+
+  const Value& root() const;
+  size_t size() const;
+
+  Snapshot& operator=(const Snapshot&) = delete;
+  Snapshot& operator=(Snapshot&& other) noexcept;
+
+private:
+  struct Data;
+  std::unique_ptr<Data> d;
+};
+
+/*!
+ * \endclass
+ */
+
+LIQUID_API Snapshot freeze(const Value& value);
+
+} // namespace liquid
+
+#endif // LIQUID_SNAPSHOT_H
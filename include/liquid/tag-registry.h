@@ -0,0 +1,63 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef LIQUID_TAG_REGISTRY_H
+#define LIQUID_TAG_REGISTRY_H
+
+#include "liquid/template.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace liquid
+{
+
+class Parser;
+struct Token;
+class TokenCursor;
+
+class LIQUID_API TagRegistry
+{
+public:
+  typedef std::function<void(Parser& parser, const Token& keyword, TokenCursor& tokens)> Handler;
+  typedef std::function<void(templates::Node& block, std::shared_ptr<templates::Node> node)> Append;
+
+  static const size_t npos = static_cast<size_t>(-1);
+
+  struct Spec
+  {
+    std::string name;
+    Handler handler;
+    Append append; // set for block tags
+    size_t closes = npos; // set for end tags, index of the block tag they close
+  };
+
+  TagRegistry();
+
+  static std::shared_ptr<const TagRegistry> builtins();
+
+  void define(std::string name, Handler handler);
+  void defineBlock(std::string name, Handler handler, Append append, std::string end);
+
+  const Spec* find(const char* name, size_t len) const;
+  const Spec* find(const std::string& name) const { return find(name.data(), name.size()); }
+
+  const Spec& at(size_t index) const { return m_specs.at(index); }
+  size_t size() const { return m_specs.size(); }
+
+private:
+  size_t insert(Spec spec);
+  size_t slot(const char* name, size_t len) const;
+  void rehash();
+
+private:
+  std::vector<Spec> m_specs;
+  std::vector<size_t> m_slots; // index of the spec plus one, 0 for an empty slot
+};
+
+} // namespace liquid
+
+#endif // LIQUID_TAG_REGISTRY_H
@@ -16,8 +16,8 @@ class LIQUID_API Tag : public templates::Node
 {
 public:
   explicit Tag(size_t off = std::numeric_limits<size_t>::max());
+  explicit Tag(Kind k, size_t off = std::numeric_limits<size_t>::max());
 
-  bool isTag() const override { return true; }
   virtual void accept(Renderer& renderer) = 0;
 };
 
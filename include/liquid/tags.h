@@ -15,76 +15,88 @@ namespace liquid
 namespace tags
 {
 
-class Comment : public Tag
+class Comment final : public Tag
 {
 public:
   Comment();
   ~Comment() = default;
 
+  static const Kind ClassKind = CommentKind;
+
   void accept(Renderer& r);
 };
 
-class Assign : public Tag
+class Assign final : public Tag
 {
 public:
   Assign(const std::string& varname, const std::shared_ptr<Object> & expr, size_t off = std::numeric_limits<size_t>::max());
   ~Assign() = default;
 
+  static const Kind ClassKind = AssignKind;
+
   void accept(Renderer& r);
 
 public:
-  std::string variable;
+  Atom variable;
   std::shared_ptr<Object> value;
   bool parent_scope = false;
   bool global_scope = false;
 };
 
-class Capture : public Tag
+class Capture final : public Tag
 {
 public:
   explicit Capture(const std::string& varname, size_t off = std::numeric_limits<size_t>::max());
   ~Capture() = default;
 
+  static const Kind ClassKind = CaptureKind;
+
   void accept(Renderer& r);
 
 public:
-  std::string variable;
+  Atom variable;
   std::vector<std::shared_ptr<templates::Node>> body;
 };
 
-class For : public Tag
+class For final : public Tag
 {
 public:
   For(const std::string& varname, const std::shared_ptr<Object> & expr, size_t off = std::numeric_limits<size_t>::max());
   ~For() = default;
 
+  static const Kind ClassKind = ForKind;
+
   void accept(Renderer& r);
 
 public:
-  std::string variable;
+  Atom variable;
   std::shared_ptr<Object> object;
   std::vector<std::shared_ptr<templates::Node>> body;
 };
 
-class Break : public Tag
+class Break final : public Tag
 {
 public:
   explicit Break(size_t off = std::numeric_limits<size_t>::max());
   ~Break() = default;
 
+  static const Kind ClassKind = BreakKind;
+
   void accept(Renderer& r);
 };
 
-class Continue : public Tag
+class Continue final : public Tag
 {
 public:
   explicit Continue(size_t off = std::numeric_limits<size_t>::max());
   ~Continue() = default;
 
+  static const Kind ClassKind = ContinueKind;
+
   void accept(Renderer& r);
 };
 
-class If : public Tag
+class If final : public Tag
 {
 public:
   struct Block
@@ -96,36 +108,44 @@ public:
   If(std::shared_ptr<Object> cond, size_t off = std::numeric_limits<size_t>::max());
   ~If() = default;
 
+  static const Kind ClassKind = IfKind;
+
   void accept(Renderer& r);
 
 public:
   std::vector<Block> blocks;
 };
 
-class Eject : public Tag
+class Eject final : public Tag
 {
 public:
   Eject();
   ~Eject() = default;
 
+  static const Kind ClassKind = EjectKind;
+
   void accept(Renderer& r);
 };
 
-class Discard : public Tag
+class Discard final : public Tag
 {
 public:
   Discard();
   ~Discard() = default;
 
+  static const Kind ClassKind = DiscardKind;
+
   void accept(Renderer& r);
 };
 
-class Include : public Tag
+class Include final : public Tag
 {
 public:
   explicit Include(std::string n);
   ~Include() = default;
 
+  static const Kind ClassKind = IncludeKind;
+
   void accept(Renderer& r);
 
 public:
@@ -133,12 +153,14 @@ public:
   std::map<std::string, std::shared_ptr<Object>> objects;
 };
 
-class Newline : public Tag
+class Newline final : public Tag
 {
 public:
   explicit Newline(size_t off = std::numeric_limits<size_t>::max());
   ~Newline() = default;
 
+  static const Kind ClassKind = NewlineKind;
+
   void accept(Renderer& r);
 };
 
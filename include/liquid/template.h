@@ -9,6 +9,7 @@
 
 #include "liquid/value.h"
 
+#include <cassert>
 #include <limits>
 #include <memory>
 #include <utility>
@@ -27,40 +28,94 @@ namespace templates
 class LIQUID_API Node
 {
 public:
+  enum Kind
+  {
+    TextKind,
+    /* Objects */
+    ValueKind,
+    VariableKind,
+    ArrayAccessKind,
+    MemberAccessKind,
+    BinOpKind,
+    LogicalNotKind,
+    PipeKind,
+    /* Tags */
+    CommentKind,
+    AssignKind,
+    CaptureKind,
+    ForKind,
+    BreakKind,
+    ContinueKind,
+    IfKind,
+    EjectKind,
+    DiscardKind,
+    IncludeKind,
+    NewlineKind,
+    /* Custom nodes */
+    UserNodeKind = 0x100,
+    UserObjectKind = 0x200,
+    UserTagKind = 0x300,
+  };
+
   virtual ~Node() = default;
 
-  explicit Node(size_t off = std::numeric_limits<size_t>::max()) : m_offset(off) { }
+  explicit Node(size_t off = std::numeric_limits<size_t>::max()) : m_kind(UserNodeKind), m_offset(off) { }
+  explicit Node(Kind k, size_t off = std::numeric_limits<size_t>::max()) : m_kind(k), m_offset(off) { }
+
+  Kind kind() const { return m_kind; }
 
   template<typename T>
-  bool is() const { return dynamic_cast<const T*>(this) != nullptr; }
+  bool is() const { return is_node<T>(this, 0); }
 
   template<typename T>
-  const T& as() const { return *dynamic_cast<const T*>(this); }
+  const T& as() const { assert(is<T>()); return *static_cast<const T*>(this); }
 
   template<typename T>
-  T& as() { return *dynamic_cast<T*>(this); }
+  T& as() { assert(is<T>()); return *static_cast<T*>(this); }
 
-  virtual bool isText() const;
-  virtual bool isTag() const;
-  virtual bool isObject() const;
+  bool isText() const { return m_kind == TextKind; }
+  bool isTag() const { return (m_kind >= CommentKind && m_kind <= NewlineKind) || m_kind >= UserTagKind; }
+  bool isObject() const { return (m_kind >= ValueKind && m_kind <= PipeKind) || (m_kind >= UserObjectKind && m_kind < UserTagKind); }
 
   size_t offset() const { return m_offset; }
   void setOffset(size_t off) { m_offset = off;  }
 
 private:
+  // built-in classes are final and are identified by their kind; custom classes, 
+  // whose kind may be shared with derived classes or undeclared, by dynamic_cast
+  template<typename T>
+  static auto is_node(const Node* n, int) -> decltype(T::ClassKind, bool())
+  {
+    return T::ClassKind < UserNodeKind ? n->m_kind == T::ClassKind : dynamic_cast<const T*>(n) != nullptr;
+  }
+
+  template<typename T>
+  static bool is_node(const Node* n, long)
+  {
+    return dynamic_cast<const T*>(n) != nullptr;
+  }
+
+private:
+  Kind m_kind;
   size_t m_offset;
 };
 
-class LIQUID_API TextNode : public Node
+class LIQUID_API TextNode final : public Node
 {
 public:
-  TextNode(std::string str, size_t off = std::numeric_limits<size_t>::max());
+  explicit TextNode(std::string str, size_t off = std::numeric_limits<size_t>::max());
+  TextNode(std::shared_ptr<const std::string> src, size_t pos, size_t len, size_t off = std::numeric_limits<size_t>::max());
   ~TextNode() = default;
 
-  bool isText() const override;
+  static const Kind ClassKind = TextKind;
+
+  const char* data() const { return source->data() + position; }
+  std::string text() const { return std::string(data(), length); }
 
 public:
-  std::string text;
+  std::shared_ptr<const std::string> source;
+  size_t position;
+  size_t length;
 };
 
 } // namespace templates
@@ -110,6 +165,7 @@ public:
   typedef templates::Node Node;
 
   Template(std::string src, std::vector<std::shared_ptr<templates::Node>> nodes, std::string filepath = {});
+  Template(std::shared_ptr<const std::string> src, std::vector<std::shared_ptr<templates::Node>> nodes, std::string filepath = {});
 
   const std::string& filePath() const;
   const std::string& source() const;
@@ -129,6 +185,8 @@ public:
 
   static void lstrip(std::string& str) noexcept;
   static void rstrip(std::string& str) noexcept;
+  static void lstrip(templates::TextNode& text) noexcept;
+  static void rstrip(templates::TextNode& text) noexcept;
 
   void stripWhitespacesAtTag();
   void skipWhitespacesAfterTag();
@@ -138,7 +196,7 @@ public:
 
 private:
   std::string mFilePath;
-  std::string mSource;
+  std::shared_ptr<const std::string> mSource;
   std::vector<std::shared_ptr<templates::Node>> mNodes;
 };
 
@@ -147,6 +205,7 @@ private:
  */
 
 LIQUID_API Template parse(const std::string& str, std::string filepath = {});
+LIQUID_API Template parse(const char* str, size_t length, std::string filepath = {});
 LIQUID_API Template parseFile(std::string filepath);
 
 /*!
@@ -7,13 +7,20 @@
 
 #include "liquid/liquid-defs.h"
 
+#include "liquid/arena.h"
+#include "liquid/atom.h"
+
 #include <cassert>
+#include <functional>
+#include <limits>
 #include <map>
 #include <memory>
 #include <set>
 #include <string>
 #include <typeindex>
+#include <type_traits>
 #include <typeinfo>
+#include <unordered_map>
 #include <vector>
 
 /*!
@@ -27,6 +34,8 @@ class Value;
 class Array;
 class Map;
 
+typedef std::function<void(const std::string& name, const Value& value)> PropertyCallback;
+
 /*!
  * \class IValue
  * \brief provides an interface for the Value class
@@ -67,7 +76,18 @@ public:
   virtual Value at(size_t index) const;
 
   virtual std::set<std::string> propertyNames() const;
+  virtual void forEachProperty(const PropertyCallback& callback) const;
   virtual Value property(const std::string& name) const;
+  virtual Value get(const Atom& name) const;
+
+  virtual const Value* find(size_t index) const;
+  virtual const Value* find(const std::string& name) const;
+  virtual const Value* find(const Atom& name) const;
+
+  virtual const Value* chunk(size_t offset, size_t& count) const;
+
+  virtual bool is_stream() const;
+  virtual bool next(Value& element);
 };
 
 /*!
@@ -101,6 +121,9 @@ public:
 /*!
  * \class Value
  * \brief holds a value that can be used by the renderer
+ * 
+ * Null, boolean, integer and real values are stored inline and do not 
+ * require any memory allocation; other values are stored in a shared IValue.
  */
 
 class LIQUID_API Value
@@ -108,11 +131,14 @@ class LIQUID_API Value
 public:
   Value();
   Value(const Value&) = default;
+  Value(Value&& other) noexcept;
   ~Value() = default;
   
   Value(std::nullptr_t);
   Value(bool b);
   Value(int n);
+  Value(long n);
+  Value(long long n);
   Value(double x);
   Value(std::string str);
   Value(const char* str);
@@ -123,6 +149,22 @@ public:
   explicit Value(std::shared_ptr<IValue> impl);
 
   static const std::shared_ptr<IValue> null_impl;
+  static const Value null_value;
+
+  enum Kind
+  {
+    NullKind,
+    BooleanKind,
+    IntegerKind,
+    Integer64Kind,
+    NumberKind,
+    StringKind,
+    ArrayKind,
+    MapKind,
+    UserKind,
+  };
+
+  Kind kind() const { return m_kind; }
 
   bool isNull() const;
   bool isArray() const;
@@ -141,15 +183,40 @@ public:
   template<typename T>
   T& as() const;
 
+  template<typename Visitor>
+  auto visit(Visitor&& visitor) const -> decltype(visitor(nullptr));
+
   size_t length() const;
   Value at(size_t index) const;
 
   std::set<std::string> propertyNames() const;
+  void forEachProperty(const PropertyCallback& callback) const;
   Value property(const std::string& name) const;
+  Value property(const Atom& name) const;
 
-  const std::shared_ptr<IValue>& impl() const;
+  const Value* find(size_t index) const;
+  const Value* find(const std::string& name) const;
+  const Value* find(const Atom& name) const;
+
+  const Value* chunk(size_t offset, size_t& count) const;
+
+  std::shared_ptr<IValue> impl() const;
+  const IValue* get() const;
+
+  Value& operator=(const Value&) = default;
+  Value& operator=(Value&& other) noexcept;
 
 private:
+  union Data
+  {
+    bool boolean;
+    int integer;
+    long long integer64;
+    double number;
+  };
+
+  Kind m_kind;
+  mutable Data m_data;
   std::shared_ptr<IValue> d;
 };
 
@@ -167,6 +234,7 @@ class LIQUID_API Array
 public:
   Array();
   Array(const Array&) = default;
+  Array(Array&&) noexcept = default;
   ~Array() = default;
 
   Array(std::vector<Value> vals);
@@ -175,9 +243,17 @@ public:
 
   size_t length() const;
   Value at(size_t index) const;
+  const Value* find(size_t index) const;
+  const Value* chunk(size_t offset, size_t& count) const;
+
+  template<typename F>
+  void forEach(F&& f) const;
 
   bool isWritable() const;
   void push(Value val);
+  void pop();
+
+  Array fork() const;
 
   Value& operator[](size_t index);
 
@@ -185,6 +261,9 @@ public:
 
   const std::shared_ptr<IValue>& impl() const;
 
+  Array& operator=(const Array&) = default;
+  Array& operator=(Array&&) noexcept = default;
+
 private:
   std::shared_ptr<IValue> d;
 };
@@ -203,6 +282,7 @@ class LIQUID_API Map
 public:
   Map();
   Map(const Map&) = default;
+  Map(Map&&) noexcept = default;
   ~Map() = default;
 
   Map(std::map<std::string, Value> dict);
@@ -211,17 +291,28 @@ public:
   explicit Map(std::shared_ptr<IValue> impl);
 
   std::set<std::string> propertyNames() const;
+  void forEachProperty(const PropertyCallback& callback) const;
   Value property(const std::string& name) const;
+  Value property(const Atom& name) const;
+  const Value* find(const std::string& name) const;
+  const Value* find(const Atom& name) const;
 
   bool isWritable() const;
   void insert(const std::string& name, Value val);
+  void insert(const Atom& name, Value val);
+
+  Map fork() const;
 
   Value& operator[](const std::string& name);
+  Value& operator[](const Atom& name);
 
   operator Value() const;
 
   const std::shared_ptr<IValue>& impl() const;
 
+  Map& operator=(const Map&) = default;
+  Map& operator=(Map&&) noexcept = default;
+
 private:
   std::shared_ptr<IValue> d;
 };
@@ -237,18 +328,430 @@ LIQUID_API int compare(const Value& lhs, const Value& rhs);
 namespace liquid
 {
 
+inline Value::Value(Value&& other) noexcept
+  : m_kind(other.m_kind),
+    m_data(other.m_data),
+    d(std::move(other.d))
+{
+  other.m_kind = NullKind;
+}
+
+inline Value& Value::operator=(Value&& other) noexcept
+{
+  m_kind = other.m_kind;
+  m_data = other.m_data;
+  d = std::move(other.d);
+  other.m_kind = NullKind;
+  return *this;
+}
+
+namespace details
+{
+
+template<typename T> struct value_kind { static const Value::Kind value = Value::UserKind; };
+template<> struct value_kind<std::nullptr_t> { static const Value::Kind value = Value::NullKind; };
+template<> struct value_kind<bool> { static const Value::Kind value = Value::BooleanKind; };
+template<> struct value_kind<int> { static const Value::Kind value = Value::IntegerKind; };
+template<> struct value_kind<long long> { static const Value::Kind value = Value::Integer64Kind; };
+template<> struct value_kind<double> { static const Value::Kind value = Value::NumberKind; };
+template<> struct value_kind<std::string> { static const Value::Kind value = Value::StringKind; };
+
+} // namespace details
+
 template<typename T>
 inline bool Value::is() const
 {
-  return d->type_index() == std::type_index(typeid(T));
+  return details::value_kind<T>::value != UserKind ? 
+    m_kind == details::value_kind<T>::value : 
+    typeIndex() == std::type_index(typeid(T));
 }
 
 template<typename T>
 inline T& Value::as() const
 {
   assert(is<T>());
-  void* data = d->data();
-  return *reinterpret_cast<T*>(data);
+  return *reinterpret_cast<T*>(data());
+}
+
+/*!
+ * \fn auto visit(Visitor&& visitor) const
+ * \param the visitor
+ * \brief calls the visitor with the content of the value
+ *
+ * The visitor is called once, with an argument whose type depends 
+ * on the kind of the value: \c{std::nullptr_t}, \c{bool}, \c{int}, 
+ * \c{long long} for integers that do not fit in an \c{int}, 
+ * \c{double}, \c{const std::string&}, \c{const Array&}, \c{const Map&} 
+ * or, for user types, the \c{const Value&} itself.
+ * 
+ * The visitor should provide an overload for each of these types.
+ */
+template<typename Visitor>
+inline auto Value::visit(Visitor&& visitor) const -> decltype(visitor(nullptr))
+{
+  switch (m_kind)
+  {
+  case BooleanKind:
+    return visitor(m_data.boolean);
+  case IntegerKind:
+    return visitor(m_data.integer);
+  case Integer64Kind:
+    return visitor(m_data.integer64);
+  case NumberKind:
+    return visitor(m_data.number);
+  case StringKind:
+    return visitor(as<std::string>());
+  case ArrayKind:
+    return visitor(toArray());
+  case MapKind:
+    return visitor(toMap());
+  case UserKind:
+    return visitor(*this);
+  default:
+    return visitor(nullptr);
+  }
+}
+
+/*!
+ * \fn void forEach(F&& f) const
+ * \param the function
+ * \brief calls a function with each element of the array, in order
+ *
+ * Elements that are stored contiguously (see \c{IValue::chunk()}) are 
+ * passed by reference without being copied; the others are retrieved 
+ * with \c{at()}.
+ */
+template<typename F>
+inline void Array::forEach(F&& f) const
+{
+  if (d->is_stream())
+  {
+    Value element;
+
+    while (d->next(element))
+      f(element);
+
+    return;
+  }
+
+  const size_t n = d->length();
+  size_t i = 0;
+
+  while (i < n)
+  {
+    size_t count = 0;
+    const Value* elements = d->chunk(i, count);
+
+    if (elements && count > 0)
+    {
+      const size_t end = (count < n - i) ? i + count : n;
+
+      for (; i < end; ++i, ++elements)
+        f(*elements);
+    }
+    else
+    {
+      f(d->at(i++));
+    }
+  }
+}
+
+/*!
+ * \class BorrowedValue
+ * \brief exposes an object owned by someone else without copying it
+ *
+ * The object is kept alive by the shared pointer, which may be an
+ * aliasing pointer into a larger object, or a non-owning pointer 
+ * for borrowed data.
+ */
+template<typename T>
+class BorrowedValue : public IValue
+{
+public:
+  explicit BorrowedValue(std::shared_ptr<const T> obj)
+    : m_object(std::move(obj))
+  {
+
+  }
+
+  std::type_index type_index() const override
+  {
+    return std::type_index(typeid(T));
+  }
+
+  void* data() override
+  {
+    return const_cast<T*>(m_object.get());
+  }
+
+private:
+  std::shared_ptr<const T> m_object;
+};
+
+/*!
+ * \endclass
+ */
+
+template<typename C, typename Conv>
+class ArrayAdapter;
+
+template<typename C, typename Conv>
+class MapAdapter;
+
+/*!
+ * \class Converter
+ * \brief converts the elements of adapted containers to values
+ *
+ * \c{convert(owner, elem)} returns a Value for \a elem, which is stored
+ * in the object held by \a owner; an aliasing pointer to \a owner 
+ * can therefore be used to share \a elem instead of copying it.
+ *
+ * Numbers and booleans are stored in the value, strings and 
+ * standard containers are shared; other types must be constructible 
+ * to a Value. The converter can be specialized for user types.
+ */
+template<typename T, typename = void>
+struct Converter
+{
+  template<typename O>
+  static Value convert(const std::shared_ptr<O>& /* owner */, const T& elem)
+  {
+    return Value(elem);
+  }
+};
+
+/*!
+ * \endclass
+ */
+
+template<typename T>
+struct Converter<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+{
+  template<typename O>
+  static Value convert(const std::shared_ptr<O>& /* owner */, const T& elem)
+  {
+    // integers that do not fit in a long long, i.e. large unsigned ones, are stored as doubles
+    if (std::is_unsigned<T>::value && sizeof(T) >= sizeof(long long) && static_cast<unsigned long long>(elem) > static_cast<unsigned long long>(std::numeric_limits<long long>::max()))
+      return Value(static_cast<double>(elem));
+
+    return Value(static_cast<long long>(elem));
+  }
+};
+
+template<typename T>
+struct Converter<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+  template<typename O>
+  static Value convert(const std::shared_ptr<O>& /* owner */, const T& elem)
+  {
+    return Value(static_cast<double>(elem));
+  }
+};
+
+template<>
+struct Converter<std::string>
+{
+  template<typename O>
+  static Value convert(const std::shared_ptr<O>& owner, const std::string& elem)
+  {
+    return Value(allocate_value<BorrowedValue<std::string>>(std::shared_ptr<const std::string>(owner, &elem)));
+  }
+};
+
+template<typename U, typename A>
+struct Converter<std::vector<U, A>>
+{
+  typedef std::vector<U, A> container_type;
+
+  template<typename O>
+  static Value convert(const std::shared_ptr<O>& owner, const container_type& elem)
+  {
+    return Value(allocate_value<ArrayAdapter<container_type, Converter<U>>>(std::shared_ptr<const container_type>(owner, &elem)));
+  }
+};
+
+template<typename V, typename C, typename A>
+struct Converter<std::map<std::string, V, C, A>>
+{
+  typedef std::map<std::string, V, C, A> container_type;
+
+  template<typename O>
+  static Value convert(const std::shared_ptr<O>& owner, const container_type& elem)
+  {
+    return Value(allocate_value<MapAdapter<container_type, Converter<V>>>(std::shared_ptr<const container_type>(owner, &elem)));
+  }
+};
+
+template<typename V, typename H, typename E, typename A>
+struct Converter<std::unordered_map<std::string, V, H, E, A>>
+{
+  typedef std::unordered_map<std::string, V, H, E, A> container_type;
+
+  template<typename O>
+  static Value convert(const std::shared_ptr<O>& owner, const container_type& elem)
+  {
+    return Value(allocate_value<MapAdapter<container_type, Converter<V>>>(std::shared_ptr<const container_type>(owner, &elem)));
+  }
+};
+
+namespace details
+{
+
+template<typename C>
+inline const Value* contiguous_chunk(const C& /* container */, size_t /* offset */, size_t& count)
+{
+  count = 0;
+  return nullptr;
+}
+
+template<typename A>
+inline const Value* contiguous_chunk(const std::vector<Value, A>& container, size_t offset, size_t& count)
+{
+  count = offset < container.size() ? container.size() - offset : 0;
+  return container.data() + (offset < container.size() ? offset : container.size());
+}
+
+} // namespace details
+
+/*!
+ * \class ArrayAdapter
+ * \brief exposes a random-access container as an array without copying it
+ *
+ * Elements are converted with \c{Conv::convert()} when they are accessed.
+ */
+template<typename C, typename Conv = Converter<typename C::value_type>>
+class ArrayAdapter : public IValue
+{
+public:
+  explicit ArrayAdapter(std::shared_ptr<const C> container)
+    : m_container(std::move(container))
+  {
+
+  }
+
+  bool is_array() const override
+  {
+    return true;
+  }
+
+  std::type_index type_index() const override
+  {
+    return std::type_index(typeid(C));
+  }
+
+  void* data() override
+  {
+    return const_cast<C*>(m_container.get());
+  }
+
+  size_t length() const override
+  {
+    return m_container->size();
+  }
+
+  Value at(size_t index) const override
+  {
+    return index < m_container->size() ? Conv::convert(m_container, (*m_container)[index]) : Value();
+  }
+
+  const Value* chunk(size_t offset, size_t& count) const override
+  {
+    return details::contiguous_chunk(*m_container, offset, count);
+  }
+
+private:
+  std::shared_ptr<const C> m_container;
+};
+
+/*!
+ * \endclass
+ */
+
+/*!
+ * \class MapAdapter
+ * \brief exposes an associative container with string keys as a map without copying it
+ *
+ * Values are converted with \c{Conv::convert()} when they are accessed.
+ */
+template<typename C, typename Conv = Converter<typename C::mapped_type>>
+class MapAdapter : public IValue
+{
+public:
+  explicit MapAdapter(std::shared_ptr<const C> container)
+    : m_container(std::move(container))
+  {
+
+  }
+
+  bool is_map() const override
+  {
+    return true;
+  }
+
+  std::type_index type_index() const override
+  {
+    return std::type_index(typeid(C));
+  }
+
+  void* data() override
+  {
+    return const_cast<C*>(m_container.get());
+  }
+
+  std::set<std::string> propertyNames() const override
+  {
+    std::set<std::string> result;
+
+    for (const auto& e : *m_container)
+      result.insert(e.first);
+
+    return result;
+  }
+
+  void forEachProperty(const PropertyCallback& callback) const override
+  {
+    for (const auto& e : *m_container)
+      callback(e.first, Conv::convert(m_container, e.second));
+  }
+
+  Value property(const std::string& name) const override
+  {
+    auto it = m_container->find(name);
+    return it != m_container->end() ? Conv::convert(m_container, it->second) : Value();
+  }
+
+private:
+  std::shared_ptr<const C> m_container;
+};
+
+/*!
+ * \endclass
+ */
+
+/*!
+ * \fn Value share(std::shared_ptr<const T> object)
+ * \brief exposes an object to the renderer without copying it
+ *
+ * The returned value shares the ownership of the object.
+ * Standard containers are exposed with an ArrayAdapter or a MapAdapter.
+ */
+template<typename T>
+inline Value share(std::shared_ptr<const T> object)
+{
+  return Converter<T>::convert(object, *object);
+}
+
+/*!
+ * \fn Value borrow(const T& object)
+ * \brief exposes an object to the renderer without copying it
+ *
+ * The returned value does not own the object: the object must outlive
+ * the value and every value obtained from it.
+ */
+template<typename T>
+inline Value borrow(const T& object)
+{
+  return share(std::shared_ptr<const T>(std::shared_ptr<const T>(), &object));
 }
 
 /*!
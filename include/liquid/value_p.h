@@ -11,9 +11,12 @@
 #define LIQUID_VALUE_P_H
 
 #include "liquid/value.h"
+#include "liquid/flat-map.h"
 
-#include <vector>
+#include <atomic>
 #include <map>
+#include <mutex>
+#include <vector>
 
 namespace liquid
 {
@@ -27,6 +30,48 @@ public:
   std::type_index type_index() const override;
 };
 
+class LIQUID_API StringValue : public IValue
+{
+public:
+  explicit StringValue(std::string str);
+  StringValue(std::shared_ptr<StringValue> str, size_t pos, size_t len);
+  StringValue(std::shared_ptr<StringValue> lhs, std::shared_ptr<StringValue> rhs);
+  ~StringValue();
+
+  static const size_t min_rope_size = 64;
+
+  static Value slice(const Value& str, size_t pos, size_t len);
+  static Value concat(const Value& lhs, const Value& rhs);
+
+  std::type_index type_index() const override;
+  void* data() override;
+
+  size_t size() const { return m_size; }
+  const std::string& str() const;
+  void appendTo(std::string& out) const;
+
+private:
+  static std::shared_ptr<StringValue> get(const Value& str);
+  void flatten() const;
+
+private:
+  enum Form
+  {
+    Flat,
+    Slice,
+    Concatenation,
+  };
+
+  Form m_form;
+  size_t m_size;
+  size_t m_offset = 0;
+  std::shared_ptr<StringValue> m_left;
+  std::shared_ptr<StringValue> m_right;
+  mutable std::string m_str;
+  mutable std::once_flag m_flatten_flag;
+  mutable std::atomic<bool> m_flat;
+};
+
 class LIQUID_API VectorValue : public IValue
 {
 public:
@@ -43,16 +88,84 @@ public:
 
   size_t length() const override;
   Value at(size_t index) const override;
+  const Value* find(size_t index) const override;
+  const Value* chunk(size_t offset, size_t& count) const override;
 };
 
 class LIQUID_API MapValue : public IValue
 {
 public:
-  std::map<std::string, Value> dict;
+  FlatMap dict;
 
 public:
   MapValue();
-  explicit MapValue(std::map<std::string, Value> m);
+  explicit MapValue(FlatMap m);
+  explicit MapValue(const std::map<std::string, Value>& m);
+
+  bool is_map() const override;
+
+  std::type_index type_index() const override;
+  void* data() override;
+
+  std::set<std::string> propertyNames() const override;
+  void forEachProperty(const PropertyCallback& callback) const override;
+  Value property(const std::string& name) const override;
+  Value get(const Atom& name) const override;
+  const Value* find(const std::string& name) const override;
+  const Value* find(const Atom& name) const override;
+};
+
+/*
+ * Persistent arrays and maps never modify their nodes once they are
+ * shared: updates copy the path from the root to the modified element
+ * and share the rest of the structure with the previous version.
+ */
+
+class LIQUID_API PersistentArrayValue : public IValue
+{
+public:
+  struct Node;
+
+  PersistentArrayValue();
+  explicit PersistentArrayValue(const std::vector<Value>& values);
+  ~PersistentArrayValue();
+
+  static std::shared_ptr<PersistentArrayValue> from(const Array& array);
+
+  bool is_array() const override;
+
+  std::type_index type_index() const override;
+  void* data() override;
+
+  size_t length() const override;
+  Value at(size_t index) const override;
+  const Value* find(size_t index) const override;
+  const Value* chunk(size_t offset, size_t& count) const override;
+
+  std::shared_ptr<PersistentArrayValue> pushed(Value val) const;
+  std::shared_ptr<PersistentArrayValue> popped() const;
+  std::shared_ptr<PersistentArrayValue> updated(size_t index, Value val) const;
+
+private:
+  size_t tailOffset() const;
+  const std::shared_ptr<const Node>& leafFor(size_t index) const;
+
+private:
+  size_t m_size = 0;
+  unsigned m_shift = 5;
+  std::shared_ptr<const Node> m_root;
+  std::shared_ptr<const Node> m_tail;
+};
+
+class LIQUID_API PersistentMapValue : public IValue
+{
+public:
+  struct Node;
+
+  PersistentMapValue();
+  ~PersistentMapValue();
+
+  static std::shared_ptr<PersistentMapValue> from(const Map& map);
 
   bool is_map() const override;
 
@@ -60,7 +173,19 @@ public:
   void* data() override;
 
   std::set<std::string> propertyNames() const override;
+  void forEachProperty(const PropertyCallback& callback) const override;
   Value property(const std::string& name) const override;
+  Value get(const Atom& name) const override;
+  const Value* find(const std::string& name) const override;
+  const Value* find(const Atom& name) const override;
+
+  size_t size() const { return m_size; }
+
+  std::shared_ptr<PersistentMapValue> inserted(const Atom& name, Value val) const;
+
+private:
+  size_t m_size = 0;
+  std::shared_ptr<const Node> m_root;
 };
 
 } // namespace liquid
@@ -0,0 +1,181 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "liquid/arena.h"
+
+#include <new>
+
+namespace liquid
+{
+
+static thread_local Arena* g_current_arena = nullptr;
+
+/*!
+ * \class Arena
+ */
+
+const size_t Arena::default_block_size;
+
+/*!
+ * \fn Arena(size_t blockSize)
+ * \brief constructs an arena
+ *
+ * No memory is allocated until the first call to \c{allocate()}.
+ * The arena starts with one reference, owned by its creator.
+ */
+Arena::Arena(size_t blockSize)
+  : m_block_size(blockSize),
+    m_refs(1)
+{
+
+}
+
+Arena::~Arena()
+{
+  for (const Block& b : m_blocks)
+    ::operator delete(b.data);
+}
+
+/*!
+ * \fn void* allocate(size_t size, size_t alignment)
+ * \brief allocates memory from the arena
+ *
+ * Requests that are larger than the block size get a block of their own.
+ */
+void* Arena::allocate(size_t size, size_t alignment)
+{
+  for (;;)
+  {
+    if (m_current < m_blocks.size())
+    {
+      const Block& b = m_blocks[m_current];
+      size_t offset = (m_offset + alignment - 1) & ~(alignment - 1);
+
+      if (offset + size <= b.size)
+      {
+        m_offset = offset + size;
+        m_size += size;
+        return b.data + offset;
+      }
+
+      if (m_current + 1 < m_blocks.size())
+      {
+        ++m_current;
+        m_offset = 0;
+        continue;
+      }
+    }
+
+    // memory returned by operator new is suitably aligned for any fundamental type
+    Block b;
+    b.size = size > m_block_size ? size : m_block_size;
+    b.data = static_cast<char*>(::operator new(b.size));
+    m_blocks.push_back(b);
+    m_current = m_blocks.size() - 1;
+    m_offset = 0;
+  }
+}
+
+/*!
+ * \fn void reset()
+ * \brief makes all the memory of the arena available again
+ *
+ * The blocks are kept for the next allocations.
+ * The objects allocated from the arena must have been destroyed.
+ */
+void Arena::reset()
+{
+  m_current = 0;
+  m_offset = 0;
+  m_size = 0;
+}
+
+/*!
+ * \fn size_t size() const
+ * \brief returns the number of bytes allocated since the last reset
+ */
+size_t Arena::size() const
+{
+  return m_size;
+}
+
+/*!
+ * \fn size_t capacity() const
+ * \brief returns the size of all the blocks owned by the arena
+ */
+size_t Arena::capacity() const
+{
+  size_t result = 0;
+
+  for (const Block& b : m_blocks)
+    result += b.size;
+
+  return result;
+}
+
+/*!
+ * \fn void ref()
+ * \brief increments the reference count of the arena
+ */
+void Arena::ref()
+{
+  m_refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*!
+ * \fn void deref()
+ * \brief decrements the reference count, deleting the arena when it reaches zero
+ */
+void Arena::deref()
+{
+  if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    delete this;
+}
+
+/*!
+ * \fn bool isShared() const
+ * \brief returns whether objects allocated from the arena are still alive
+ *
+ * An arena that is not shared can be safely reset.
+ */
+bool Arena::isShared() const
+{
+  return m_refs.load(std::memory_order_acquire) > 1;
+}
+
+/*!
+ * \fn static Arena* current()
+ * \brief returns the current arena of the calling thread
+ *
+ * Returns nullptr if no arena is current.
+ */
+Arena* Arena::current()
+{
+  return g_current_arena;
+}
+
+/*!
+ * \class Arena::Scope
+ * \brief makes an arena current for the lifetime of the scope
+ *
+ * Scopes can be nested; the previous arena is restored when the scope
+ * is destroyed.
+ * Passing a null pointer disables arena allocation within the scope.
+ */
+Arena::Scope::Scope(Arena* arena)
+  : m_previous(g_current_arena)
+{
+  g_current_arena = arena;
+}
+
+Arena::Scope::~Scope()
+{
+  g_current_arena = m_previous;
+}
+
+/*!
+ * \endclass
+ */
+
+} // namespace liquid
@@ -0,0 +1,233 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "liquid/arithmetic.h"
+
+#include "liquid/errors.h"
+#include "liquid/filters.h"
+#include "liquid/value_p.h"
+
+#include <climits>
+#include <cmath>
+#include <type_traits>
+
+namespace liquid
+{
+
+namespace
+{
+
+typedef Value(*Kernel)(const Value&, const Value&);
+
+const size_t kind_count = Value::UserKind + 1;
+
+const char* const symbols[Arithmetic::OperationCount] = { "+", "-", "*", "/", "%" };
+
+/*
+ * The integer operations return false if the result does not fit in
+ * a long long; the operation is then performed on doubles.
+ */
+
+inline bool checked_add(long long a, long long b, long long& r)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return !__builtin_add_overflow(a, b, &r);
+#else
+  if ((b > 0 && a > LLONG_MAX - b) || (b < 0 && a < LLONG_MIN - b))
+    return false;
+
+  r = a + b;
+  return true;
+#endif
+}
+
+inline bool checked_sub(long long a, long long b, long long& r)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return !__builtin_sub_overflow(a, b, &r);
+#else
+  if ((b < 0 && a > LLONG_MAX + b) || (b > 0 && a < LLONG_MIN + b))
+    return false;
+
+  r = a - b;
+  return true;
+#endif
+}
+
+inline bool checked_mul(long long a, long long b, long long& r)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return !__builtin_mul_overflow(a, b, &r);
+#else
+  if (a > 0 ? (b > 0 ? a > LLONG_MAX / b : b < LLONG_MIN / a)
+            : (b > 0 ? a < LLONG_MIN / b : (a != 0 && b < LLONG_MAX / a)))
+    return false;
+
+  r = a * b;
+  return true;
+#endif
+}
+
+struct AddOp
+{
+  static bool integer(long long a, long long b, long long& r) { return checked_add(a, b, r); }
+  static double real(double a, double b) { return a + b; }
+};
+
+struct SubOp
+{
+  static bool integer(long long a, long long b, long long& r) { return checked_sub(a, b, r); }
+  static double real(double a, double b) { return a - b; }
+};
+
+struct MulOp
+{
+  static bool integer(long long a, long long b, long long& r) { return checked_mul(a, b, r); }
+  static double real(double a, double b) { return a * b; }
+};
+
+struct DivOp
+{
+  static bool integer(long long a, long long b, long long& r)
+  {
+    if (b == 0)
+      throw EvaluationException{ "division by zero" };
+
+    if (a == LLONG_MIN && b == -1)
+      return false;
+
+    r = a / b;
+    return true;
+  }
+
+  static double real(double a, double b) { return a / b; }
+};
+
+struct ModOp
+{
+  static bool integer(long long a, long long b, long long& r)
+  {
+    if (b == 0)
+      throw EvaluationException{ "division by zero" };
+
+    r = (b == -1) ? 0 : a % b;
+    return true;
+  }
+
+  static double real(double a, double b) { return std::fmod(a, b); }
+};
+
+template<typename Op>
+Value compute(long long a, long long b)
+{
+  long long r;
+
+  if (Op::integer(a, b, r))
+    return Value(r);
+
+  return Value(Op::real(static_cast<double>(a), static_cast<double>(b)));
+}
+
+template<typename Op>
+Value compute(double a, double b)
+{
+  return Value(Op::real(a, b));
+}
+
+template<typename Op, typename L, typename R>
+Value numeric_kernel(const Value& lhs, const Value& rhs)
+{
+  // integers are computed on 64 bits, so that 32-bit operands never overflow
+  typedef typename std::conditional<std::is_integral<L>::value && std::is_integral<R>::value, long long, double>::type Common;
+  return compute<Op>(static_cast<Common>(lhs.as<L>()), static_cast<Common>(rhs.as<R>()));
+}
+
+Value string_concat(const Value& lhs, const Value& rhs)
+{
+  return StringValue::concat(lhs, rhs);
+}
+
+Value array_concat(const Value& lhs, const Value& rhs)
+{
+  return ArrayFilters::concat(lhs.toArray(), rhs.toArray());
+}
+
+struct KernelTable
+{
+  Kernel kernels[Arithmetic::OperationCount][kind_count][kind_count];
+
+  KernelTable()
+  {
+    for (size_t op(0); op < Arithmetic::OperationCount; ++op)
+    {
+      for (size_t l(0); l < kind_count; ++l)
+      {
+        for (size_t r(0); r < kind_count; ++r)
+          kernels[op][l][r] = nullptr;
+      }
+    }
+
+    fill<AddOp>(kernels[Arithmetic::Add]);
+    fill<SubOp>(kernels[Arithmetic::Sub]);
+    fill<MulOp>(kernels[Arithmetic::Mul]);
+    fill<DivOp>(kernels[Arithmetic::Div]);
+    fill<ModOp>(kernels[Arithmetic::Mod]);
+
+    kernels[Arithmetic::Add][Value::StringKind][Value::StringKind] = &string_concat;
+    kernels[Arithmetic::Add][Value::ArrayKind][Value::ArrayKind] = &array_concat;
+  }
+
+  template<typename Op>
+  static void fill(Kernel (&k)[kind_count][kind_count])
+  {
+    k[Value::IntegerKind][Value::IntegerKind] = &numeric_kernel<Op, int, int>;
+    k[Value::IntegerKind][Value::Integer64Kind] = &numeric_kernel<Op, int, long long>;
+    k[Value::IntegerKind][Value::NumberKind] = &numeric_kernel<Op, int, double>;
+    k[Value::Integer64Kind][Value::IntegerKind] = &numeric_kernel<Op, long long, int>;
+    k[Value::Integer64Kind][Value::Integer64Kind] = &numeric_kernel<Op, long long, long long>;
+    k[Value::Integer64Kind][Value::NumberKind] = &numeric_kernel<Op, long long, double>;
+    k[Value::NumberKind][Value::IntegerKind] = &numeric_kernel<Op, double, int>;
+    k[Value::NumberKind][Value::Integer64Kind] = &numeric_kernel<Op, double, long long>;
+    k[Value::NumberKind][Value::NumberKind] = &numeric_kernel<Op, double, double>;
+  }
+};
+
+const KernelTable kernel_table;
+
+} // namespace
+
+/*!
+ * \class Arithmetic
+ * \brief implements the arithmetic operators of the template language
+ */
+
+/*!
+ * \fn static liquid::Value apply(Operation op, const liquid::Value& lhs, const liquid::Value& rhs)
+ * \brief applies an arithmetic operator to two values
+ *
+ * The operation is looked up in a table indexed by the kinds of the
+ * operands, so that it costs a single indirect call.
+ *
+ * Integers are computed on 64 bits: the result is an \c{int} if it
+ * fits, a \c{long long} otherwise, and a \c{double} if the operation
+ * overflows 64 bits. Integer division and modulo truncate toward zero
+ * and throw an EvaluationException if the divisor is zero.
+ *
+ * Strings and arrays can be concatenated with the \c{+} operator.
+ */
+liquid::Value Arithmetic::apply(Operation op, const liquid::Value& lhs, const liquid::Value& rhs)
+{
+  Kernel kernel = kernel_table.kernels[op][lhs.kind()][rhs.kind()];
+
+  if (!kernel)
+    throw EvaluationException{ std::string("operator ") + symbols[op] + " cannot proceed with given operands" };
+
+  return kernel(lhs, rhs);
+}
+
+/*!
+ * \endclass
+ */
+
+} // namespace liquid
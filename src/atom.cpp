@@ -0,0 +1,182 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "liquid/atom.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace liquid
+{
+
+namespace
+{
+
+// transient atoms count their references, the other ones make the entry permanent
+struct Entry : Atom::Data
+{
+  Entry(const std::string& s, size_t h)
+    : Atom::Data{ s, h },
+      refs(0),
+      permanent(false)
+  {
+
+  }
+
+  mutable std::atomic<size_t> refs;
+  bool permanent;
+};
+
+class AtomTable
+{
+public:
+  static AtomTable& instance()
+  {
+    static AtomTable table;
+    return table;
+  }
+
+  const Atom::Data* intern(const std::string& str, bool transient)
+  {
+    const size_t hash = std::hash<std::string>()(str);
+    Shard& shard = m_shards[hash % NbShards];
+
+    std::lock_guard<std::mutex> lock{ shard.mutex };
+
+    std::unique_ptr<Entry>& entry = shard.atoms[str];
+
+    if (!entry)
+      entry.reset(new Entry{ str, hash });
+
+    if (transient)
+      entry->refs.fetch_add(1, std::memory_order_relaxed);
+    else
+      entry->permanent = true;
+
+    return entry.get();
+  }
+
+  void release(const Atom::Data* data)
+  {
+    Entry* entry = static_cast<Entry*>(const_cast<Atom::Data*>(data));
+
+    // the last reference is released under the lock, so that 
+    // intern() cannot return an entry that is being erased
+    size_t refs = entry->refs.load(std::memory_order_relaxed);
+
+    while (refs > 1)
+    {
+      if (entry->refs.compare_exchange_weak(refs, refs - 1, std::memory_order_acq_rel))
+        return;
+    }
+
+    Shard& shard = m_shards[entry->hash % NbShards];
+
+    std::lock_guard<std::mutex> lock{ shard.mutex };
+
+    if (entry->refs.fetch_sub(1, std::memory_order_acq_rel) == 1 && !entry->permanent)
+      shard.atoms.erase(shard.atoms.find(entry->str));
+  }
+
+private:
+  // sharding reduces contention when several threads create maps
+  static const size_t NbShards = 16;
+
+  struct Shard
+  {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<Entry>> atoms;
+  };
+
+  Shard m_shards[NbShards];
+};
+
+} // namespace
+
+/*!
+ * \class Atom
+ */
+
+/*!
+ * \fn Atom()
+ * \brief constructs the atom for the empty string
+ */
+Atom::Atom()
+{
+  static const Data* empty = AtomTable::instance().intern(std::string(), false);
+  m_bits = reinterpret_cast<uintptr_t>(empty);
+}
+
+/*!
+ * \fn Atom(const std::string& str)
+ * \brief interns a string
+ */
+Atom::Atom(const std::string& str)
+  : m_bits(reinterpret_cast<uintptr_t>(AtomTable::instance().intern(str, false)))
+{
+
+}
+
+/*!
+ * \fn Atom(const char* str)
+ * \brief interns a string
+ */
+Atom::Atom(const char* str)
+  : m_bits(reinterpret_cast<uintptr_t>(AtomTable::instance().intern(std::string(str), false)))
+{
+
+}
+
+/*!
+ * \fn static Atom transient(const std::string& str)
+ * \brief interns a string until the last transient atom referring to it is destroyed
+ *
+ * A transient atom compares equal to the atoms created from the same 
+ * string, but copying it updates a reference count. The string is 
+ * released with the last transient atom, unless it was also interned 
+ * by a constructor.
+ */
+Atom Atom::transient(const std::string& str)
+{
+  Atom result;
+  result.m_bits = reinterpret_cast<uintptr_t>(AtomTable::instance().intern(str, true)) | TransientBit;
+  return result;
+}
+
+/*!
+ * \fn bool isTransient() const
+ * \brief returns whether the atom was created by \c{transient()}
+ */
+
+void Atom::ref() const
+{
+  static_cast<const Entry*>(data())->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Atom::deref() const
+{
+  AtomTable::instance().release(data());
+}
+
+/*!
+ * \fn const std::string& str() const
+ * \brief returns the interned string
+ */
+
+/*!
+ * \fn size_t hash() const
+ * \brief returns the hash of the string
+ *
+ * The hash is computed once, when the string is interned; 
+ * it is equal to \c{std::hash<std::string>()(str())}.
+ */
+
+/*!
+ * \endclass
+ */
+
+} // namespace liquid
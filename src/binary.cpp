@@ -0,0 +1,734 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "liquid/binary.h"
+
+#include "liquid/arena.h"
+#include "liquid/parser.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Format of a binary snapshot (version 2)
+ *
+ * All integers are stored in the byte order of the machine that wrote
+ * the snapshot, which is recorded in the header. Records are aligned
+ * on 8 bytes.
+ *
+ * Header (32 bytes):
+ *   char[4] magic "LQBS", u32 version, u32 byte order mark, u32 reserved,
+ *   u64 root reference, u64 size of the snapshot
+ *
+ * A reference is a u64 whose 3 low bits are a tag:
+ *   null (0), boolean (1, value in bit 3), integer (2, value in the
+ *   high 32 bits); for double (3), string (4), array (5), map (6) and
+ *   64-bit integer (7), the other bits are the offset of a record.
+ *
+ * Records:
+ *   double: the 8 bytes of the number
+ *   64-bit integer: the 8 bytes of the integer
+ *   string: u32 length, u32 reserved, characters, padding
+ *   array:  u64 count, count references
+ *   map:    u64 count, count entries { u64 key hash, u64 key reference,
+ *           u64 value reference }, sorted by hash
+ *
+ * The writer emits the records of the elements before the record of
+ * their container, so that references always point backwards; strings
+ * are deduplicated. Keys are hashed with 64-bit FNV-1a.
+ *
+ * Version 2 added 64-bit integers; version 1 snapshots are still read.
+ */
+
+namespace liquid
+{
+
+namespace binary
+{
+
+namespace
+{
+
+const char magic[4] = { 'L', 'Q', 'B', 'S' };
+const uint32_t format_version = 2;
+const uint32_t byte_order_mark = 0x01020304;
+const size_t header_size = 32;
+const size_t map_entry_size = 24;
+
+enum Tag
+{
+  NullTag,
+  BooleanTag,
+  IntegerTag,
+  NumberTag,
+  StringTag,
+  ArrayTag,
+  MapTag,
+  Integer64Tag,
+};
+
+uint64_t key_hash(const char* str, size_t len)
+{
+  uint64_t h = 14695981039346656037ull;
+
+  for (size_t i(0); i < len; ++i)
+  {
+    h ^= static_cast<unsigned char>(str[i]);
+    h *= 1099511628211ull;
+  }
+
+  return h;
+}
+
+Tag tag_of(uint64_t ref)
+{
+  return static_cast<Tag>(ref & 7);
+}
+
+size_t offset_of(uint64_t ref)
+{
+  return static_cast<size_t>(ref & ~uint64_t(7));
+}
+
+class Writer
+{
+public:
+  std::string out;
+
+public:
+  Writer()
+  {
+    out.resize(header_size);
+  }
+
+  uint64_t write(const Value& val)
+  {
+    switch (val.kind())
+    {
+    case Value::NullKind:
+      return NullTag;
+    case Value::BooleanKind:
+      return BooleanTag | (val.as<bool>() ? 8 : 0);
+    case Value::IntegerKind:
+      return IntegerTag | (uint64_t(uint32_t(val.as<int>())) << 32);
+    case Value::Integer64Kind:
+    {
+      size_t offset = align();
+      put(val.as<long long>());
+      return offset | Integer64Tag;
+    }
+    case Value::NumberKind:
+    {
+      size_t offset = align();
+      put(val.as<double>());
+      return offset | NumberTag;
+    }
+    case Value::StringKind:
+      return writeString(val.as<std::string>());
+    case Value::ArrayKind:
+      return writeArray(val.toArray());
+    case Value::MapKind:
+      return writeMap(val);
+    default:
+      throw std::runtime_error{ "binary snapshot: values of type " + std::string(val.typeIndex().name()) + " cannot be serialized" };
+    }
+  }
+
+  void finish(uint64_t root)
+  {
+    std::memcpy(&out[0], magic, 4);
+    std::memcpy(&out[4], &format_version, 4);
+    std::memcpy(&out[8], &byte_order_mark, 4);
+    std::memset(&out[12], 0, 4);
+    std::memcpy(&out[16], &root, 8);
+    uint64_t size = out.size();
+    std::memcpy(&out[24], &size, 8);
+  }
+
+private:
+  size_t align()
+  {
+    out.resize((out.size() + 7) & ~size_t(7), '\0');
+    return out.size();
+  }
+
+  template<typename T>
+  void put(const T& val)
+  {
+    out.append(reinterpret_cast<const char*>(&val), sizeof(T));
+  }
+
+  uint64_t writeString(const std::string& str)
+  {
+    auto it = m_strings.find(str);
+
+    if (it != m_strings.end())
+      return it->second;
+
+    size_t offset = align();
+    put(uint32_t(str.size()));
+    put(uint32_t(0));
+    out.append(str);
+
+    uint64_t ref = offset | StringTag;
+    m_strings[str] = ref;
+    return ref;
+  }
+
+  uint64_t writeArray(const Array& array)
+  {
+    std::vector<uint64_t> refs;
+    refs.reserve(array.length());
+
+    array.forEach([this, &refs](const Value& elem) {
+      refs.push_back(write(elem));
+    });
+
+    size_t offset = align();
+    put(uint64_t(refs.size()));
+    out.append(reinterpret_cast<const char*>(refs.data()), refs.size() * sizeof(uint64_t));
+    return offset | ArrayTag;
+  }
+
+  struct Entry
+  {
+    uint64_t hash;
+    uint64_t key;
+    uint64_t value;
+    std::string name;
+  };
+
+  uint64_t writeMap(const Value& map)
+  {
+    std::vector<Entry> entries;
+
+    map.forEachProperty([this, &entries](const std::string& name, const Value& value) {
+      uint64_t key = writeString(name);
+      entries.push_back(Entry{ key_hash(name.data(), name.size()), key, write(value), name });
+    });
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+      return a.hash < b.hash || (a.hash == b.hash && a.name < b.name);
+    });
+
+    size_t offset = align();
+    put(uint64_t(entries.size()));
+
+    for (const Entry& e : entries)
+    {
+      put(e.hash);
+      put(e.key);
+      put(e.value);
+    }
+
+    return offset | MapTag;
+  }
+
+private:
+  std::unordered_map<std::string, uint64_t> m_strings;
+};
+
+} // namespace
+
+struct Document::Data
+{
+  const char* begin = nullptr;
+  size_t size = 0;
+  std::string buffer;
+  void* mapping = nullptr;
+
+  Data() = default;
+  Data(const Data&) = delete;
+
+  ~Data()
+  {
+#if !defined(_WIN32)
+    if (mapping)
+      munmap(mapping, size);
+#endif
+  }
+
+  uint64_t read64(size_t offset) const
+  {
+    uint64_t result;
+    std::memcpy(&result, begin + offset, 8);
+    return result;
+  }
+
+  uint32_t read32(size_t offset) const
+  {
+    uint32_t result;
+    std::memcpy(&result, begin + offset, 4);
+    return result;
+  }
+};
+
+namespace
+{
+
+typedef std::shared_ptr<const Document::Data> DocumentPtr;
+
+Value decode(const DocumentPtr& doc, uint64_t ref);
+
+class BinaryArray : public IValue
+{
+public:
+  BinaryArray(DocumentPtr doc, size_t offset)
+    : m_doc(std::move(doc)),
+      m_offset(offset)
+  {
+
+  }
+
+  bool is_array() const override
+  {
+    return true;
+  }
+
+  std::type_index type_index() const override
+  {
+    return std::type_index(typeid(BinaryArray));
+  }
+
+  void* data() override
+  {
+    return this;
+  }
+
+  size_t length() const override
+  {
+    return static_cast<size_t>(m_doc->read64(m_offset));
+  }
+
+  Value at(size_t index) const override
+  {
+    if (index >= length())
+      return Value();
+
+    return decode(m_doc, m_doc->read64(m_offset + 8 + 8 * index));
+  }
+
+private:
+  DocumentPtr m_doc;
+  size_t m_offset;
+};
+
+class BinaryMap : public IValue
+{
+public:
+  BinaryMap(DocumentPtr doc, size_t offset)
+    : m_doc(std::move(doc)),
+      m_offset(offset)
+  {
+
+  }
+
+  bool is_map() const override
+  {
+    return true;
+  }
+
+  std::type_index type_index() const override
+  {
+    return std::type_index(typeid(BinaryMap));
+  }
+
+  void* data() override
+  {
+    return this;
+  }
+
+  std::set<std::string> propertyNames() const override
+  {
+    std::set<std::string> result;
+
+    for (size_t i(0); i < count(); ++i)
+      result.insert(key(i));
+
+    return result;
+  }
+
+  void forEachProperty(const PropertyCallback& callback) const override
+  {
+    for (size_t i(0); i < count(); ++i)
+      callback(key(i), decode(m_doc, m_doc->read64(entry(i) + 16)));
+  }
+
+  Value property(const std::string& name) const override
+  {
+    const uint64_t h = key_hash(name.data(), name.size());
+
+    // binary search of the first entry with the hash
+    size_t lo = 0, hi = count();
+
+    while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (m_doc->read64(entry(mid)) < h)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    for (; lo < count() && m_doc->read64(entry(lo)) == h; ++lo)
+    {
+      size_t k = offset_of(m_doc->read64(entry(lo) + 8));
+
+      if (m_doc->read32(k) == name.size() && std::memcmp(m_doc->begin + k + 8, name.data(), name.size()) == 0)
+        return decode(m_doc, m_doc->read64(entry(lo) + 16));
+    }
+
+    return Value();
+  }
+
+private:
+  size_t count() const
+  {
+    return static_cast<size_t>(m_doc->read64(m_offset));
+  }
+
+  size_t entry(size_t i) const
+  {
+    return m_offset + 8 + map_entry_size * i;
+  }
+
+  std::string key(size_t i) const
+  {
+    size_t k = offset_of(m_doc->read64(entry(i) + 8));
+    return std::string(m_doc->begin + k + 8, m_doc->read32(k));
+  }
+
+private:
+  DocumentPtr m_doc;
+  size_t m_offset;
+};
+
+Value decode(const DocumentPtr& doc, uint64_t ref)
+{
+  switch (tag_of(ref))
+  {
+  case BooleanTag:
+    return Value((ref & 8) != 0);
+  case IntegerTag:
+    return Value(static_cast<int>(static_cast<uint32_t>(ref >> 32)));
+  case NumberTag:
+  {
+    double x;
+    std::memcpy(&x, doc->begin + offset_of(ref), 8);
+    return Value(x);
+  }
+  case Integer64Tag:
+  {
+    long long n;
+    std::memcpy(&n, doc->begin + offset_of(ref), 8);
+    return Value(n);
+  }
+  case StringTag:
+  {
+    size_t offset = offset_of(ref);
+    return Value(std::string(doc->begin + offset + 8, doc->read32(offset)));
+  }
+  case ArrayTag:
+    return Value(allocate_value<BinaryArray>(doc, offset_of(ref)));
+  case MapTag:
+    return Value(allocate_value<BinaryMap>(doc, offset_of(ref)));
+  default:
+    return Value();
+  }
+}
+
+class Validator
+{
+public:
+  explicit Validator(const Document::Data& doc)
+    : m_doc(doc)
+  {
+
+  }
+
+  uint64_t validateHeader()
+  {
+    if (m_doc.size < header_size || std::memcmp(m_doc.begin, magic, 4) != 0)
+      fail(0, "not a binary snapshot");
+
+    if (m_doc.read32(4) == 0 || m_doc.read32(4) > format_version)
+      fail(4, "unsupported version");
+
+    if (m_doc.read32(8) != byte_order_mark)
+      fail(8, "unsupported byte order");
+
+    if (m_doc.read64(24) != m_doc.size)
+      fail(24, "size mismatch, the snapshot may be truncated");
+
+    return m_doc.read64(16);
+  }
+
+  void validate(uint64_t root)
+  {
+    // references point backwards, so the traversal terminates; each reference
+    // is stored once in a valid snapshot, which bounds the number of visits
+    const size_t max_visits = m_doc.size / 8;
+    size_t visits = 0;
+    std::vector<std::pair<uint64_t, size_t>> pending{ { root, m_doc.size } };
+
+    while (!pending.empty())
+    {
+      uint64_t ref = pending.back().first;
+      size_t limit = pending.back().second;
+      pending.pop_back();
+
+      if (++visits > max_visits)
+        fail(0, "too many references");
+
+      const size_t offset = offset_of(ref);
+
+      switch (tag_of(ref))
+      {
+      case NullTag:
+      case BooleanTag:
+      case IntegerTag:
+        break;
+      case NumberTag:
+      case Integer64Tag:
+        checkRecord(offset, limit, 8);
+        break;
+      case StringTag:
+        checkString(offset, limit);
+        break;
+      case ArrayTag:
+      {
+        checkRecord(offset, limit, 8);
+        uint64_t n = m_doc.read64(offset);
+
+        if (n > (m_doc.size - offset - 8) / 8)
+          fail(offset, "array out of bounds");
+
+        for (size_t i(0); i < n; ++i)
+          pending.emplace_back(m_doc.read64(offset + 8 + 8 * i), offset);
+      }
+        break;
+      case MapTag:
+      {
+        checkRecord(offset, limit, 8);
+        uint64_t n = m_doc.read64(offset);
+
+        if (n > (m_doc.size - offset - 8) / map_entry_size)
+          fail(offset, "map out of bounds");
+
+        uint64_t previous_hash = 0;
+
+        for (size_t i(0); i < n; ++i)
+        {
+          size_t e = offset + 8 + map_entry_size * i;
+          uint64_t h = m_doc.read64(e);
+          uint64_t key = m_doc.read64(e + 8);
+
+          if (tag_of(key) != StringTag)
+            fail(e, "map key is not a string");
+
+          checkString(offset_of(key), offset);
+          size_t k = offset_of(key);
+
+          if (key_hash(m_doc.begin + k + 8, m_doc.read32(k)) != h || (i > 0 && h < previous_hash))
+            fail(e, "invalid map entry");
+
+          previous_hash = h;
+          pending.emplace_back(m_doc.read64(e + 16), offset);
+        }
+      }
+        break;
+      default:
+        fail(offset, "invalid reference");
+      }
+    }
+  }
+
+private:
+  [[noreturn]] void fail(size_t offset, const std::string& mssg)
+  {
+    throw ParserException(offset, "binary snapshot: " + mssg);
+  }
+
+  void checkRecord(size_t offset, size_t limit, size_t size)
+  {
+    if (offset < header_size || offset >= limit || size > m_doc.size - offset)
+      fail(offset, "invalid reference");
+  }
+
+  void checkString(size_t offset, size_t limit)
+  {
+    checkRecord(offset, limit, 8);
+
+    if (m_doc.read32(offset) > m_doc.size - offset - 8)
+      fail(offset, "string out of bounds");
+  }
+
+private:
+  const Document::Data& m_doc;
+};
+
+} // namespace
+
+/*!
+ * \fn std::string serialize(const Value& value)
+ * \brief serializes a value tree in the binary snapshot format
+ *
+ * Arrays, maps (including user values that are arrays or maps),
+ * strings, numbers and booleans are supported; other user values
+ * throw a \c{std::runtime_error}.
+ */
+std::string serialize(const Value& value)
+{
+  Writer writer;
+  uint64_t root = writer.write(value);
+  writer.finish(root);
+  return std::move(writer.out);
+}
+
+/*!
+ * \fn void save(const Value& value, const std::string& path)
+ * \brief writes a binary snapshot of a value tree to a file
+ */
+void save(const Value& value, const std::string& path)
+{
+  std::string data = serialize(value);
+  std::ofstream file{ path, std::ios::binary | std::ios::trunc };
+
+  if (!file.write(data.data(), data.size()))
+    throw std::runtime_error{ "binary snapshot: could not write '" + path + "'" };
+}
+
+/*!
+ * \class Document
+ */
+
+/*!
+ * \fn Document()
+ * \brief constructs an empty document whose root is null
+ */
+Document::Document()
+{
+
+}
+
+Document::Document(std::shared_ptr<const Data> data, bool validate)
+  : d(std::move(data))
+{
+  Validator validator{ *d };
+  uint64_t root = validator.validateHeader();
+
+  if (validate)
+    validator.validate(root);
+
+  m_root = decode(d, root);
+}
+
+Document::~Document()
+{
+
+}
+
+/*!
+ * \fn static Document open(const std::string& path, bool validate)
+ * \brief opens a binary snapshot
+ *
+ * The file is mapped in memory where supported, read otherwise.
+ *
+ * If \a validate is true, every reference of the snapshot is checked
+ * and a ParserException is thrown if the snapshot is invalid; this
+ * reads the whole file. Otherwise, only the header is checked and
+ * the file must be trusted.
+ */
+Document Document::open(const std::string& path, bool validate)
+{
+#if defined(_WIN32)
+  std::ifstream file{ path, std::ios::binary };
+
+  if (!file)
+    throw std::runtime_error{ "binary snapshot: could not open '" + path + "'" };
+
+  std::string buffer{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+  return fromBuffer(std::move(buffer), validate);
+#else
+  int fd = ::open(path.c_str(), O_RDONLY);
+
+  if (fd == -1)
+    throw std::runtime_error{ "binary snapshot: could not open '" + path + "'" };
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    ::close(fd);
+    throw ParserException(0, "binary snapshot: not a binary snapshot");
+  }
+
+  void* mapping = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (mapping == MAP_FAILED)
+    throw std::runtime_error{ "binary snapshot: could not map '" + path + "'" };
+
+  auto data = std::make_shared<Data>();
+  data->mapping = mapping;
+  data->begin = static_cast<const char*>(mapping);
+  data->size = static_cast<size_t>(st.st_size);
+  return Document(std::move(data), validate);
+#endif // defined(_WIN32)
+}
+
+/*!
+ * \fn static Document fromBuffer(std::string buffer, bool validate)
+ * \brief reads a binary snapshot from memory
+ *
+ * \sa open()
+ */
+Document Document::fromBuffer(std::string buffer, bool validate)
+{
+  auto data = std::make_shared<Data>();
+  data->buffer = std::move(buffer);
+  data->begin = data->buffer.data();
+  data->size = data->buffer.size();
+  return Document(std::move(data), validate);
+}
+
+/*!
+ * \fn const Value& root() const
+ * \brief returns the root of the value tree
+ */
+const Value& Document::root() const
+{
+  return m_root;
+}
+
+/*!
+ * \fn size_t size() const
+ * \brief returns the size of the snapshot in bytes
+ */
+size_t Document::size() const
+{
+  return d ? d->size : 0;
+}
+
+/*!
+ * \endclass
+ */
+
+} // namespace binary
+
+} // namespace liquid
@@ -33,7 +33,7 @@ Context::Scope::Scope(Context& c, const Template& tmplt)
 Context::Scope::Scope(Context& c, const Template& tmplt, liquid::Map data)
   : Scope(c, tmplt)
 {
-  c.scopes().back().data = data;
+  c.scopes().back().data = std::move(data);
 }
 
 Context::Scope::~Scope()
@@ -46,6 +46,11 @@ Value& Context::Scope::operator[](const std::string& str)
   return context_->scopes().back().data[str];
 }
 
+Value& Context::Scope::operator[](const Atom& name)
+{
+  return context_->scopes().back().data[name];
+}
+
 const Template& Context::currentTemplate() const
 {
   for (size_t i(m_stack.size()); i-- > 0; )
@@ -5,6 +5,7 @@
 #include "liquid/filters.h"
 
 #include "liquid/errors.h"
+#include "liquid/value_p.h"
 
 namespace liquid
 {
@@ -53,25 +54,42 @@ std::string ArrayFilters::join(const std::vector<std::string>& strings, const st
 std::string ArrayFilters::join(const liquid::Array& vec, const liquid::Value& sep)
 {
   std::vector<std::string> strings;
+  strings.reserve(vec.length());
 
-  for (size_t i(0); i < vec.length(); ++i)
-  {
-    if (vec.at(i).is<std::string>())
-      strings.push_back(vec.at(i).as<std::string>());
-  }
+  vec.forEach([&strings](const liquid::Value& elem) {
+    if (elem.is<std::string>())
+      strings.push_back(elem.as<std::string>());
+  });
 
   return join(strings, sep.is<std::string>() ? sep.as<std::string>() : std::string(""));
 }
 
+static void append_elements(std::vector<liquid::Value>& result, const liquid::Array& a)
+{
+  a.forEach([&result](const liquid::Value& elem) {
+    result.push_back(elem);
+  });
+}
+
 liquid::Array ArrayFilters::concat(const liquid::Array& a, const liquid::Array& b)
 {
-  liquid::Array result;
+  if (!dynamic_cast<const PersistentArrayValue*>(a.impl().get()))
+  {
+    std::vector<liquid::Value> result;
+    result.reserve(a.length() + b.length());
 
-  for (int i(0); i < a.length(); ++i)
-    result.push(a.at(i));
+    append_elements(result, a);
+    append_elements(result, b);
+
+    return liquid::Array(std::move(result));
+  }
 
-  for (int i(0); i < b.length(); ++i)
-    result.push(b.at(i));
+  // the elements of 'a' are shared with the result
+  liquid::Array result = a.fork();
+
+  b.forEach([&result](const liquid::Value& elem) {
+    result.push(elem);
+  });
 
   return result;
 }
@@ -88,33 +106,28 @@ liquid::Value ArrayFilters::last(const liquid::Array& a)
 
 liquid::Array ArrayFilters::map(const liquid::Array& a, const std::string& field)
 {
-  liquid::Array result;
+  std::vector<liquid::Value> result;
+  result.reserve(a.length());
 
-  for (int i(0); i < a.length(); ++i)
-    result.push(a.at(i).property(field));
+  a.forEach([&result, &field](const liquid::Value& elem) {
+    const liquid::Value* prop = elem.find(field);
+    result.push_back(prop ? *prop : elem.property(field));
+  });
 
-  return result;
+  return liquid::Array(std::move(result));
 }
 
 liquid::Array ArrayFilters::push(const liquid::Array& a, const liquid::Value& elem)
 {
-  liquid::Array result;
-
-  for (int i(0); i < a.length(); ++i)
-    result.push(a.at(i));
-
+  liquid::Array result = a.fork();
   result.push(elem);
-
   return result;
 }
 
 liquid::Array ArrayFilters::pop(const liquid::Array& a)
 {
-  liquid::Array result;
-
-  for (int i(0); i < a.length() - 1; ++i)
-    result.push(a.at(i));
-
+  liquid::Array result = a.fork();
+  result.pop();
   return result;
 }
 
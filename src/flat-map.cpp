@@ -0,0 +1,247 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "liquid/flat-map.h"
+
+#include <functional>
+#include <limits>
+
+namespace liquid
+{
+
+static const size_t npos = std::numeric_limits<size_t>::max();
+
+/*!
+ * \class FlatMap
+ */
+
+const size_t FlatMap::small_size;
+
+/*!
+ * \fn iterator find(const Atom& key)
+ * \brief finds an element by key
+ *
+ * Returns \c{end()} if the map does not contain the key.
+ */
+FlatMap::iterator FlatMap::find(const Atom& key)
+{
+  size_t i = lookup(key);
+  return i != npos ? m_entries.begin() + i : m_entries.end();
+}
+
+/*!
+ * \fn const_iterator find(const Atom& key) const
+ * \brief finds an element by key
+ */
+FlatMap::const_iterator FlatMap::find(const Atom& key) const
+{
+  size_t i = lookup(key);
+  return i != npos ? m_entries.begin() + i : m_entries.end();
+}
+
+/*!
+ * \fn iterator find(const std::string& key)
+ * \brief finds an element by key
+ */
+FlatMap::iterator FlatMap::find(const std::string& key)
+{
+  size_t i = lookup(key);
+  return i != npos ? m_entries.begin() + i : m_entries.end();
+}
+
+/*!
+ * \fn const_iterator find(const std::string& key) const
+ * \brief finds an element by key
+ */
+FlatMap::const_iterator FlatMap::find(const std::string& key) const
+{
+  size_t i = lookup(key);
+  return i != npos ? m_entries.begin() + i : m_entries.end();
+}
+
+/*!
+ * \fn size_t count(const Atom& key) const
+ * \brief returns 1 if the map contains the key, 0 otherwise
+ */
+size_t FlatMap::count(const Atom& key) const
+{
+  return lookup(key) != npos ? 1 : 0;
+}
+
+/*!
+ * \fn size_t count(const std::string& key) const
+ * \brief returns 1 if the map contains the key, 0 otherwise
+ */
+size_t FlatMap::count(const std::string& key) const
+{
+  return lookup(key) != npos ? 1 : 0;
+}
+
+/*!
+ * \fn std::pair<iterator, bool> emplace(const Atom& key, Value val)
+ * \brief inserts an element if the key is not already present
+ *
+ * Returns an iterator to the element with the given key and whether
+ * an insertion took place.
+ */
+std::pair<FlatMap::iterator, bool> FlatMap::emplace(const Atom& key, Value val)
+{
+  size_t i = lookup(key);
+
+  if (i != npos)
+    return std::make_pair(m_entries.begin() + i, false);
+
+  append(key, std::move(val));
+  return std::make_pair(m_entries.end() - 1, true);
+}
+
+/*!
+ * \fn Value& operator[](const Atom& key)
+ * \brief access an element by key, inserting a null value if needed
+ */
+Value& FlatMap::operator[](const Atom& key)
+{
+  size_t i = lookup(key);
+
+  if (i != npos)
+    return m_entries[i].second;
+
+  append(key, Value());
+  return m_entries.back().second;
+}
+
+/*!
+ * \fn Value& operator[](const std::string& key)
+ * \brief access an element by key, inserting a null value if needed
+ *
+ * If an insertion takes place, the key is stored in a transient atom.
+ */
+Value& FlatMap::operator[](const std::string& key)
+{
+  size_t i = lookup(key);
+
+  if (i != npos)
+    return m_entries[i].second;
+
+  append(Atom::transient(key), Value());
+  return m_entries.back().second;
+}
+
+/*!
+ * \fn void reserve(size_t n)
+ * \brief reserves storage for n elements
+ */
+void FlatMap::reserve(size_t n)
+{
+  m_entries.reserve(n);
+}
+
+/*!
+ * \fn void clear()
+ * \brief removes all the elements
+ */
+void FlatMap::clear()
+{
+  m_entries.clear();
+  m_index.clear();
+}
+
+size_t FlatMap::lookup(const Atom& key) const
+{
+  if (m_index.empty())
+  {
+    for (size_t i(0); i < m_entries.size(); ++i)
+    {
+      if (m_entries[i].first == key)
+        return i;
+    }
+
+    return npos;
+  }
+
+  const size_t mask = m_index.size() - 1;
+
+  for (size_t slot = key.hash() & mask; m_index[slot] != 0; slot = (slot + 1) & mask)
+  {
+    const size_t i = m_index[slot] - 1;
+
+    if (m_entries[i].first == key)
+      return i;
+  }
+
+  return npos;
+}
+
+size_t FlatMap::lookup(const std::string& key) const
+{
+  if (m_index.empty())
+  {
+    for (size_t i(0); i < m_entries.size(); ++i)
+    {
+      if (m_entries[i].first.str() == key)
+        return i;
+    }
+
+    return npos;
+  }
+
+  const size_t hash = std::hash<std::string>()(key);
+  const size_t mask = m_index.size() - 1;
+
+  for (size_t slot = hash & mask; m_index[slot] != 0; slot = (slot + 1) & mask)
+  {
+    const size_t i = m_index[slot] - 1;
+
+    if (m_entries[i].first.hash() == hash && m_entries[i].first.str() == key)
+      return i;
+  }
+
+  return npos;
+}
+
+void FlatMap::append(const Atom& key, Value val)
+{
+  m_entries.emplace_back(key, std::move(val));
+
+  if (m_entries.size() <= small_size)
+    return;
+
+  if (2 * m_entries.size() > m_index.size())
+  {
+    rebuildIndex(m_index.empty() ? 4 * small_size : 2 * m_index.size());
+  }
+  else
+  {
+    const size_t mask = m_index.size() - 1;
+    size_t slot = key.hash() & mask;
+
+    while (m_index[slot] != 0)
+      slot = (slot + 1) & mask;
+
+    m_index[slot] = static_cast<uint32_t>(m_entries.size());
+  }
+}
+
+void FlatMap::rebuildIndex(size_t capacity)
+{
+  m_index.assign(capacity, 0);
+
+  const size_t mask = capacity - 1;
+
+  for (size_t i(0); i < m_entries.size(); ++i)
+  {
+    size_t slot = m_entries[i].first.hash() & mask;
+
+    while (m_index[slot] != 0)
+      slot = (slot + 1) & mask;
+
+    m_index[slot] = static_cast<uint32_t>(i + 1);
+  }
+}
+
+/*!
+ * \endclass
+ */
+
+} // namespace liquid
@@ -0,0 +1,765 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "liquid/json.h"
+
+#include "liquid/arena.h"
+#include "liquid/parser.h"
+#include "liquid/value_p.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define LIQUID_JSON_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define LIQUID_JSON_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#endif
+
+namespace liquid
+{
+
+namespace json
+{
+
+namespace
+{
+
+inline unsigned count_trailing_zeros(unsigned mask)
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<unsigned>(index);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+/*
+ * Returns a pointer to the first quote, backslash or control character
+ * in [begin, end), or end if there is none.
+ * These are the only characters that end the fast path of string parsing.
+ */
+inline const char* find_string_special(const char* begin, const char* end)
+{
+#if defined(LIQUID_JSON_AVX2)
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i control = _mm256_set1_epi8(0x1F);
+
+  for (; end - begin >= 32; begin += 32)
+  {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    __m256i special = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)),
+      _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, control), control));
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(special));
+
+    if (mask != 0)
+      return begin + count_trailing_zeros(mask);
+  }
+#elif defined(LIQUID_JSON_SSE2)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1F);
+
+  for (; end - begin >= 16; begin += 16)
+  {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    __m128i special = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+      _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+
+    if (mask != 0)
+      return begin + count_trailing_zeros(mask);
+  }
+#endif
+
+  for (; begin != end; ++begin)
+  {
+    unsigned char c = static_cast<unsigned char>(*begin);
+
+    if (c == '"' || c == '\\' || c < 0x20)
+      return begin;
+  }
+
+  return end;
+}
+
+void append_utf8(std::string& out, unsigned cp)
+{
+  if (cp < 0x80)
+  {
+    out.push_back(static_cast<char>(cp));
+  }
+  else if (cp < 0x800)
+  {
+    out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+  else if (cp < 0x10000)
+  {
+    out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+  else
+  {
+    out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+}
+
+/*
+ * Object keys are data, they are interned as transient atoms, which 
+ * are released with the document; the same keys usually appear many 
+ * times in a document, this cache avoids interning them again.
+ */
+class KeyCache
+{
+public:
+  Atom get(const char* str, size_t len)
+  {
+    size_t h = 14695981039346656037ull & std::numeric_limits<size_t>::max();
+
+    for (size_t i(0); i < len; ++i)
+      h = (h ^ static_cast<unsigned char>(str[i])) * 1099511628211ull;
+
+    Entry& e = m_entries[h % NbEntries];
+
+    if (e.hash != h || e.key.str().size() != len || std::memcmp(e.key.str().data(), str, len) != 0)
+    {
+      e.hash = h;
+      e.key = Atom::transient(std::string(str, len));
+    }
+
+    return e.key;
+  }
+
+private:
+  static const size_t NbEntries = 256;
+
+  struct Entry
+  {
+    size_t hash = 0;
+    Atom key;
+  };
+
+  Entry m_entries[NbEntries];
+};
+
+/*
+ * The buffers of a parser that can be reused by the next one,
+ * when several documents are parsed in a row.
+ */
+struct ParserBuffers
+{
+  KeyCache keys;
+  std::deque<std::vector<Value>> elements;
+  std::deque<std::vector<FlatMap::value_type>> members;
+};
+
+class Parser
+{
+public:
+  Parser(const std::string& text, const Value& input, const ParseOptions& options, ParserBuffers& buffers)
+    : m_begin(text.data()),
+      m_end(text.data() + text.size()),
+      m_ptr(text.data()),
+      m_input(input),
+      m_options(options),
+      m_keys(buffers.keys),
+      m_elements(buffers.elements),
+      m_members(buffers.members)
+  {
+
+  }
+
+  Value parseDocument()
+  {
+    Value result = parseValue(0);
+    skipWhitespaces();
+
+    if (m_ptr != m_end)
+      error("unexpected characters after the JSON value");
+
+    return result;
+  }
+
+private:
+  [[noreturn]] void error(const std::string& mssg) const
+  {
+    throw ParserException(static_cast<size_t>(m_ptr - m_begin), "JSON: " + mssg);
+  }
+
+  void skipWhitespaces()
+  {
+    while (m_ptr != m_end && (*m_ptr == ' ' || *m_ptr == '\n' || *m_ptr == '\r' || *m_ptr == '\t'))
+      ++m_ptr;
+  }
+
+  void expect(const char* word)
+  {
+    size_t len = std::strlen(word);
+
+    if (static_cast<size_t>(m_end - m_ptr) < len || std::memcmp(m_ptr, word, len) != 0)
+      error("invalid literal");
+
+    m_ptr += len;
+  }
+
+  Value parseValue(size_t depth)
+  {
+    skipWhitespaces();
+
+    if (m_ptr == m_end)
+      error("unexpected end of input");
+
+    switch (*m_ptr)
+    {
+    case '{':
+      return parseObject(depth + 1);
+    case '[':
+      return parseArray(depth + 1);
+    case '"':
+      return parseString();
+    case 't':
+      expect("true");
+      return true;
+    case 'f':
+      expect("false");
+      return false;
+    case 'n':
+      expect("null");
+      return nullptr;
+    default:
+      return parseNumber();
+    }
+  }
+
+  Value parseObject(size_t depth)
+  {
+    if (depth > m_options.maxDepth)
+      error("maximum nesting depth exceeded");
+
+    ++m_ptr;
+
+    std::vector<FlatMap::value_type>& members = scratch(m_members, depth);
+
+    skipWhitespaces();
+
+    if (m_ptr != m_end && *m_ptr == '}')
+    {
+      ++m_ptr;
+      return Value(allocate_value<MapValue>());
+    }
+
+    for (;;)
+    {
+      skipWhitespaces();
+
+      if (m_ptr == m_end || *m_ptr != '"')
+        error("expected a string key");
+
+      Atom key = parseKey();
+
+      skipWhitespaces();
+
+      if (m_ptr == m_end || *m_ptr != ':')
+        error("expected ':'");
+
+      ++m_ptr;
+
+      Value val = parseValue(depth);
+      members.emplace_back(key, std::move(val));
+
+      skipWhitespaces();
+
+      if (m_ptr == m_end)
+        error("unexpected end of input");
+      else if (*m_ptr == ',')
+        ++m_ptr;
+      else if (*m_ptr == '}')
+        break;
+      else
+        error("expected ',' or '}'");
+    }
+
+    ++m_ptr;
+
+    FlatMap dict;
+    dict.reserve(members.size());
+
+    // the last value wins if a key is repeated
+    for (FlatMap::value_type& m : members)
+      dict[m.first] = std::move(m.second);
+
+    members.clear();
+
+    return Value(allocate_value<MapValue>(std::move(dict)));
+  }
+
+  Value parseArray(size_t depth)
+  {
+    if (depth > m_options.maxDepth)
+      error("maximum nesting depth exceeded");
+
+    ++m_ptr;
+
+    std::vector<Value>& elements = scratch(m_elements, depth);
+
+    skipWhitespaces();
+
+    if (m_ptr != m_end && *m_ptr == ']')
+    {
+      ++m_ptr;
+      return Value(std::vector<Value>());
+    }
+
+    for (;;)
+    {
+      Value val = parseValue(depth);
+      elements.push_back(std::move(val));
+
+      skipWhitespaces();
+
+      if (m_ptr == m_end)
+        error("unexpected end of input");
+      else if (*m_ptr == ',')
+        ++m_ptr;
+      else if (*m_ptr == ']')
+        break;
+      else
+        error("expected ',' or ']'");
+    }
+
+    ++m_ptr;
+
+    std::vector<Value> values{ std::make_move_iterator(elements.begin()), std::make_move_iterator(elements.end()) };
+    elements.clear();
+
+    return Value(std::move(values));
+  }
+
+  // elements are collected in buffers that are reused for every array 
+  // and object of the same depth, so that the final containers are 
+  // allocated once, with the right size; a deque is used so that 
+  // the buffers of the enclosing levels are not moved
+  template<typename T>
+  std::vector<T>& scratch(std::deque<std::vector<T>>& buffers, size_t depth)
+  {
+    if (buffers.size() <= depth)
+      buffers.resize(depth + 1);
+
+    return buffers[depth];
+  }
+
+  Atom parseKey()
+  {
+    const char* start = ++m_ptr;
+    const char* special = find_string_special(m_ptr, m_end);
+
+    if (special != m_end && *special == '"')
+    {
+      m_ptr = special + 1;
+      return m_keys.get(start, static_cast<size_t>(special - start));
+    }
+
+    std::string key{ start, special };
+    m_ptr = special;
+    readEscapedString(key);
+    return Atom::transient(key);
+  }
+
+  Value parseString()
+  {
+    const char* start = ++m_ptr;
+    const char* special = find_string_special(m_ptr, m_end);
+
+    if (special != m_end && *special == '"')
+    {
+      m_ptr = special + 1;
+      size_t len = static_cast<size_t>(special - start);
+
+      if (m_options.stringSlices)
+        return StringValue::slice(m_input, static_cast<size_t>(start - m_begin), len);
+      else
+        return Value(std::string(start, len));
+    }
+
+    std::string str{ start, special };
+    m_ptr = special;
+    readEscapedString(str);
+    return Value(std::move(str));
+  }
+
+  // reads the rest of a string that contains escape sequences, up to the closing quote
+  void readEscapedString(std::string& out)
+  {
+    for (;;)
+    {
+      if (m_ptr == m_end)
+        error("unterminated string");
+
+      unsigned char c = static_cast<unsigned char>(*m_ptr);
+
+      if (c == '"')
+      {
+        ++m_ptr;
+        return;
+      }
+      else if (c < 0x20)
+      {
+        error("control character in string");
+      }
+      else if (c != '\\')
+      {
+        const char* special = find_string_special(m_ptr, m_end);
+        out.append(m_ptr, special);
+        m_ptr = special;
+        continue;
+      }
+
+      if (++m_ptr == m_end)
+        error("unterminated string");
+
+      switch (*m_ptr++)
+      {
+      case '"': out.push_back('"'); break;
+      case '\\': out.push_back('\\'); break;
+      case '/': out.push_back('/'); break;
+      case 'b': out.push_back('\b'); break;
+      case 'f': out.push_back('\f'); break;
+      case 'n': out.push_back('\n'); break;
+      case 'r': out.push_back('\r'); break;
+      case 't': out.push_back('\t'); break;
+      case 'u':
+      {
+        unsigned cp = readHex4();
+
+        if (cp >= 0xD800 && cp < 0xDC00)
+        {
+          if (m_end - m_ptr < 2 || m_ptr[0] != '\\' || m_ptr[1] != 'u')
+            error("invalid surrogate pair");
+
+          m_ptr += 2;
+          unsigned low = readHex4();
+
+          if (low < 0xDC00 || low >= 0xE000)
+            error("invalid surrogate pair");
+
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        }
+
+        append_utf8(out, cp);
+        break;
+      }
+      default:
+        --m_ptr;
+        error("invalid escape sequence");
+      }
+    }
+  }
+
+  unsigned readHex4()
+  {
+    if (m_end - m_ptr < 4)
+      error("invalid unicode escape");
+
+    unsigned result = 0;
+
+    for (int i(0); i < 4; ++i, ++m_ptr)
+    {
+      char c = *m_ptr;
+      result <<= 4;
+
+      if (c >= '0' && c <= '9')
+        result |= static_cast<unsigned>(c - '0');
+      else if (c >= 'a' && c <= 'f')
+        result |= static_cast<unsigned>(c - 'a' + 10);
+      else if (c >= 'A' && c <= 'F')
+        result |= static_cast<unsigned>(c - 'A' + 10);
+      else
+        error("invalid unicode escape");
+    }
+
+    return result;
+  }
+
+  Value parseNumber()
+  {
+    const char* start = m_ptr;
+    bool negative = false;
+
+    if (*m_ptr == '-')
+      negative = true, ++m_ptr;
+
+    if (m_ptr == m_end || !StringBackend::is_digit(*m_ptr))
+      error("unexpected character");
+
+    // integers are accumulated directly, the common case
+    long long n = 0;
+    bool overflow = false;
+
+    if (*m_ptr == '0')
+    {
+      ++m_ptr;
+    }
+    else
+    {
+      for (; m_ptr != m_end && StringBackend::is_digit(*m_ptr); ++m_ptr)
+      {
+        const int digit = *m_ptr - '0';
+
+        // past the range of a long long, the digits are only skipped, the number is read by strtod()
+        if (overflow || n > (std::numeric_limits<long long>::max() - digit) / 10)
+          overflow = true;
+        else
+          n = n * 10 + digit;
+      }
+    }
+
+    bool is_integer = true;
+
+    if (m_ptr != m_end && *m_ptr == '.')
+    {
+      is_integer = false;
+      ++m_ptr;
+
+      if (m_ptr == m_end || !StringBackend::is_digit(*m_ptr))
+        error("invalid number");
+
+      while (m_ptr != m_end && StringBackend::is_digit(*m_ptr))
+        ++m_ptr;
+    }
+
+    if (m_ptr != m_end && (*m_ptr == 'e' || *m_ptr == 'E'))
+    {
+      is_integer = false;
+      ++m_ptr;
+
+      if (m_ptr != m_end && (*m_ptr == '+' || *m_ptr == '-'))
+        ++m_ptr;
+
+      if (m_ptr == m_end || !StringBackend::is_digit(*m_ptr))
+        error("invalid number");
+
+      while (m_ptr != m_end && StringBackend::is_digit(*m_ptr))
+        ++m_ptr;
+    }
+
+    if (is_integer && !overflow)
+    {
+      if (negative)
+        n = -n;
+
+      // stored as an int when it fits
+      return Value(n);
+    }
+
+    return std::strtod(std::string(start, m_ptr).c_str(), nullptr);
+  }
+
+private:
+  const char* m_begin;
+  const char* m_end;
+  const char* m_ptr;
+  const Value& m_input;
+  const ParseOptions& m_options;
+  KeyCache& m_keys;
+  std::deque<std::vector<Value>>& m_elements;
+  std::deque<std::vector<FlatMap::value_type>>& m_members;
+};
+
+} // namespace
+
+static Value parse_json(const std::string& text, const Value& input, const ParseOptions& options, ParserBuffers& buffers)
+{
+  // a previous parse that threw may have left partial containers in the buffers
+  for (std::vector<Value>& elements : buffers.elements)
+    elements.clear();
+
+  for (std::vector<FlatMap::value_type>& members : buffers.members)
+    members.clear();
+
+  Arena::Scope arena_scope{ options.arena ? options.arena : Arena::current() };
+  Parser parser{ text, input, options, buffers };
+  return parser.parseDocument();
+}
+
+static Value parse_json(const std::string& text, const Value& input, const ParseOptions& options)
+{
+  ParserBuffers buffers;
+  return parse_json(text, input, options, buffers);
+}
+
+/*!
+ * \fn Value parse(const std::string& text, const ParseOptions& options)
+ * \brief parses a JSON document
+ *
+ * Objects are converted to maps, arrays to arrays; numbers are
+ * converted to integers if they are integral and fit in 64 bits 
+ * (see \c{Value::Integer64Kind}), to doubles otherwise.
+ *
+ * Throws a ParserException if the document is not valid JSON.
+ */
+Value parse(const std::string& text, const ParseOptions& options)
+{
+  if (!options.stringSlices)
+    return parse_json(text, Value(), options);
+
+  return parse(std::string(text), options);
+}
+
+/*!
+ * \fn Value parse(std::string&& text, const ParseOptions& options)
+ * \brief parses a JSON document
+ *
+ * If string slices are enabled, the text is moved into a string value
+ * and shared by the strings of the document.
+ */
+Value parse(std::string&& text, const ParseOptions& options)
+{
+  if (!options.stringSlices)
+    return parse_json(text, Value(), options);
+
+  Value input{ std::move(text) };
+  return parse_json(input.as<std::string>(), input, options);
+}
+
+namespace
+{
+
+/*
+ * An array whose elements are the lines of an NDJSON input, parsed
+ * one at a time; only the line being parsed is held in memory.
+ */
+class NdjsonStream : public IValue
+{
+public:
+  NdjsonStream(std::shared_ptr<std::istream> input, const ParseOptions& options)
+    : m_input(std::move(input)),
+      m_options(options)
+  {
+
+  }
+
+  bool is_array() const override
+  {
+    return true;
+  }
+
+  std::type_index type_index() const override
+  {
+    return std::type_index(typeid(NdjsonStream));
+  }
+
+  void* data() override
+  {
+    return m_input.get();
+  }
+
+  bool is_stream() const override
+  {
+    return true;
+  }
+
+  bool next(Value& element) override
+  {
+    while (std::getline(*m_input, m_line))
+    {
+      const size_t offset = m_offset;
+      m_offset += m_line.size() + 1;
+
+      if (m_line.find_first_not_of(" \t\r") == std::string::npos)
+        continue;
+
+      try
+      {
+        // the key cache and the buffers are kept from one line to the next
+        if (m_options.stringSlices)
+        {
+          Value text{ std::move(m_line) };
+          element = parse_json(text.as<std::string>(), text, m_options, m_buffers);
+        }
+        else
+        {
+          element = parse_json(m_line, Value(), m_options, m_buffers);
+        }
+      }
+      catch (const ParserException& ex)
+      {
+        throw ParserException(offset + ex.offset_, ex.message_);
+      }
+
+      return true;
+    }
+
+    if (m_input->bad())
+      throw std::runtime_error{ "json: could not read the NDJSON input" };
+
+    return false;
+  }
+
+private:
+  std::shared_ptr<std::istream> m_input;
+  ParseOptions m_options;
+  ParserBuffers m_buffers;
+  size_t m_offset = 0;
+  std::string m_line;
+};
+
+} // namespace
+
+/*!
+ * \fn Value stream(std::shared_ptr<std::istream> input, const ParseOptions& options)
+ * \brief reads an NDJSON input as a stream of values
+ *
+ * Each non-blank line of the input must be a JSON document; it is 
+ * parsed when the element is read, so that a for-loop over the stream 
+ * only keeps the current element in memory.
+ *
+ * The returned array can only be iterated once, by a single thread.
+ * Errors are reported when the faulty line is reached, as a 
+ * ParserException whose offset is relative to the start of the input.
+ */
+Value stream(std::shared_ptr<std::istream> input, const ParseOptions& options)
+{
+  return Value(std::make_shared<NdjsonStream>(std::move(input), options));
+}
+
+/*!
+ * \fn Value streamFile(const std::string& path, const ParseOptions& options)
+ * \brief reads an NDJSON file as a stream of values
+ *
+ * Throws a \c{std::runtime_error} if the file cannot be opened.
+ */
+Value streamFile(const std::string& path, const ParseOptions& options)
+{
+  auto file = std::make_shared<std::ifstream>(path, std::ios::binary);
+
+  if (!file->is_open())
+    throw std::runtime_error{ "json: could not open '" + path + "'" };
+
+  return stream(std::move(file), options);
+}
+
+} // namespace json
+
+} // namespace liquid
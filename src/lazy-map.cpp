@@ -0,0 +1,162 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "liquid/lazy-map.h"
+
+#include "liquid/arena.h"
+
+#include <mutex>
+
+namespace liquid
+{
+
+struct LazyMapValue::Property
+{
+  Atom name;
+  Thunk thunk;
+  mutable std::once_flag once;
+  mutable Value value;
+};
+
+/*!
+ * \class LazyMapValue
+ */
+
+/*!
+ * \fn LazyMapValue()
+ * \brief constructs an empty map
+ */
+LazyMapValue::LazyMapValue()
+{
+
+}
+
+LazyMapValue::~LazyMapValue()
+{
+
+}
+
+/*!
+ * \fn void insert(const Atom& name, Value val)
+ * \brief inserts a property whose value is already known
+ *
+ * Replaces any property with the same name.
+ */
+void LazyMapValue::insert(const Atom& name, Value val)
+{
+  Property& prop = slot(name);
+  prop.thunk = nullptr;
+  prop.value = std::move(val);
+}
+
+/*!
+ * \fn void insertLazy(const Atom& name, Thunk thunk)
+ * \brief inserts a property that is computed on first access
+ *
+ * Replaces any property with the same name.
+ */
+void LazyMapValue::insertLazy(const Atom& name, Thunk thunk)
+{
+  Property& prop = slot(name);
+  prop.thunk = std::move(thunk);
+  prop.value = Value();
+}
+
+bool LazyMapValue::is_map() const
+{
+  return true;
+}
+
+std::type_index LazyMapValue::type_index() const
+{
+  return std::type_index(typeid(LazyMapValue));
+}
+
+void* LazyMapValue::data()
+{
+  return this;
+}
+
+std::set<std::string> LazyMapValue::propertyNames() const
+{
+  std::set<std::string> names;
+
+  for (const auto& prop : m_properties)
+  {
+    names.insert(prop->name.str());
+  }
+
+  return names;
+}
+
+/*!
+ * \fn void forEachProperty(const PropertyCallback& callback) const
+ * \brief calls a function for each property, computing the lazy ones
+ */
+void LazyMapValue::forEachProperty(const PropertyCallback& callback) const
+{
+  for (const auto& prop : m_properties)
+  {
+    callback(prop->name.str(), evaluate(*prop));
+  }
+}
+
+Value LazyMapValue::property(const std::string& name) const
+{
+  return *find(name);
+}
+
+Value LazyMapValue::get(const Atom& name) const
+{
+  return *find(name);
+}
+
+const Value* LazyMapValue::find(const std::string& name) const
+{
+  auto it = m_index.find(name);
+  return it != m_index.end() ? &evaluate(*m_properties[it->second.as<int>()]) : &Value::null_value;
+}
+
+const Value* LazyMapValue::find(const Atom& name) const
+{
+  auto it = m_index.find(name);
+  return it != m_index.end() ? &evaluate(*m_properties[it->second.as<int>()]) : &Value::null_value;
+}
+
+const Value& LazyMapValue::evaluate(const Property& prop) const
+{
+  if (prop.thunk)
+  {
+    std::call_once(prop.once, [&prop]() {
+      // the value is cached in the map, which may outlive the arena of the current render
+      Arena::Scope arena_scope{ nullptr };
+      prop.value = prop.thunk();
+    });
+  }
+
+  return prop.value;
+}
+
+LazyMapValue::Property& LazyMapValue::slot(const Atom& name)
+{
+  auto it = m_index.find(name);
+
+  if (it != m_index.end())
+  {
+    // replaced by a new property, whose once_flag has not been used
+    std::unique_ptr<Property>& prop = m_properties[it->second.as<int>()];
+    prop.reset(new Property{ name, nullptr, {}, Value() });
+    return *prop;
+  }
+
+  m_index[name] = static_cast<int>(m_properties.size());
+  m_properties.emplace_back(new Property{ name, nullptr, {}, Value() });
+  return *m_properties.back();
+}
+
+/*!
+ * \endclass
+ */
+
+} // namespace liquid
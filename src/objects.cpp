@@ -10,16 +10,27 @@ namespace liquid
 {
 
 Object::Object(size_t off)
-  : Node(off)
+  : Node(UserObjectKind, off)
 {
 
 }
 
+Object::Object(Kind k, size_t off)
+  : Node(k, off)
+{
+
+}
+
+const liquid::Value* Object::resolve(Renderer& /* renderer */)
+{
+  return nullptr;
+}
+
 namespace objects
 {
 
 Value::Value(const liquid::Value& val, size_t off)
-  : Object(off),
+  : Object(ValueKind, off),
     value(val)
 {
 
@@ -30,9 +41,14 @@ liquid::Value Value::accept(Renderer& r)
   return r.visitObject(*this);
 }
 
-Variable::Variable(std::string n, size_t off)
-  : Object(off),
-    name(std::move(n))
+const liquid::Value* Value::resolve(Renderer& r)
+{
+  return r.resolveObject(*this);
+}
+
+Variable::Variable(const std::string& n, size_t off)
+  : Object(VariableKind, off),
+    name(n)
 {
 
 }
@@ -42,8 +58,13 @@ liquid::Value Variable::accept(Renderer& r)
   return r.visitObject(*this);
 }
 
+const liquid::Value* Variable::resolve(Renderer& r)
+{
+  return r.resolveObject(*this);
+}
+
 ArrayAccess::ArrayAccess(const std::shared_ptr<Object>& obj, const std::shared_ptr<Object>& ind, size_t off)
-  : Object(off), 
+  : Object(ArrayAccessKind, off), 
     object(obj),
     index(ind)
 {
@@ -55,8 +76,13 @@ liquid::Value ArrayAccess::accept(Renderer& r)
   return r.visitObject(*this);
 }
 
+const liquid::Value* ArrayAccess::resolve(Renderer& r)
+{
+  return r.resolveObject(*this);
+}
+
 MemberAccess::MemberAccess(const std::shared_ptr<Object>& obj, const std::string& name, size_t off)
-  : Object(off),
+  : Object(MemberAccessKind, off),
     object(obj),
     name(name)
 {
@@ -68,8 +94,13 @@ liquid::Value MemberAccess::accept(Renderer& r)
   return r.visitObject(*this);
 }
 
+const liquid::Value* MemberAccess::resolve(Renderer& r)
+{
+  return r.resolveObject(*this);
+}
+
 BinOp::BinOp(Operation op, const std::shared_ptr<Object>& left, const std::shared_ptr<Object>& right, size_t off)
-  : Object(off), 
+  : Object(BinOpKind, off), 
     operation(op),
     lhs(left),
     rhs(right)
@@ -83,7 +114,7 @@ liquid::Value BinOp::accept(Renderer& r)
 }
 
 LogicalNot::LogicalNot(const std::shared_ptr<Object>& obj, size_t off)
-  : Object(off),
+  : Object(LogicalNotKind, off),
     object(obj)
 {
 
@@ -95,7 +126,7 @@ liquid::Value LogicalNot::accept(Renderer& r)
 }
 
 Pipe::Pipe(const std::shared_ptr<Object>& object, const std::string& filtername, const std::vector<std::shared_ptr<Object>>& args, size_t off)
-  : Object(off), 
+  : Object(PipeKind, off), 
     object(object),
     filterName(filtername),
     arguments(args)
@@ -104,7 +135,7 @@ Pipe::Pipe(const std::shared_ptr<Object>& object, const std::string& filtername,
 }
 
 Pipe::Pipe(const std::shared_ptr<Object>& object, const std::string& filtername, size_t off)
-  : Object(off),
+  : Object(PipeKind, off),
     object(object),
     filterName(filtername)
 {
@@ -7,37 +7,19 @@
 #include "liquid/tags.h"
 
 #include <algorithm>
+#include <stdexcept>
 
-namespace vec
-{
-
-template<typename T>
-T take_first(std::vector<T>& list)
-{
-  T result = list.front();
-  list.erase(list.begin());
-  return result;
-}
-
-template<typename T>
-T take_last(std::vector<T>& list)
-{
-  T result = list.back();
-  list.pop_back();
-  return result;
-}
-
-template<typename T>
-std::vector<T> mid(const std::vector<T>& list, size_t offset, size_t n = std::numeric_limits<size_t>::max())
-{
-  if (n == std::numeric_limits<size_t>::max())
-    n = list.size() - offset;
-
-  return std::vector<T>(list.begin() + offset, list.begin() + offset + n);
-}
-
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define LIQUID_PARSER_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define LIQUID_PARSER_SSE2
+#endif
 
-} // namespace vec
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#endif
 
 namespace liquid
 {
@@ -115,25 +97,319 @@ bool Token::operator==(const char *str) const
   return text == str;
 }
 
+/*!
+ * \class TokenCursor
+ * \brief a range of tokens that is consumed from both ends
+ *
+ * The parser reads the tokens of a tag through a cursor over a buffer
+ * that is reused from one tag to the next: consuming a token, or
+ * handing a sub-range to another parser, only moves indices.
+ */
+
+TokenCursor::TokenCursor(const std::vector<Token>& tokens)
+  : m_tokens(&tokens),
+    m_begin(0),
+    m_end(tokens.size())
+{
+
+}
+
+TokenCursor::TokenCursor(const std::vector<Token>& tokens, size_t begin, size_t end)
+  : m_tokens(&tokens),
+    m_begin(begin),
+    m_end(end)
+{
+
+}
+
+/*!
+ * \fn const Token& front() const
+ * \brief returns the first token of the range
+ *
+ * Throws a ParserException if the range is empty.
+ */
+const Token& TokenCursor::front() const
+{
+  return at(0);
+}
+
+/*!
+ * \fn const Token& back() const
+ * \brief returns the last token of the range
+ *
+ * Throws a ParserException if the range is empty.
+ */
+const Token& TokenCursor::back() const
+{
+  return at(size() - 1);
+}
+
+/*!
+ * \fn const Token& at(size_t index) const
+ * \brief returns a token by its index in the range
+ */
+const Token& TokenCursor::at(size_t index) const
+{
+  if (index >= size())
+    throw ParserException{ endOffset(), "Unexpected end of expression" };
+
+  return (*m_tokens)[m_begin + index];
+}
+
+/*!
+ * \fn const Token& takeFirst()
+ * \brief removes the first token from the range and returns it
+ */
+const Token& TokenCursor::takeFirst()
+{
+  const Token& tok = front();
+  ++m_begin;
+  return tok;
+}
+
+/*!
+ * \fn const Token& takeLast()
+ * \brief removes the last token from the range and returns it
+ */
+const Token& TokenCursor::takeLast()
+{
+  const Token& tok = back();
+  --m_end;
+  return tok;
+}
+
+/*!
+ * \fn TokenCursor mid(size_t offset, size_t count) const
+ * \brief returns a sub-range of this range
+ */
+TokenCursor TokenCursor::mid(size_t offset, size_t count) const
+{
+  assert(offset + count <= size());
+  return TokenCursor(*m_tokens, m_begin + offset, m_begin + offset + count);
+}
+
+/*!
+ * \fn void advance(size_t count)
+ * \brief removes the first tokens of the range
+ */
+void TokenCursor::advance(size_t count)
+{
+  assert(count <= size());
+  m_begin += count;
+}
+
+/*!
+ * \fn size_t endOffset() const
+ * \brief returns the offset in the document of the end of the range
+ */
+size_t TokenCursor::endOffset() const
+{
+  if (m_end == 0)
+    return 0;
+
+  const Token& last = (*m_tokens)[m_end - 1];
+  return last.text.offset_ + last.text.length_;
+}
+
+/*!
+ * \endclass
+ */
+
+namespace
+{
+
+inline unsigned count_trailing_zeros(unsigned mask)
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<unsigned>(index);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+inline void scan_delimiter(const char* str, size_t i, size_t length, std::vector<DelimiterIndex::Entry>& out)
+{
+  if (i + 1 == length)
+    return;
+
+  const char c = str[i];
+  const char next = str[i + 1];
+
+  if (c == '{' && next == '{')
+    out.push_back({ i, DelimiterIndex::ObjectBegin });
+  else if (c == '{' && next == '%')
+    out.push_back({ i, DelimiterIndex::TagBegin });
+  else if (c == '}' && next == '}')
+    out.push_back({ i, DelimiterIndex::ObjectEnd });
+  else if (c == '%' && next == '}')
+    out.push_back({ i, DelimiterIndex::TagEnd });
+}
+
+/*
+ * Appends the delimiters of str to out, in order.
+ * Blocks of text that contain no '{', '}' or '%' are skipped 
+ * 16 or 32 bytes at a time.
+ */
+void scan_delimiters(const char* str, size_t length, std::vector<DelimiterIndex::Entry>& out)
+{
+  size_t i = 0;
+
+#if defined(LIQUID_PARSER_AVX2)
+  const __m256i lbrace = _mm256_set1_epi8('{');
+  const __m256i rbrace = _mm256_set1_epi8('}');
+  const __m256i percent = _mm256_set1_epi8('%');
+
+  for (; length - i >= 32; i += 32)
+  {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(str + i));
+    __m256i special = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(chunk, lbrace), _mm256_cmpeq_epi8(chunk, rbrace)),
+      _mm256_cmpeq_epi8(chunk, percent));
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(special));
+
+    while (mask != 0)
+    {
+      scan_delimiter(str, i + count_trailing_zeros(mask), length, out);
+      mask &= mask - 1;
+    }
+  }
+#elif defined(LIQUID_PARSER_SSE2)
+  const __m128i lbrace = _mm_set1_epi8('{');
+  const __m128i rbrace = _mm_set1_epi8('}');
+  const __m128i percent = _mm_set1_epi8('%');
+
+  for (; length - i >= 16; i += 16)
+  {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i));
+    __m128i special = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, lbrace), _mm_cmpeq_epi8(chunk, rbrace)),
+      _mm_cmpeq_epi8(chunk, percent));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+
+    while (mask != 0)
+    {
+      scan_delimiter(str, i + count_trailing_zeros(mask), length, out);
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; i < length; ++i)
+  {
+    const char c = str[i];
+
+    if (c == '{' || c == '}' || c == '%')
+      scan_delimiter(str, i, length, out);
+  }
+}
+
+} // namespace
+
+/*!
+ * \class DelimiterIndex
+ * \brief lists the positions of the delimiters of a document
+ *
+ * The index is built in a single pass over the document before it is 
+ * parsed. Lookups must be made at increasing offsets: the index keeps
+ * a cursor so that the whole document is parsed in linear time.
+ */
+
+DelimiterIndex::DelimiterIndex()
+  : m_current(0)
+{
+
+}
+
+/*!
+ * \fn void build(const std::string& document)
+ * \brief builds the index of a document
+ *
+ * Every occurrence of a delimiter is listed, including those that 
+ * appear inside a tag or an object; the parser skips them.
+ */
+void DelimiterIndex::build(const std::string& document)
+{
+  m_entries.clear();
+  m_current = 0;
+  scan_delimiters(document.data(), document.size(), m_entries);
+}
+
+/*!
+ * \fn size_t findOpening(size_t from, Kind& kind)
+ * \brief returns the offset of the first '{{' or '{%' at or after from
+ *
+ * Returns std::string::npos if there is none.
+ */
+size_t DelimiterIndex::findOpening(size_t from, Kind& kind)
+{
+  while (m_current < m_entries.size())
+  {
+    const Entry& e = m_entries[m_current];
+
+    if (e.offset >= from && (e.kind == ObjectBegin || e.kind == TagBegin))
+    {
+      kind = e.kind;
+      return e.offset;
+    }
+
+    ++m_current;
+  }
+
+  return std::string::npos;
+}
+
+/*!
+ * \fn size_t find(Kind kind, size_t from)
+ * \brief returns the offset of the first delimiter of a given kind at or after from
+ *
+ * Returns std::string::npos if there is none.
+ */
+size_t DelimiterIndex::find(Kind kind, size_t from)
+{
+  while (m_current < m_entries.size())
+  {
+    const Entry& e = m_entries[m_current];
+
+    if (e.offset >= from && e.kind == kind)
+      return e.offset;
+
+    ++m_current;
+  }
+
+  return std::string::npos;
+}
+
+/*!
+ * \endclass
+ */
+
 Tokenizer::Tokenizer()
   : mPosition(0), mStartPos(0)
 {
-  mPunctuators = std::set<char>{ '!', '<', '>', '=', '+', '-', '*', '/' };
+  mPunctuators = std::set<char>{ '!', '<', '>', '=', '+', '-', '*', '/', '%' };
 }
 
 std::vector<Token> Tokenizer::tokenize(StringView str)
 {
   std::vector<Token> result;
-  
+  tokenize(str, result);
+  return result;
+}
+
+void Tokenizer::tokenize(StringView str, std::vector<Token>& tokens)
+{
+  // the capacity of the buffer is kept, tags usually need no allocation
+  tokens.clear();
+
   mInput = str;
   mPosition = 0;
 
   readSpaces();
 
   while (!atEnd())
-    result.push_back(read());
-
-  return result;
+    tokens.push_back(read());
 }
 
 Token Tokenizer::read()
@@ -284,31 +560,95 @@ bool Tokenizer::atEnd() const
 class ObjectParser
 {
 public:
-  std::vector<Token>& tokens;
+  TokenCursor& tokens;
+
+  size_t depth;
+
+  // the maximum nesting of 'not' operators and array indices in an expression, 
+  // and the maximum height of its tree, which is evaluated recursively
+  static const size_t max_depth = 256;
 
-  explicit ObjectParser(std::vector<Token>& toks)
-    : tokens(toks)
+  struct Operator
   {
+    objects::BinOp::Operation name;
+    int precedence; // 1 binds the tightest
+  };
+
+  // the loosest precedence level, that of 'or' and 'xor'
+  static const int max_precedence = 6;
 
+  explicit ObjectParser(TokenCursor& toks, size_t d = 0)
+    : tokens(toks),
+      depth(d)
+  {
+    if (depth > max_depth)
+      throw ParserException{ tokens.empty() ? tokens.endOffset() : tokens.front().text.offset_, "Maximum nesting depth exceeded in expression" };
   }
 
   std::shared_ptr<liquid::Object> parse()
   {
-    return parseObject();
+    size_t height = 0;
+    return parseObject(height);
   }
 
-  Token readOperator()
+  std::shared_ptr<liquid::Object> parse(size_t& height)
   {
-    Token tok = vec::take_first(tokens);
-
-    if (tok.kind != Token::Operator)
-      throw ParserException{ tok.text.offset_ , std::string("Expected operator") };
+    return parseObject(height);
+  }
 
-    return tok;
+  // a chain of operators, accesses or filters is as high as it is long
+  static void checkHeight(size_t height, size_t offset)
+  {
+    if (height > max_depth)
+      throw ParserException{ offset, "Maximum nesting depth exceeded in expression" };
   }
 
+  // returns false if the token is not a binary operator
+  static bool lookupOperator(const Token& tok, Operator& op)
+  {
+    struct OpInfo { const char* symbol; int precedence; };
+
+    // indexed by objects::BinOp::Operation
+    static const OpInfo table[] = {
+      { "<", 3 }, { "<=", 3 }, { ">", 3 }, { ">=", 3 },
+      { "==", 4 }, { "!=", 4 },
+      { "and", 5 }, { "or", 6 }, { "xor", 6 },
+      { "+", 2 }, { "-", 2 },
+      { "*", 1 }, { "/", 1 }, { "%", 1 },
+    };
+
+    if (tok.kind != Token::Operator || tok.text.length_ == 0)
+      return false;
+
+    const char next = tok.text.length_ > 1 ? tok.text[1] : '\0';
+    objects::BinOp::Operation name;
+
+    // the first character selects the only candidate
+    switch (tok.text[0])
+    {
+    case '<': name = next == '=' ? objects::BinOp::Leq : (next == '>' ? objects::BinOp::Inequal : objects::BinOp::Less); break;
+    case '>': name = next == '=' ? objects::BinOp::Geq : objects::BinOp::Greater; break;
+    case '=': name = objects::BinOp::Equal; break;
+    case '!': name = objects::BinOp::Inequal; break;
+    case 'a': name = objects::BinOp::And; break;
+    case 'o': name = objects::BinOp::Or; break;
+    case 'x': name = objects::BinOp::Xor; break;
+    case '+': name = objects::BinOp::Add; break;
+    case '-': name = objects::BinOp::Sub; break;
+    case '*': name = objects::BinOp::Mul; break;
+    case '/': name = objects::BinOp::Div; break;
+    case '%': name = objects::BinOp::Mod; break;
+    default: return false;
+    }
+
+    if (!(tok == table[name].symbol) && !(name == objects::BinOp::Inequal && tok == "<>"))
+      return false;
+
+    op = Operator{ name, table[name].precedence };
+    return true;
+  }
 
-  static liquid::Value createLiteral(const Token& tok) noexcept
+  static liquid::Value createLiteral(const Token& tok)
   {
     assert(tok.kind == Token::BooleanLiteral || tok.kind == Token::IntegerLiteral || tok.kind == Token::StringLiteral);
 
@@ -318,7 +658,14 @@ public:
     }
     else if (tok.kind == Token::IntegerLiteral)
     {
-      return liquid::Value{ std::stoi(tok.toString()) };
+      try
+      {
+        return liquid::Value(std::stoll(tok.toString()));
+      }
+      catch (const std::out_of_range&)
+      {
+        throw ParserException{ tok.text.offset_, "Integer literal is out of range" };
+      }
     }
     else // tok.kind == Token::StringLiteral
     {
@@ -328,7 +675,7 @@ public:
 
   liquid::Value readLiteral()
   {
-    Token tok = vec::take_first(tokens);
+    const Token& tok = tokens.takeFirst();
 
     if(tok.kind == Token::BooleanLiteral || tok.kind == Token::IntegerLiteral || tok.kind == Token::StringLiteral)
       return createLiteral(tok);
@@ -336,7 +683,7 @@ public:
     throw ParserException{ tok.text.offset_, "expected literal" };
   }
 
-  std::shared_ptr<liquid::Object> readArray(Token tok)
+  std::shared_ptr<liquid::Object> readArray(const Token& tok)
   {
     assert(tok.kind == Token::LeftBracket);
 
@@ -348,25 +695,39 @@ public:
 
       if (tokens.front().kind == Token::Comma)
       {
-        vec::take_first(tokens);
+        tokens.takeFirst();
       }
     }
 
-    vec::take_first(tokens);
+    tokens.takeFirst();
 
     return std::make_shared<objects::Value>(result, tok.text.offset_);
   }
 
-  std::shared_ptr<liquid::Object> readOperand()
+  std::shared_ptr<liquid::Object> readNot(const Token& tok, size_t& height)
+  {
+    if (++depth > max_depth)
+      throw ParserException{ tok.text.offset_, "Maximum nesting depth exceeded in expression" };
+
+    auto operand = readOperand(height);
+    --depth;
+
+    checkHeight(++height, tok.text.offset_);
+
+    return std::make_shared<objects::LogicalNot>(operand, tok.text.offset_);
+  }
+
+  std::shared_ptr<liquid::Object> readOperand(size_t& height)
   {
     std::shared_ptr<liquid::Object> obj;
 
-    Token tok = vec::take_first(tokens);
+    Token tok = tokens.takeFirst();
+    height = 1;
 
     if (tok.kind == Token::Identifier && tok.text != "not")
       obj = std::make_shared<objects::Variable>(tok.toString(), tok.text.offset_);
     else if (tok.text == "not")
-      return std::make_shared<objects::LogicalNot>(readOperand(), tok.text.offset_);
+      return readNot(tok, height);
     else if (tok.kind == Token::BooleanLiteral || tok.kind == Token::IntegerLiteral || tok.kind == Token::StringLiteral)
       obj = std::make_shared<objects::Value>(createLiteral(tok), tok.text.offset_);
     else if (tok.kind == Token::LeftBracket)
@@ -378,35 +739,39 @@ public:
     {
       if (tokens.front().kind == Token::Dot)
       {
-        vec::take_first(tokens);
+        tokens.takeFirst();
 
         if (tokens.empty() || tokens.front().kind != Token::Identifier)
-          throw ParserException{ tokens.front().text.offset_, "Expected identifier after '.'" };
+          throw ParserException{ tokens.empty() ? tokens.endOffset() : tokens.front().text.offset_, "Expected identifier after '.'" };
 
-        tok = vec::take_first(tokens);
+        tok = tokens.takeFirst();
         obj = std::make_shared<objects::MemberAccess>(obj, tok.toString(), tok.text.offset_);
+        checkHeight(++height, tok.text.offset_);
       }
       else if (tokens.front().kind == Token::LeftBracket)
       {
-        const Token left_bracket = vec::take_first(tokens);
-        std::vector<Token> subtokens;
+        const Token left_bracket = tokens.takeFirst();
 
-        while (!tokens.empty() && tokens.front().kind != Token::RightBracket)
-        {
-          subtokens.push_back(vec::take_first(tokens));
-        }
+        size_t count = 0;
 
-        if (tokens.empty())
-          throw ParserException{ left_bracket.text.offset_, "Could not find closing bracket ']'" };
+        while (count < tokens.size() && tokens.at(count).kind != Token::RightBracket)
+          ++count;
 
-        vec::take_first(tokens);
+        if (count == tokens.size())
+          throw ParserException{ left_bracket.text.offset_, "Could not find closing bracket ']'" };
 
-        if (subtokens.empty())
+        if (count == 0)
           throw ParserException{ left_bracket.text.offset_, "Invalid empty index in array access" };
 
-        ObjectParser subobj_parser{ subtokens };
-        std::shared_ptr<liquid::Object> index = subobj_parser.parse();
+        TokenCursor subtokens = tokens.mid(0, count);
+        tokens.advance(count + 1);
+
+        ObjectParser subobj_parser{ subtokens, depth + 1 };
+        size_t index_height = 0;
+        std::shared_ptr<liquid::Object> index = subobj_parser.parse(index_height);
         obj = std::make_shared<objects::ArrayAccess>(obj, index, tok.text.offset_);
+        height = std::max(height, index_height) + 1;
+        checkHeight(height, left_bracket.text.offset_);
       }
       else
       {
@@ -417,61 +782,40 @@ public:
     return obj;
   }
 
-  static std::shared_ptr<liquid::Object> buildExpr(std::vector<std::shared_ptr<liquid::Object>> operands, std::vector<Token> operators)
-  {
-    struct OpInfo { objects::BinOp::Operation name; int precedence; };
-
-    static std::vector<std::pair<std::string, OpInfo>> map{
-      { "or", { objects::BinOp::Or, 6 } },
-      { "xor", { objects::BinOp::Xor, 6 } },
-      { "and", { objects::BinOp::And, 5 } },
-      { "!=", { objects::BinOp::Inequal, 4 } },
-      { "<>", { objects::BinOp::Inequal, 4 } },
-      { "==", { objects::BinOp::Equal, 4 } },
-      { "<", { objects::BinOp::Less, 3 } },
-      { "<=", { objects::BinOp::Leq, 3 } },
-      { ">", { objects::BinOp::Greater, 3 } },
-      { ">=", { objects::BinOp::Geq, 3 } },
-      { "+", { objects::BinOp::Add, 2 } },
-      { "-", { objects::BinOp::Sub, 2 } },
-      { "*", { objects::BinOp::Mul, 1 } },
-      { "/", { objects::BinOp::Div, 1 } },
-    };
-
-    if (operators.size() == 0)
-      return operands.front();
-
-    auto get_info = [](const std::vector<std::pair<std::string, OpInfo>>& map, const Token& optok) -> OpInfo
-    {
-      return std::find_if(map.begin(), map.end(), [&optok](const std::pair<std::string, OpInfo>& elem) -> bool {
-        return optok == elem.first.data();
-        })->second;
-    };
+  /*
+   * Precedence climbing: reads an operand followed by the operators
+   * whose precedence is at most 'precedence', the right-hand side of
+   * each operator being parsed at the next tighter level so that
+   * operators of equal precedence associate to the left.
+   */
+  std::shared_ptr<liquid::Object> parseBinary(int precedence, size_t& height)
+  {
+    std::shared_ptr<liquid::Object> lhs = readOperand(height);
 
-    size_t op_index = operators.size() - 1;
-    OpInfo op_info = get_info(map, operators.back());
+    Operator op;
 
-    for (size_t i(operators.size() - 1); i-- > 0;)
+    while (!tokens.empty() && lookupOperator(tokens.front(), op) && op.precedence <= precedence)
     {
-      OpInfo temp_op_info = get_info(map, operators.at(i));
-      if (temp_op_info.precedence > op_info.precedence)
-        op_index = i, op_info = temp_op_info;
+      const size_t offset = tokens.takeFirst().text.offset_;
+      size_t rhs_height = 0;
+      std::shared_ptr<liquid::Object> rhs = parseBinary(op.precedence - 1, rhs_height);
+      lhs = std::make_shared<objects::BinOp>(op.name, lhs, rhs, offset);
+      height = std::max(height, rhs_height) + 1;
+      checkHeight(height, offset);
     }
 
-    auto lhs = buildExpr(vec::mid(operands, 0, op_index + 1), vec::mid(operators, 0, op_index));
-    auto rhs = buildExpr(vec::mid(operands, op_index + 1), vec::mid(operators, op_index + 1));
-
-    return std::make_shared<objects::BinOp>(op_info.name, lhs, rhs, operators.at(op_index).text.offset_);
+    return lhs;
   }
 
-  std::shared_ptr<liquid::Object> applyFilter(std::shared_ptr<liquid::Object> obj)
+  std::shared_ptr<liquid::Object> applyFilter(std::shared_ptr<liquid::Object> obj, size_t& height)
   {
-    Token tok = vec::take_first(tokens);
-    tok = vec::take_first(tokens);
+    tokens.takeFirst();
+    const Token& tok = tokens.takeFirst();
 
     std::string name = tok.toString();
 
     auto ret = std::make_shared<objects::Pipe>(obj, name, tok.text.offset_);
+    checkHeight(++height, tok.text.offset_);
 
     if (tokens.empty() || tokens.front().kind == Token::Pipe)
       return ret;
@@ -479,11 +823,14 @@ public:
     if (tokens.front().kind != Token::Colon)
       throw ParserException{ tokens.front().text.offset_, "Expected ':' after filter name" };
 
-    vec::take_first(tokens);
+    tokens.takeFirst();
 
     while (!tokens.empty() && tokens.front().kind != Token::Pipe)
     {
-      ret->arguments.push_back(readOperand());
+      size_t arg_height = 0;
+      ret->arguments.push_back(readOperand(arg_height));
+      height = std::max(height, arg_height + 1);
+      checkHeight(height, tok.text.offset_);
 
       if (tokens.empty() || tokens.front().kind == Token::Pipe)
         break;
@@ -492,40 +839,34 @@ public:
         throw ParserException{ tokens.front().text.offset_, "Expected ',' or '|' or end of filter expression" };
 
       // read the comma
-      vec::take_first(tokens);
+      tokens.takeFirst();
     }
 
     return ret;
   }
 
-  std::shared_ptr<liquid::Object> parseObject()
+  std::shared_ptr<liquid::Object> parseObject(size_t& height)
   {
-    assert(!tokens.empty());
+    height = 1;
+
+    if (tokens.empty())
+      throw ParserException{ tokens.endOffset(), "Expected expression" };
 
     if (tokens.size() == 1 && tokens.front().kind == Token::Identifier)
       return std::make_shared<objects::Variable>(tokens.front().toString(), tokens.front().text.offset_);
 
-    auto obj = readOperand();
+    auto obj = parseBinary(max_precedence, height);
 
-    if (tokens.empty())
-      return obj;
-
-    std::vector<std::shared_ptr<liquid::Object>> operands;
-    operands.push_back(obj);
-    std::vector<Token> operators;
-
-    while (!tokens.empty() && tokens.front().kind != Token::Pipe)
+    if (!tokens.empty() && tokens.front().kind != Token::Pipe)
     {
-      operators.push_back(readOperator());
-      operands.push_back(readOperand());
+      const Token& tok = tokens.front();
+      throw ParserException{ tok.text.offset_, tok.kind == Token::Operator ? "Unknown operator" : "Expected operator" };
     }
 
-    obj = buildExpr(operands, operators);
-
     /* Apply filters */
     while (!tokens.empty() && tokens.front().kind == Token::Pipe)
     {
-      obj = applyFilter(obj);
+      obj = applyFilter(obj, height);
     }
 
     return obj;
@@ -534,7 +875,19 @@ public:
 };
 
 Parser::Parser()
-  : mPosition(0)
+  : Parser(TagRegistry::builtins())
+{
+
+}
+
+/*!
+ * \fn Parser(std::shared_ptr<const TagRegistry> tags)
+ * \brief constructs a parser that supports the tags of a registry
+ */
+Parser::Parser(std::shared_ptr<const TagRegistry> tags)
+  : mTags(std::move(tags)),
+    mCurrentTag(nullptr),
+    mPosition(0)
 {
 
 }
@@ -546,10 +899,24 @@ Parser::~Parser()
 
 std::vector<std::shared_ptr<liquid::templates::Node>> Parser::parse(const std::string & document)
 {
-  mDocument = StringBackend::normalize(document);
+  return parse(document.data(), document.size());
+}
+
+/*!
+ * \fn std::vector<std::shared_ptr<liquid::templates::Node>> parse(const char* document, size_t length)
+ * \brief parses a document
+ *
+ * The document is copied once into a buffer that is shared by the text
+ * nodes of the result, see source().
+ */
+std::vector<std::shared_ptr<liquid::templates::Node>> Parser::parse(const char* document, size_t length)
+{
+  mDocument = std::make_shared<const std::string>(StringBackend::normalize(document, length));
+  mDelimiters.build(*mDocument);
   mPosition = 0;
   mNodes.clear();
   mStack.clear();
+  mCurrentTag = nullptr;
 
   while (!atEnd())
     readNode();
@@ -559,134 +926,119 @@ std::vector<std::shared_ptr<liquid::templates::Node>> Parser::parse(const std::s
 
 void Parser::readNode()
 {
-  size_t pos = document().find('{', position());
-  
-  if (pos == std::string::npos || pos == document().length() - 1)
+  DelimiterIndex::Kind kind;
+  size_t pos = mDelimiters.findOpening(position(), kind);
+
+  if (pos != position())
   {
-    auto text = std::string(document().begin() + position(), document().end());
-    auto ret = std::make_shared<templates::TextNode>(std::move(text), position());
-    mPosition = document().length();
+    // a single '{' does not start a tag and is part of the text
+    const size_t end = pos == std::string::npos ? document().length() : pos;
+    auto ret = std::make_shared<templates::TextNode>(mDocument, position(), end - position(), position());
+    mPosition = end;
     dispatchNode(ret);
     return;
   }
 
-  if (pos == position())
-  {
-    if (document().at(pos + 1) == '{')
-    {
-      pos = pos + 2;
-      const size_t endpos = document().find("}}", pos);
+  pos = pos + 2;
 
-      if (endpos == std::string::npos)
-        throw ParserException{ pos, "Could not match '{{' with a closing '}}'" };
-
-      auto tokens = tokenizer().tokenize(StringView(&document(), pos, endpos - pos));
-      auto obj = parseObject(tokens);
-      dispatchNode(obj);
-
-      mPosition = endpos + 2;
-    }
-    else if (document().at(static_cast<size_t>(pos) + 1) == '%')
-    {
-      pos = pos + 2;
-      size_t endpos = document().find("%}", pos);
-
-      if (endpos == std::string::npos)
-        throw ParserException{ pos, "Could not match '{%' with a closing '%}'" };
+  if (kind == DelimiterIndex::ObjectBegin)
+  {
+    const size_t endpos = mDelimiters.find(DelimiterIndex::ObjectEnd, pos);
 
-      auto tokens = tokenizer().tokenize(StringView(&document(), pos, endpos - pos));
-      processTag(tokens);
+    if (endpos == std::string::npos)
+      throw ParserException{ pos, "Could not match '{{' with a closing '}}'" };
 
-      mPosition = endpos + 2;
+    tokenizer().tokenize(StringView(&document(), pos, endpos - pos), mTokens);
+    TokenCursor tokens{ mTokens };
+    auto obj = parseObject(tokens);
+    dispatchNode(obj);
 
-      // Strips new-line after a tag
-      //if (!atEnd() && document().at(position()) == '\n')
-      //  mPosition += 1;
-    }
-    else
-    {
-      auto text = std::string(document().begin() + position(), document().begin() + (pos + 1));
-      auto ret = std::make_shared<templates::TextNode>(std::move(text), position());
-      mPosition = pos + 1;
-      dispatchNode(ret);
-    }
+    mPosition = endpos + 2;
   }
   else
   {
-    auto text = std::string(document().begin() + position(), document().begin() + pos);
-    auto ret = std::make_shared<templates::TextNode>(std::move(text), position());
-    mPosition = pos;
-    dispatchNode(ret);
-    return;
+    const size_t endpos = mDelimiters.find(DelimiterIndex::TagEnd, pos);
+
+    if (endpos == std::string::npos)
+      throw ParserException{ pos, "Could not match '{%' with a closing '%}'" };
+
+    tokenizer().tokenize(StringView(&document(), pos, endpos - pos), mTokens);
+    TokenCursor tokens{ mTokens };
+    processTag(tokens);
+
+    mPosition = endpos + 2;
   }
 }
 
 void Parser::dispatchNode(std::shared_ptr<liquid::templates::Node> n)
 {
-  if (stack().empty())
+  if (mStack.empty())
   {
     mNodes.push_back(n);
   }
   else
   {
-    auto top = stack().back();
-
-    const bool is_for = top->is<tags::For>();
-    const bool is_if = !is_for && top->is<tags::If>();
-    const bool is_capture = !is_for && !is_if && top->is<tags::Capture>();
-
-    assert(is_for || is_if || is_capture);
-
-    if (is_for)
-      top->as<tags::For>().body.push_back(n);
-    else if (is_if)
-      top->as<tags::If>().blocks.back().body.push_back(n);
-    else if (is_capture)
-      top->as<tags::Capture>().body.push_back(n);
-  }
-}
-
-void Parser::processTag(std::vector<Token> & tokens)
-{
-  Token tok = vec::take_first(tokens);
-
-  if (tok == "assign")
-    process_tag_assign(tok, tokens);
-  else if (tok == "if")
-    process_tag_if(tok, tokens);
-  else if (tok == "elsif")
-    process_tag_elsif(tok, tokens);
-  else if (tok == "else")
-    process_tag_else(tok, tokens);
-  else if (tok == "endif")
-    process_tag_endif(tok, tokens);
-  else if (tok == "for")
-    process_tag_for(tok, tokens);
-  else if (tok == "break")
-    process_tag_break(tok, tokens);
-  else if (tok == "continue")
-    process_tag_continue(tok, tokens);
-  else if (tok == "endfor")
-    process_tag_endfor(tok, tokens);
-  else if (tok == "comment")
-    process_tag_comment();
-  else if (tok == "eject")
-    process_tag_eject();
-  else if (tok == "discard")
-    process_tag_discard();
-  else if (tok == "include")
-    process_tag_include(tok, tokens);
-  else if (tok == "capture")
-    process_tag_capture(tok, tokens);
-  else if (tok == "endcapture")
-    process_tag_endcapture(tok, tokens);
-  else if (tok == "newline")
-    process_tag_newline(tok, tokens);
-  else
+    const Block& top = mStack.back();
+    top.tag->append(*top.node, std::move(n));
+  }
+}
+
+/*!
+ * \fn void openBlock(std::shared_ptr<liquid::templates::Node> block)
+ * \brief opens the block of the tag being processed
+ *
+ * The following nodes are appended to the block until its end tag is
+ * read; the block is then dispatched as a single node.
+ * This function must be called from the handler of a block tag.
+ */
+void Parser::openBlock(std::shared_ptr<liquid::templates::Node> block)
+{
+  assert(mCurrentTag && mCurrentTag->append);
+  mStack.push_back(Block{ std::move(block), mCurrentTag });
+}
+
+/*!
+ * \fn bool isInBlock(const char* name) const
+ * \brief returns whether the innermost open block was opened by a given tag
+ */
+bool Parser::isInBlock(const char* name) const
+{
+  return !mStack.empty() && mStack.back().tag->name == name;
+}
+
+void Parser::closeBlock(const Token& keyword, const TagRegistry::Spec& end)
+{
+  const TagRegistry::Spec& opening = tags().at(end.closes);
+
+  if (mStack.empty() || mStack.back().tag != &opening)
+    throw ParserException{ keyword.text.offset_, "Unexpected '" + end.name + "' tag" };
+
+  auto node = std::move(mStack.back().node);
+  mStack.pop_back();
+  dispatchNode(node);
+}
+
+void Parser::processTag(TokenCursor& tokens)
+{
+  const Token& tok = tokens.takeFirst();
+
+  const TagRegistry::Spec* spec = tags().find(tok.text.text_->data() + tok.text.offset_, tok.text.length_);
+
+  if (!spec)
     throw ParserException{ tok.text.offset_, "Unknown tag name" };
+
+  if (spec->closes != TagRegistry::npos)
+  {
+    closeBlock(tok, *spec);
+    return;
+  }
+
+  mCurrentTag = spec;
+  spec->handler(*this, tok, tokens);
+  mCurrentTag = nullptr;
 }
 
-std::shared_ptr<liquid::Object> Parser::parseObject(std::vector<Token> & tokens)
+std::shared_ptr<liquid::Object> Parser::parseObject(TokenCursor& tokens)
 {
   ObjectParser parser{ tokens };
   return parser.parse();
@@ -710,22 +1062,22 @@ void Parser::process_tag_discard()
   dispatchNode(node);
 }
 
-void Parser::process_tag_assign(const Token& keyword, std::vector<Token>& tokens)
+void Parser::process_tag_assign(const Token& keyword, TokenCursor& tokens)
 {
-  Token name = vec::take_first(tokens);
-  Token eq = vec::take_first(tokens);
+  const Token& name = tokens.takeFirst();
+  tokens.takeFirst(); // '='
 
   bool parent_scope = false;
   bool global = false;
 
   if (tokens.back() == "parent_scope")
   {
-    tokens.pop_back();
+    tokens.takeLast();
     parent_scope = true;
   }
   else if (tokens.back() == "global")
   {
-    tokens.pop_back();
+    tokens.takeLast();
     global = true;
   }
 
@@ -737,50 +1089,40 @@ void Parser::process_tag_assign(const Token& keyword, std::vector<Token>& tokens
   dispatchNode(node);
 }
 
-void Parser::process_tag_if(const Token& keyword, std::vector<Token>& tokens)
+void Parser::process_tag_if(const Token& keyword, TokenCursor& tokens)
 {
   auto cond = parseObject(tokens);
   auto tag = std::make_shared<tags::If>(cond, keyword.text.offset_);
-  mStack.push_back(tag);
+  openBlock(tag);
 }
 
-void Parser::process_tag_elsif(const Token& keyword, std::vector<Token>& tokens)
+void Parser::process_tag_elsif(const Token& keyword, TokenCursor& tokens)
 {
-  if (stack().empty() || !stack().back()->is<tags::If>())
+  if (!isInBlock("if"))
     throw ParserException{ keyword.text.offset_, "Unexpected 'elsif' tag" };
 
   tags::If::Block block;
   block.condition = parseObject(tokens);
 
-  stack().back()->as<tags::If>().blocks.push_back(block);
+  stack().back().node->as<tags::If>().blocks.push_back(block);
 }
 
-void Parser::process_tag_else(const Token& keyword, std::vector<Token>& tokens)
+void Parser::process_tag_else(const Token& keyword, TokenCursor& tokens)
 {
-  if (stack().empty() || !stack().back()->is<tags::If>())
+  if (!isInBlock("if"))
     throw ParserException{ keyword.text.offset_, "Unexpected 'else' tag" };
 
   tags::If::Block block;
   block.condition = std::make_shared<objects::Value>(liquid::Value(true));
 
-  stack().back()->as<tags::If>().blocks.push_back(block);
-}
-
-void Parser::process_tag_endif(const Token& keyword, std::vector<Token>& tokens)
-{
-  if (stack().empty() || !stack().back()->is<tags::If>())
-    throw ParserException{ keyword.text.offset_, "Unexpected 'endif' tag" };
-
-  auto node = vec::take_last(mStack);
-  assert(node->is<tags::If>());
-  dispatchNode(node);
+  stack().back().node->as<tags::If>().blocks.push_back(block);
 }
 
-void Parser::process_tag_for(const Token& keyword, std::vector<Token>& tokens)
+void Parser::process_tag_for(const Token& keyword, TokenCursor& tokens)
 {
-  std::string name = vec::take_first(tokens).toString();
+  std::string name = tokens.takeFirst().toString();
 
-  std::string in = vec::take_first(tokens).toString();
+  std::string in = tokens.takeFirst().toString();
 
   if (in != "in")
     throw ParserException{ keyword.text.offset_, "Expected token 'in'" };
@@ -788,106 +1130,74 @@ void Parser::process_tag_for(const Token& keyword, std::vector<Token>& tokens)
   auto container = parseObject(tokens);
 
   auto tag = std::make_shared<tags::For>(name, container, keyword.text.offset_);
-  mStack.push_back(tag);
+  openBlock(tag);
 }
 
-void Parser::process_tag_break(const Token& keyword, std::vector<Token>& tokens)
+void Parser::process_tag_break(const Token& keyword, TokenCursor& tokens)
 {
   dispatchNode(std::make_shared<tags::Break>(keyword.text.offset_));
 }
 
-void Parser::process_tag_continue(const Token& keyword, std::vector<Token>& tokens)
+void Parser::process_tag_continue(const Token& keyword, TokenCursor& tokens)
 {
   dispatchNode(std::make_shared<tags::Continue>(keyword.text.offset_));
 }
 
-void Parser::process_tag_endfor(const Token& keyword, std::vector<Token>& tokens)
-{
-  if (stack().empty() || !stack().back()->is<tags::For>())
-    throw ParserException{ keyword.text.offset_, "Unexpected 'endfor' tag" };
-
-  auto node = vec::take_last(mStack);
-  assert(node->is<tags::For>());
-  dispatchNode(node);
-}
-
 class IncludeParser
 {
 public:
   tags::Include& result;
-  std::vector<Token>& tokens;
-  size_t index = 0;
-
-  IncludeParser(tags::Include& target, std::vector<Token>& toks) : result(target), tokens(toks)
-  {
-
-  }
-
-  bool atEnd() const
-  {
-    return index == tokens.size();
-  }
+  TokenCursor& tokens;
 
-  Token read()
+  IncludeParser(tags::Include& target, TokenCursor& toks) : result(target), tokens(toks)
   {
-    if(atEnd())
-      throw ParserException{ tokens.back().text.offset_, "unexpected end of input" };
 
-    return tokens.at(index++);
   }
 
   void parse()
   {
-    std::vector<Token> buffer;
-
-    while (!atEnd())
+    while (!tokens.empty())
     {
-      std::string name = read().toString();
+      std::string name = tokens.takeFirst().toString();
 
-      Token tok = read();
+      const Token& tok = tokens.takeFirst();
 
       if (tok.text != "=")
       {
         throw ParserException{ tok.text.offset_, "expected '=' after variable name in 'include'" };
       }
 
-      buffer.clear();
+      size_t count = 0;
 
-      while (!atEnd())
-      {
-        tok = read();
+      while (count < tokens.size() && tokens.at(count) != "and")
+        ++count;
 
-        if (tok == "and")
-          break;
+      TokenCursor value = tokens.mid(0, count);
+      tokens.advance(count < tokens.size() ? count + 1 : count);
 
-        buffer.push_back(tok);
-      }
-
-      ObjectParser obj_parser{ buffer };
+      ObjectParser obj_parser{ value };
       auto obj = obj_parser.parse();
       result.objects[name] = obj;
     }
   }
 };
 
-void Parser::process_tag_include(const Token& keyword, std::vector<Token>& tokens)
+void Parser::process_tag_include(const Token& keyword, TokenCursor& tokens)
 {
   if(tokens.empty())
     throw ParserException{ keyword.text.offset_, "'include' should provide a template name" };
 
-  std::string template_name = tokens.front().toString();
+  std::string template_name = tokens.takeFirst().toString();
 
   auto result = std::make_shared<tags::Include>(std::move(template_name));
   result->setOffset(keyword.text.offset_);
 
-  tokens.erase(tokens.begin());
-
   if (!tokens.empty())
   {
     if(tokens.front().toString() != "with")
       throw ParserException{ tokens.front().text.offset_, "expected 'with' keyword after 'include' name" };
 
-    tokens.erase(tokens.begin());
+    tokens.takeFirst();
 
     IncludeParser incparser{ *result, tokens };
     incparser.parse();
@@ -896,26 +1206,17 @@ void Parser::process_tag_include(const Token& keyword, std::vector<Token>& token
   dispatchNode(result);
 }
 
-void Parser::process_tag_capture(const Token& keyword, std::vector<Token>& tokens)
+void Parser::process_tag_capture(const Token& keyword, TokenCursor& tokens)
 {
-  std::string name = vec::take_first(tokens).toString();
+  std::string name = tokens.takeFirst().toString();
 
   auto tag = std::make_shared<tags::Capture>(name, keyword.text.offset_);
   tag->setOffset(keyword.text.offset_);
 
-  mStack.push_back(tag);
-}
-
-void Parser::process_tag_endcapture(const Token& keyword, std::vector<Token>& tokens)
-{
-  if (stack().empty() || !stack().back()->is<tags::Capture>())
-    throw ParserException{ keyword.text.offset_, "Unexpected 'endcapture' tag" };
-
-  auto node = vec::take_last(mStack);
-  dispatchNode(node);
+  openBlock(tag);
 }
 
-void Parser::process_tag_newline(const Token& keyword, std::vector<Token>& /* tokens */)
+void Parser::process_tag_newline(const Token& keyword, TokenCursor& /* tokens */)
 {
   dispatchNode(std::make_shared<tags::Newline>(keyword.text.offset_));
 }
@@ -0,0 +1,672 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "liquid/value_p.h"
+
+#include "liquid/arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+namespace liquid
+{
+
+/*
+ * PersistentArrayValue is a 32-way trie whose leaves hold the elements,
+ * plus a tail leaf holding the last 1 to 32 elements so that pushing
+ * and popping usually only copy the tail.
+ */
+
+struct PersistentArrayValue::Node
+{
+  std::vector<Value> values;
+  std::vector<std::shared_ptr<const Node>> children;
+};
+
+namespace
+{
+
+typedef PersistentArrayValue::Node ArrayNode;
+
+const unsigned array_bits = 5;
+const size_t array_width = size_t(1) << array_bits;
+const size_t array_mask = array_width - 1;
+
+std::shared_ptr<const ArrayNode> new_path(unsigned level, std::shared_ptr<const ArrayNode> node)
+{
+  if (level == 0)
+    return node;
+
+  auto ret = std::make_shared<ArrayNode>();
+  ret->children.push_back(new_path(level - array_bits, std::move(node)));
+  return ret;
+}
+
+std::shared_ptr<const ArrayNode> push_tail(size_t size, unsigned level, const ArrayNode& parent, std::shared_ptr<const ArrayNode> tail)
+{
+  const size_t subidx = ((size - 1) >> level) & array_mask;
+  auto ret = std::make_shared<ArrayNode>(parent);
+
+  std::shared_ptr<const ArrayNode> node;
+
+  if (level == array_bits)
+    node = std::move(tail);
+  else if (subidx < parent.children.size())
+    node = push_tail(size, level - array_bits, *parent.children[subidx], std::move(tail));
+  else
+    node = new_path(level - array_bits, std::move(tail));
+
+  if (subidx < ret->children.size())
+    ret->children[subidx] = std::move(node);
+  else
+    ret->children.push_back(std::move(node));
+
+  return ret;
+}
+
+std::shared_ptr<const ArrayNode> pop_tail(size_t size, unsigned level, const ArrayNode& node)
+{
+  const size_t subidx = ((size - 2) >> level) & array_mask;
+
+  if (level > array_bits)
+  {
+    std::shared_ptr<const ArrayNode> child = pop_tail(size, level - array_bits, *node.children[subidx]);
+
+    if (!child && subidx == 0)
+      return nullptr;
+
+    auto ret = std::make_shared<ArrayNode>(node);
+
+    if (child)
+      ret->children[subidx] = std::move(child);
+    else
+      ret->children.pop_back();
+
+    return ret;
+  }
+  else if (subidx == 0)
+  {
+    return nullptr;
+  }
+
+  auto ret = std::make_shared<ArrayNode>(node);
+  ret->children.pop_back();
+  return ret;
+}
+
+std::shared_ptr<const ArrayNode> assoc(unsigned level, const ArrayNode& node, size_t index, Value val)
+{
+  auto ret = std::make_shared<ArrayNode>(node);
+
+  if (level == 0)
+  {
+    ret->values[index & array_mask] = std::move(val);
+  }
+  else
+  {
+    const size_t subidx = (index >> level) & array_mask;
+    ret->children[subidx] = assoc(level - array_bits, *node.children[subidx], index, std::move(val));
+  }
+
+  return ret;
+}
+
+} // namespace
+
+/*!
+ * \class PersistentArrayValue
+ * \brief an immutable array sharing its structure with its versions
+ *
+ * Pushing, popping or replacing an element returns a new array in
+ * O(log32 n), leaving this one untouched.
+ */
+
+PersistentArrayValue::PersistentArrayValue()
+  : m_root(std::make_shared<Node>()),
+    m_tail(std::make_shared<Node>())
+{
+
+}
+
+/*!
+ * \fn PersistentArrayValue(const std::vector<Value>& values)
+ * \brief builds the trie bottom-up from a list of values
+ */
+PersistentArrayValue::PersistentArrayValue(const std::vector<Value>& values)
+  : m_size(values.size())
+{
+  const size_t tailoff = tailOffset();
+
+  std::vector<std::shared_ptr<const Node>> nodes;
+
+  for (size_t i(0); i < tailoff; i += array_width)
+  {
+    auto leaf = std::make_shared<Node>();
+    leaf->values.assign(values.begin() + i, values.begin() + i + array_width);
+    nodes.push_back(std::move(leaf));
+  }
+
+  while (nodes.size() > array_width)
+  {
+    std::vector<std::shared_ptr<const Node>> parents;
+
+    for (size_t i(0); i < nodes.size(); i += array_width)
+    {
+      auto parent = std::make_shared<Node>();
+      const size_t end = std::min(nodes.size(), i + array_width);
+      parent->children.assign(nodes.begin() + i, nodes.begin() + end);
+      parents.push_back(std::move(parent));
+    }
+
+    nodes = std::move(parents);
+    m_shift += array_bits;
+  }
+
+  auto root = std::make_shared<Node>();
+  root->children = std::move(nodes);
+  m_root = std::move(root);
+
+  auto tail = std::make_shared<Node>();
+  tail->values.assign(values.begin() + tailoff, values.end());
+  m_tail = std::move(tail);
+}
+
+PersistentArrayValue::~PersistentArrayValue()
+{
+
+}
+
+/*!
+ * \fn static std::shared_ptr<PersistentArrayValue> from(const Array& array)
+ * \brief returns a persistent version of an array
+ *
+ * This is free if the array is already persistent, otherwise its
+ * elements are copied.
+ */
+std::shared_ptr<PersistentArrayValue> PersistentArrayValue::from(const Array& array)
+{
+  auto self = std::dynamic_pointer_cast<PersistentArrayValue>(array.impl());
+
+  if (self)
+    return self;
+
+  std::vector<Value> values;
+  values.reserve(array.length());
+  array.forEach([&values](const Value& v) { values.push_back(v); });
+
+  return allocate_value<PersistentArrayValue>(values);
+}
+
+bool PersistentArrayValue::is_array() const
+{
+  return true;
+}
+
+std::type_index PersistentArrayValue::type_index() const
+{
+  return std::type_index(typeid(PersistentArrayValue));
+}
+
+void* PersistentArrayValue::data()
+{
+  return this;
+}
+
+size_t PersistentArrayValue::length() const
+{
+  return m_size;
+}
+
+Value PersistentArrayValue::at(size_t index) const
+{
+  return *find(index);
+}
+
+const Value* PersistentArrayValue::find(size_t index) const
+{
+  return index < m_size ? &leafFor(index)->values[index & array_mask] : &Value::null_value;
+}
+
+const Value* PersistentArrayValue::chunk(size_t offset, size_t& count) const
+{
+  if (offset >= m_size)
+  {
+    count = 0;
+    return nullptr;
+  }
+
+  const Node& leaf = *leafFor(offset);
+  const size_t start = offset & array_mask;
+  count = leaf.values.size() - start;
+  return leaf.values.data() + start;
+}
+
+/*!
+ * \fn std::shared_ptr<PersistentArrayValue> pushed(Value val) const
+ * \brief returns a copy of this array with a value appended to it
+ */
+std::shared_ptr<PersistentArrayValue> PersistentArrayValue::pushed(Value val) const
+{
+  auto ret = allocate_value<PersistentArrayValue>(*this);
+
+  if (m_size - tailOffset() < array_width)
+  {
+    auto tail = std::make_shared<Node>(*m_tail);
+    tail->values.push_back(std::move(val));
+    ret->m_tail = std::move(tail);
+  }
+  else
+  {
+    if ((m_size >> array_bits) > (size_t(1) << m_shift))
+    {
+      auto root = std::make_shared<Node>();
+      root->children.push_back(m_root);
+      root->children.push_back(new_path(m_shift, m_tail));
+      ret->m_root = std::move(root);
+      ret->m_shift += array_bits;
+    }
+    else
+    {
+      ret->m_root = push_tail(m_size, m_shift, *m_root, m_tail);
+    }
+
+    auto tail = std::make_shared<Node>();
+    tail->values.push_back(std::move(val));
+    ret->m_tail = std::move(tail);
+  }
+
+  ret->m_size = m_size + 1;
+  return ret;
+}
+
+/*!
+ * \fn std::shared_ptr<PersistentArrayValue> popped() const
+ * \brief returns a copy of this array without its last element
+ *
+ * Popping an empty array returns an empty array.
+ */
+std::shared_ptr<PersistentArrayValue> PersistentArrayValue::popped() const
+{
+  if (m_size <= 1)
+    return allocate_value<PersistentArrayValue>();
+
+  auto ret = allocate_value<PersistentArrayValue>(*this);
+
+  if (m_size - tailOffset() > 1)
+  {
+    auto tail = std::make_shared<Node>(*m_tail);
+    tail->values.pop_back();
+    ret->m_tail = std::move(tail);
+  }
+  else
+  {
+    ret->m_tail = leafFor(m_size - 2);
+
+    std::shared_ptr<const Node> root = pop_tail(m_size, m_shift, *m_root);
+
+    if (!root)
+      root = std::make_shared<Node>();
+
+    if (m_shift > array_bits && root->children.size() == 1)
+    {
+      root = root->children.front();
+      ret->m_shift -= array_bits;
+    }
+
+    ret->m_root = std::move(root);
+  }
+
+  ret->m_size = m_size - 1;
+  return ret;
+}
+
+/*!
+ * \fn std::shared_ptr<PersistentArrayValue> updated(size_t index, Value val) const
+ * \brief returns a copy of this array with an element replaced
+ */
+std::shared_ptr<PersistentArrayValue> PersistentArrayValue::updated(size_t index, Value val) const
+{
+  if (index >= m_size)
+    throw std::out_of_range{ "PersistentArrayValue::updated()" };
+
+  auto ret = allocate_value<PersistentArrayValue>(*this);
+
+  if (index >= tailOffset())
+  {
+    auto tail = std::make_shared<Node>(*m_tail);
+    tail->values[index & array_mask] = std::move(val);
+    ret->m_tail = std::move(tail);
+  }
+  else
+  {
+    ret->m_root = assoc(m_shift, *m_root, index, std::move(val));
+  }
+
+  return ret;
+}
+
+size_t PersistentArrayValue::tailOffset() const
+{
+  return m_size < array_width ? 0 : ((m_size - 1) >> array_bits) << array_bits;
+}
+
+const std::shared_ptr<const PersistentArrayValue::Node>& PersistentArrayValue::leafFor(size_t index) const
+{
+  if (index >= tailOffset())
+    return m_tail;
+
+  const std::shared_ptr<const Node>* node = &m_root;
+
+  for (unsigned level = m_shift; level > 0; level -= array_bits)
+    node = &(*node)->children[(index >> level) & array_mask];
+
+  return *node;
+}
+
+/*!
+ * \endclass
+ */
+
+/*
+ * PersistentMapValue is a hash array mapped trie: each node consumes
+ * 5 bits of the hash of the key and stores its entries densely, a bitmap
+ * telling which of the 32 possible slots are used.
+ * Keys whose hashes are equal end up in a collision node.
+ */
+
+struct PersistentMapValue::Node
+{
+  struct Entry
+  {
+    Atom key;
+    Value value;
+    std::shared_ptr<const Node> sub;
+  };
+
+  uint32_t bitmap = 0;
+  bool collision = false;
+  std::vector<Entry> entries;
+};
+
+namespace
+{
+
+typedef PersistentMapValue::Node MapNode;
+
+const unsigned map_bits = 5;
+const unsigned hash_bits = sizeof(size_t) * 8;
+
+inline unsigned popcount(uint32_t x)
+{
+  x = x - ((x >> 1) & 0x55555555u);
+  x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+  x = (x + (x >> 4)) & 0x0F0F0F0Fu;
+  return (x * 0x01010101u) >> 24;
+}
+
+inline uint32_t bit_for(size_t hash, unsigned shift)
+{
+  return uint32_t(1) << ((hash >> shift) & 31);
+}
+
+inline bool key_equals(const Atom& key, const Atom& name)
+{
+  return key == name;
+}
+
+inline bool key_equals(const Atom& key, const std::string& name)
+{
+  return key.str() == name;
+}
+
+template<typename K>
+const Value* map_find(const MapNode* node, size_t hash, const K& name)
+{
+  unsigned shift = 0;
+
+  while (node)
+  {
+    if (node->collision)
+    {
+      for (const MapNode::Entry& e : node->entries)
+      {
+        if (key_equals(e.key, name))
+          return &e.value;
+      }
+
+      return nullptr;
+    }
+
+    const uint32_t bit = bit_for(hash, shift);
+
+    if (!(node->bitmap & bit))
+      return nullptr;
+
+    const MapNode::Entry& e = node->entries[popcount(node->bitmap & (bit - 1))];
+
+    if (!e.sub)
+      return key_equals(e.key, name) ? &e.value : nullptr;
+
+    node = e.sub.get();
+    shift += map_bits;
+  }
+
+  return nullptr;
+}
+
+std::shared_ptr<const MapNode> merge(unsigned shift, MapNode::Entry a, MapNode::Entry b)
+{
+  auto ret = std::make_shared<MapNode>();
+
+  if (shift >= hash_bits)
+  {
+    ret->collision = true;
+    ret->entries.push_back(std::move(a));
+    ret->entries.push_back(std::move(b));
+    return ret;
+  }
+
+  const uint32_t abit = bit_for(a.key.hash(), shift);
+  const uint32_t bbit = bit_for(b.key.hash(), shift);
+
+  if (abit == bbit)
+  {
+    ret->bitmap = abit;
+    ret->entries.push_back(MapNode::Entry{ Atom(), Value(), merge(shift + map_bits, std::move(a), std::move(b)) });
+  }
+  else
+  {
+    ret->bitmap = abit | bbit;
+    ret->entries.push_back(std::move(abit < bbit ? a : b));
+    ret->entries.push_back(std::move(abit < bbit ? b : a));
+  }
+
+  return ret;
+}
+
+std::shared_ptr<const MapNode> map_insert(const MapNode& node, unsigned shift, const Atom& name, Value val, bool& added)
+{
+  auto ret = std::make_shared<MapNode>(node);
+
+  if (node.collision)
+  {
+    for (MapNode::Entry& e : ret->entries)
+    {
+      if (e.key == name)
+      {
+        e.value = std::move(val);
+        return ret;
+      }
+    }
+
+    ret->entries.push_back(MapNode::Entry{ name, std::move(val), nullptr });
+    added = true;
+    return ret;
+  }
+
+  const uint32_t bit = bit_for(name.hash(), shift);
+  const size_t index = popcount(node.bitmap & (bit - 1));
+
+  if (!(node.bitmap & bit))
+  {
+    ret->bitmap |= bit;
+    ret->entries.insert(ret->entries.begin() + index, MapNode::Entry{ name, std::move(val), nullptr });
+    added = true;
+    return ret;
+  }
+
+  MapNode::Entry& e = ret->entries[index];
+
+  if (e.sub)
+  {
+    e.sub = map_insert(*e.sub, shift + map_bits, name, std::move(val), added);
+  }
+  else if (e.key == name)
+  {
+    e.value = std::move(val);
+  }
+  else
+  {
+    e.sub = merge(shift + map_bits, std::move(e), MapNode::Entry{ name, std::move(val), nullptr });
+    e.key = Atom();
+    e.value = Value();
+    added = true;
+  }
+
+  return ret;
+}
+
+void map_for_each(const MapNode& node, const PropertyCallback& callback)
+{
+  for (const MapNode::Entry& e : node.entries)
+  {
+    if (e.sub)
+      map_for_each(*e.sub, callback);
+    else
+      callback(e.key.str(), e.value);
+  }
+}
+
+} // namespace
+
+/*!
+ * \class PersistentMapValue
+ * \brief an immutable map sharing its structure with its versions
+ *
+ * Inserting a property returns a new map in O(log32 n), leaving this one
+ * untouched.
+ */
+
+PersistentMapValue::PersistentMapValue()
+  : m_root(std::make_shared<Node>())
+{
+
+}
+
+PersistentMapValue::~PersistentMapValue()
+{
+
+}
+
+/*!
+ * \fn static std::shared_ptr<PersistentMapValue> from(const Map& map)
+ * \brief returns a persistent version of a map
+ *
+ * This is free if the map is already persistent, otherwise its
+ * properties are copied.
+ */
+std::shared_ptr<PersistentMapValue> PersistentMapValue::from(const Map& map)
+{
+  auto self = std::dynamic_pointer_cast<PersistentMapValue>(map.impl());
+
+  if (self)
+    return self;
+
+  auto ret = allocate_value<PersistentMapValue>();
+  std::shared_ptr<const Node> root = ret->m_root;
+  size_t size = 0;
+
+  map.forEachProperty([&root, &size](const std::string& name, const Value& val) {
+    bool added = false;
+    root = map_insert(*root, 0, Atom::transient(name), val, added);
+    size += added ? 1 : 0;
+  });
+
+  ret->m_root = std::move(root);
+  ret->m_size = size;
+  return ret;
+}
+
+bool PersistentMapValue::is_map() const
+{
+  return true;
+}
+
+std::type_index PersistentMapValue::type_index() const
+{
+  return std::type_index(typeid(PersistentMapValue));
+}
+
+void* PersistentMapValue::data()
+{
+  return this;
+}
+
+std::set<std::string> PersistentMapValue::propertyNames() const
+{
+  std::set<std::string> names;
+
+  map_for_each(*m_root, [&names](const std::string& name, const Value&) {
+    names.insert(name);
+  });
+
+  return names;
+}
+
+void PersistentMapValue::forEachProperty(const PropertyCallback& callback) const
+{
+  map_for_each(*m_root, callback);
+}
+
+Value PersistentMapValue::property(const std::string& name) const
+{
+  return *find(name);
+}
+
+Value PersistentMapValue::get(const Atom& name) const
+{
+  return *find(name);
+}
+
+const Value* PersistentMapValue::find(const std::string& name) const
+{
+  const Value* val = map_find(m_root.get(), std::hash<std::string>()(name), name);
+  return val ? val : &Value::null_value;
+}
+
+const Value* PersistentMapValue::find(const Atom& name) const
+{
+  const Value* val = map_find(m_root.get(), name.hash(), name);
+  return val ? val : &Value::null_value;
+}
+
+/*!
+ * \fn std::shared_ptr<PersistentMapValue> inserted(const Atom& name, Value val) const
+ * \brief returns a copy of this map with a property inserted or replaced
+ */
+std::shared_ptr<PersistentMapValue> PersistentMapValue::inserted(const Atom& name, Value val) const
+{
+  bool added = false;
+  auto ret = allocate_value<PersistentMapValue>();
+  ret->m_root = map_insert(*m_root, 0, name, std::move(val), added);
+  ret->m_size = m_size + (added ? 1 : 0);
+  return ret;
+}
+
+/*!
+ * \endclass
+ */
+
+} // namespace liquid
@@ -4,8 +4,13 @@
 
 #include "liquid/renderer.h"
 
+#include "liquid/arithmetic.h"
 #include "liquid/context.h"
 #include "liquid/filters.h"
+#include "liquid/value_p.h"
+
+#include <algorithm>
+#include <typeinfo>
 
 /*!
  * \namespace liquid
@@ -14,6 +19,14 @@
 namespace liquid
 {
 
+static const Atom atom_size{ "size" };
+static const Atom atom_length{ "length" };
+static const Atom atom_forloop{ "forloop" };
+static const Atom atom_index{ "index" };
+static const Atom atom_first{ "first" };
+static const Atom atom_last{ "last" };
+static const Atom atom_include{ "include" };
+
 Renderer::Error::Error(size_t off, std::string mssg)
   : offset(off),
    message(std::move(mssg))
@@ -30,7 +43,8 @@ Renderer::Error::Error(size_t off, std::string mssg)
  * \brief constructs a renderer
  */
 Renderer::Renderer()
-  : m_template(nullptr)
+  : m_template(nullptr),
+    m_arena(nullptr)
 {
 
 }
@@ -41,7 +55,7 @@ Renderer::Renderer()
  */
 Renderer::~Renderer()
 {
-  
+  setArenaEnabled(false);
 }
 
 /*!
@@ -54,10 +68,74 @@ void Renderer::reset()
   m_errors.clear();
   m_template = nullptr;
   context().scopes().clear();
+
+  if (m_arena)
+  {
+    // values that escaped the previous rendering keep its arena alive
+    if (!m_arena->isShared())
+    {
+      m_arena->reset();
+    }
+    else
+    {
+      m_arena->deref();
+      m_arena = new Arena;
+    }
+  }
+
   context().scopes().emplace_back();
   context().flags() = 0;
 }
 
+/*!
+ * \fn bool isArenaEnabled() const
+ * \brief returns whether values are allocated from an arena during rendering
+ */
+bool Renderer::isArenaEnabled() const
+{
+  return m_arena != nullptr;
+}
+
+/*!
+ * \fn void setArenaEnabled(bool on)
+ * \brief enables or disables the allocation of values from an arena
+ * 
+ * When enabled, the values created while rendering (temporaries, loop 
+ * variables, filter results, ...) are allocated from a monotonic arena 
+ * owned by the renderer, instead of being individually allocated on the heap.
+ * The arena is reused by the next call to \c{render()}.
+ * 
+ * Values that outlive the rendering, for example values stored in the 
+ * input data with an 'assign global' tag, keep the arena alive: they remain 
+ * valid, but the memory of the arena is not reused and the renderer 
+ * starts a new one.
+ * 
+ * The arena is disabled by default.
+ */
+void Renderer::setArenaEnabled(bool on)
+{
+  if (on && !m_arena)
+  {
+    m_arena = new Arena;
+  }
+  else if (!on && m_arena)
+  {
+    m_arena->deref();
+    m_arena = nullptr;
+  }
+}
+
+/*!
+ * \fn Arena* arena() const
+ * \brief returns the arena used by the renderer
+ * 
+ * Returns nullptr if the arena is not enabled.
+ */
+Arena* Renderer::arena() const
+{
+  return m_arena;
+}
+
 /*!
  * \fn Context& context()
  * \brief returns the renderer context
@@ -129,11 +207,13 @@ std::string Renderer::render(const Template& t, const liquid::Map& data)
 
   m_template = &t;
 
+  Arena::Scope arena_scope{ m_arena };
+
   try
   {
     Context::Scope template_scope{ context(), t };
 
-    for (auto n : t.nodes())
+    for (const auto& n : t.nodes())
     {
       process(n);
 
@@ -161,13 +241,50 @@ std::string Renderer::render(const Template& t, const liquid::Map& data)
 
 void Renderer::process(const std::shared_ptr<Template::Node>& n)
 {
-  if (n->isText())
+  switch (n->kind())
+  {
+  case Template::Node::TextKind:
   {
-    write(n->as<templates::TextNode>().text);
+    const auto& text = n->as<templates::TextNode>();
+    write(text.data(), text.length);
+    return;
   }
-  else if (n->isObject())
+  case Template::Node::AssignKind:
+    return visitTag(n->as<tags::Assign>());
+  case Template::Node::CaptureKind:
+    return visitTag(n->as<tags::Capture>());
+  case Template::Node::ForKind:
+    return visitTag(n->as<tags::For>());
+  case Template::Node::BreakKind:
+    return visitTag(n->as<tags::Break>());
+  case Template::Node::ContinueKind:
+    return visitTag(n->as<tags::Continue>());
+  case Template::Node::IfKind:
+    return visitTag(n->as<tags::If>());
+  case Template::Node::EjectKind:
+    return visitTag(n->as<tags::Eject>());
+  case Template::Node::DiscardKind:
+    return visitTag(n->as<tags::Discard>());
+  case Template::Node::IncludeKind:
+    return visitTag(n->as<tags::Include>());
+  case Template::Node::NewlineKind:
+    return visitTag(n->as<tags::Newline>());
+  case Template::Node::CommentKind:
+    return;
+  default:
+    break;
+  }
+
+  if (n->isObject())
   {
-    write(stringify(eval(std::static_pointer_cast<Object>(n))));
+    liquid::Value storage;
+    const liquid::Value& val = eval(std::static_pointer_cast<Object>(n), storage);
+
+    // strings may be written without being copied, see writeString()
+    if (val.kind() == liquid::Value::StringKind)
+      writeString(val);
+    else
+      write(stringify(val));
   }
   else if (n->isTag())
   {
@@ -179,18 +296,25 @@ static std::string stringify_value(const liquid::Value& val);
 
 static std::string stringify_map(const liquid::Map& map)
 {
-  std::set<std::string> names = map.propertyNames();
+  // properties are printed by name, as they used to be when stored in a std::map
+  std::vector<std::pair<std::string, std::string>> props;
+
+  map.forEachProperty([&props](const std::string& name, const liquid::Value& val) {
+    props.emplace_back(name, stringify_value(val));
+  });
 
-  if (names.empty())
+  if (props.empty())
     return "{}";
 
+  std::sort(props.begin(), props.end());
+
   std::string result;
 
   result.push_back('{');
 
-  for (const auto& n : names)
+  for (const auto& p : props)
   {
-    result += "\"" + n +"\": " + stringify_value(map.property(n)) + ", ";
+    result += "\"" + p.first + "\": " + p.second + ", ";
   }
 
   result.pop_back();
@@ -207,59 +331,45 @@ static std::string stringify_array(const liquid::Array& vec)
 
   result.push_back('[');
 
-  for (size_t i(0); i < vec.length(); ++i)
-  {
-    result += stringify_value(vec.at(i)) + ", ";
-  }
+  // streams report no length, the separator is written before each element but the first
+  bool first = true;
 
-  if (vec.length() > 0)
-  {
-    result.pop_back();
-    result.pop_back();
-  }
+  vec.forEach([&result, &first](const liquid::Value& elem) {
+    if (!first)
+      result += ", ";
+
+    first = false;
+    result += stringify_value(elem);
+  });
 
   result.push_back(']');
 
   return result;
 }
 
+struct Stringifier
+{
+  bool quote_strings;
+
+  std::string operator()(std::nullptr_t) const { return {}; }
+  std::string operator()(bool b) const { return b ? "true" : "false"; }
+  std::string operator()(int n) const { return StringBackend::from_integer(n); }
+  std::string operator()(long long n) const { return std::to_string(n); }
+  std::string operator()(double x) const { return StringBackend::from_number(x); }
+  std::string operator()(const std::string& str) const { return quote_strings ? "\"" + str + "\"" : str; }
+  std::string operator()(const liquid::Array& vec) const { return stringify_array(vec); }
+  std::string operator()(const liquid::Map& map) const { return stringify_map(map); }
+  std::string operator()(const liquid::Value&) const { return {}; }
+};
+
 static std::string stringify_value(const liquid::Value& val)
 {
-  if (val.is<std::string>())
-    return "\"" + val.as<std::string>() + "\"";
-  else if (val.is<bool>())
-    return val.as<bool>() ? "true" : "false";
-  else if (val.is<int>())
-    return StringBackend::from_integer(val.as<int>());
-  else if (val.is<double>())
-    return StringBackend::from_number(val.as<double>());
-  else if (val.isMap())
-    return stringify_map(val.toMap());
-  else if (val.isArray())
-    return stringify_array(val.toArray());
-  else
-    return "";
+  return val.visit(Stringifier{ true });
 }
 
 std::string Renderer::defaultStringify(const liquid::Value& val)
 {
-  if (val.isNull())
-    return {};
-
-  if (val.is<std::string>())
-    return val.as<std::string>();
-  else if (val.is<bool>())
-    return val.as<bool>() ? "true" : "false";
-  else if (val.is<int>())
-    return StringBackend::from_integer(val.as<int>());
-  else if (val.is<double>())
-    return StringBackend::from_number(val.as<double>());
-  else if (val.isMap())
-    return stringify_map(val.toMap());
-  else if (val.isArray())
-    return stringify_array(val.toArray());
-  else
-    return {};
+  return val.visit(Stringifier{ false });
 }
 
 std::string Renderer::stringify(const liquid::Value& val)
@@ -272,6 +382,45 @@ void Renderer::write(const std::string& str)
   m_result += str;
 }
 
+void Renderer::write(const char* str, size_t length)
+{
+  m_result.append(str, length);
+}
+
+/*!
+ * \fn virtual void writeString(const liquid::Value& str)
+ * \brief writes the string value of an object
+ *
+ * By default, strings are converted by \c{stringify()}, as the other 
+ * values, so that a subclass overriding it (e.g. to escape HTML) 
+ * applies to them. Only the Renderer class itself writes them 
+ * without copying them.
+ *
+ * A subclass whose \c{stringify()} does not change strings can override 
+ * this function to call \c{appendString()} and avoid the copy.
+ */
+void Renderer::writeString(const liquid::Value& str)
+{
+  if (typeid(*this) == typeid(Renderer))
+    appendString(str);
+  else
+    write(stringify(str));
+}
+
+/*!
+ * \fn void appendString(const liquid::Value& str)
+ * \brief appends a string value to the output without copying it first
+ */
+void Renderer::appendString(const liquid::Value& str)
+{
+  auto* strval = dynamic_cast<const StringValue*>(str.get());
+
+  if (strval)
+    strval->appendTo(m_result);
+  else
+    m_result += str.as<std::string>();
+}
+
 void Renderer::record(const EvaluationException& ex)
 {
   m_errors.emplace_back(ex.offset_, ex.message_);
@@ -308,20 +457,40 @@ std::string Renderer::capture(const Template& tmplt, const liquid::Map& data)
 
 std::string Renderer::capture(const std::vector<std::shared_ptr<templates::Node>>& nodes)
 {
-  size_t offset = m_result.size();
+  // the nodes are rendered in a separate buffer that is returned without a copy
+  std::string output;
+  std::swap(output, m_result);
 
-  process(nodes);
-
-  std::string captured{ m_result.begin() + offset, m_result.end() };
-  m_result.resize(offset);
+  try
+  {
+    process(nodes);
+  }
+  catch (...)
+  {
+    output += m_result;
+    std::swap(output, m_result);
+    throw;
+  }
 
-  return captured;
+  std::swap(output, m_result);
+  return output;
 }
 
 bool Renderer::evalCondition(const liquid::Value& val)
 {
-  return val.is<bool>() ? val.as<bool>() :
-    (val.is<int>() ? val.as<int>() != 0 : !val.isNull());
+  switch (val.kind())
+  {
+  case liquid::Value::NullKind:
+    return false;
+  case liquid::Value::BooleanKind:
+    return val.as<bool>();
+  case liquid::Value::IntegerKind:
+    return val.as<int>() != 0;
+  case liquid::Value::Integer64Kind:
+    return val.as<long long>() != 0;
+  default:
+    return true;
+  }
 }
 
 liquid::Value Renderer::eval(const std::shared_ptr<Object>& obj)
@@ -329,12 +498,32 @@ liquid::Value Renderer::eval(const std::shared_ptr<Object>& obj)
   return obj->accept(*this);
 }
 
+/*!
+ * \fn const liquid::Value& eval(const std::shared_ptr<Object>& obj, liquid::Value& storage)
+ * \brief evaluates an object, without copying its value if possible
+ * 
+ * Variables and member accesses that refer to values stored in the context 
+ * are returned by reference; other objects are evaluated into \c{storage}.
+ * 
+ * The returned reference is only valid until the context is modified.
+ */
+const liquid::Value& Renderer::eval(const std::shared_ptr<Object>& obj, liquid::Value& storage)
+{
+  const liquid::Value* val = obj->resolve(*this);
+
+  if (val)
+    return *val;
+
+  storage = obj->accept(*this);
+  return storage;
+}
+
 std::vector<liquid::Value> Renderer::eval(const std::vector<std::shared_ptr<Object>>& objects)
 {
   std::vector<liquid::Value> result;
   result.reserve(objects.size());
 
-  for (auto obj : objects)
+  for (const auto& obj : objects)
     result.push_back(eval(obj));
 
   return result;
@@ -350,65 +539,75 @@ liquid::Value Renderer::eval_variable(const objects::Variable& var)
   for (int i = static_cast<int>(context().scopes().size()) - 1; i >= 0; --i)
   {
     const auto& data = context().scopes().at(i).data;
-    
-    liquid::Value val = data.property(var.name);
+    const liquid::Value* borrowed = data.find(var.name);
 
-    if (!val.isNull())
-      return val;
+    if (borrowed)
+    {
+      if (!borrowed->isNull())
+        return *borrowed;
+    }
+    else
+    {
+      liquid::Value val = data.property(var.name);
+
+      if (!val.isNull())
+        return val;
+    }
   }
   
   return nullptr;
 }
 
+static size_t string_size(const liquid::Value& str)
+{
+  auto* strval = dynamic_cast<const StringValue*>(str.get());
+  return strval ? strval->size() : str.as<std::string>().size();
+}
+
 liquid::Value Renderer::eval_memberaccess(const objects::MemberAccess& ma)
 {
-  const liquid::Value obj = eval(ma.object);
+  liquid::Value storage;
+  const liquid::Value& obj = eval(ma.object, storage);
 
-  if (obj.isArray())
+  switch (obj.kind())
   {
-    if (ma.name == "size" || ma.name == "length")
+  case liquid::Value::ArrayKind:
+    if (ma.name == atom_size || ma.name == atom_length)
       return liquid::Value(int(obj.length()));
     else
       return nullptr;
-  }
-  else if (obj.isMap())
-  {
+  case liquid::Value::MapKind:
     return obj.property(ma.name);
-  }
-  else if (obj.is<std::string>())
-  {
-    if (ma.name == "size" || ma.name == "length")
-      return static_cast<int>(obj.as<std::string>().size());
+  case liquid::Value::StringKind:
+    if (ma.name == atom_size || ma.name == atom_length)
+      return static_cast<int>(string_size(obj));
     else
       return nullptr;
-  }
-  else
-  {
+  default:
     throw EvaluationException{ "Value does not support member access", context().currentTemplate(), ma.object->offset() };
   }
 }
 
 liquid::Value Renderer::eval_arrayaccess(const objects::ArrayAccess & aa)
 {
-  const liquid::Value obj = eval(aa.object);
-  const liquid::Value index = eval(aa.index);
+  liquid::Value obj_storage;
+  const liquid::Value& obj = eval(aa.object, obj_storage);
+  liquid::Value index_storage;
+  const liquid::Value& index = eval(aa.index, index_storage);
 
-  if (index.is<int>())
+  switch (index.kind())
   {
+  case liquid::Value::IntegerKind:
     if (!obj.isArray())
       throw EvaluationException{ "Value is not an array", context().currentTemplate(),  aa.object->offset() };
 
     return obj.at(index.as<int>());
-  }
-  else if (index.is<std::string>())
-  {
+  case liquid::Value::StringKind:
     if (!obj.isMap())
       throw EvaluationException{ "Value is not an object",  context().currentTemplate(), aa.object->offset() };
 
     return obj.property(index.as<std::string>());
-  }
-  else
-  {
+  default:
     throw EvaluationException{ "Index must be a 'string' or an 'int'",  context().currentTemplate(), aa.index->offset() };
   }
 }
@@ -427,8 +626,10 @@ liquid::Value Renderer::eval_binop(const objects::BinOp & binop)
     break;
   }
 
-  const liquid::Value lhs = eval(binop.lhs);
-  const liquid::Value rhs = eval(binop.rhs);
+  liquid::Value lhs_storage;
+  const liquid::Value& lhs = eval(binop.lhs, lhs_storage);
+  liquid::Value rhs_storage;
+  const liquid::Value& rhs = eval(binop.rhs, rhs_storage);
 
   switch (binop.operation)
   {
@@ -452,6 +653,8 @@ liquid::Value Renderer::eval_binop(const objects::BinOp & binop)
     return value_mul(lhs, rhs);
   case objects::BinOp::Div:
     return value_div(lhs, rhs);
+  case objects::BinOp::Mod:
+    return value_mod(lhs, rhs);
   default:
     break;
   }
@@ -467,12 +670,40 @@ liquid::Value Renderer::eval_logicalnot(const objects::LogicalNot& op)
 
 liquid::Value Renderer::eval_pipe(const objects::Pipe & pipe)
 {
-  liquid::Value obj = eval(pipe.object);
-  std::vector<liquid::Value> args = eval(pipe.arguments);
+  liquid::Value storage;
+  const liquid::Value& obj = eval(pipe.object, storage);
+
+  // argument lists are recycled, filters can be nested in the arguments
+  struct PooledArguments
+  {
+    std::vector<std::vector<liquid::Value>>& pool;
+    std::vector<liquid::Value> values;
+
+    explicit PooledArguments(std::vector<std::vector<liquid::Value>>& p)
+      : pool(p)
+    {
+      if (!pool.empty())
+      {
+        values = std::move(pool.back());
+        pool.pop_back();
+      }
+    }
+
+    ~PooledArguments()
+    {
+      values.clear();
+      pool.push_back(std::move(values));
+    }
+  };
+
+  PooledArguments args{ m_arguments_pool };
+
+  for (const auto& a : pipe.arguments)
+    args.values.push_back(eval(a));
 
   try
   {
-    return applyFilter(pipe.filterName, obj, args);
+    return applyFilter(pipe.filterName, obj, args.values);
   }
   catch (EvaluationException& ex)
   {
@@ -483,92 +714,27 @@ liquid::Value Renderer::eval_pipe(const objects::Pipe & pipe)
 
 liquid::Value Renderer::value_add(const liquid::Value& lhs, const liquid::Value& rhs) const
 {
-  if (lhs.is<int>())
-  {
-    if (rhs.is<int>())
-      return lhs.as<int>() + rhs.as<int>();
-    else if (rhs.is<double>())
-      return lhs.as<int>() + rhs.as<double>();
-  }
-  else if (lhs.is<double>())
-  {
-    if (rhs.is<int>())
-      return lhs.as<double>() + rhs.as<int>();
-    else if (rhs.is<double>())
-      return lhs.as<double>() + rhs.as<double>();
-  }
-  else if (lhs.is<std::string>())
-  {
-    if (rhs.is<std::string>())
-      return lhs.as<std::string>() + rhs.as<std::string>();
-  }
-  else if (lhs.isArray())
-  {
-    if (rhs.isArray())
-      return ArrayFilters::concat(lhs.toArray(), rhs.toArray());
-  }
-
-  throw EvaluationException{ "operator + cannot proceed with given operands" };
+  return Arithmetic::apply(Arithmetic::Add, lhs, rhs);
 }
 
 liquid::Value Renderer::value_sub(const liquid::Value& lhs, const liquid::Value& rhs) const
 {
-  if (lhs.is<int>())
-  {
-    if (rhs.is<int>())
-      return lhs.as<int>() - rhs.as<int>();
-    else if (rhs.is<double>())
-      return lhs.as<int>() - rhs.as<double>();
-  }
-  else if (lhs.is<double>())
-  {
-    if (rhs.is<int>())
-      return lhs.as<double>() - rhs.as<int>();
-    else if (rhs.is<double>())
-      return lhs.as<double>() - rhs.as<double>();
-  }
-
-  throw EvaluationException{ "operator - cannot proceed with given operands" };
+  return Arithmetic::apply(Arithmetic::Sub, lhs, rhs);
 }
 
 liquid::Value Renderer::value_mul(const liquid::Value& lhs, const liquid::Value& rhs) const
 {
-  if (lhs.is<int>())
-  {
-    if (rhs.is<int>())
-      return lhs.as<int>() * rhs.as<int>();
-    else if (rhs.is<double>())
-      return lhs.as<int>() * rhs.as<double>();
-  }
-  else if (lhs.is<double>())
-  {
-    if (rhs.is<int>())
-      return lhs.as<double>() * rhs.as<int>();
-    else if (rhs.is<double>())
-      return lhs.as<double>() * rhs.as<double>();
-  }
-
-  throw EvaluationException{ "operator * cannot proceed with given operands" };
+  return Arithmetic::apply(Arithmetic::Mul, lhs, rhs);
 }
 
 liquid::Value Renderer::value_div(const liquid::Value& lhs, const liquid::Value& rhs) const
 {
-  if (lhs.is<int>())
-  {
-    if (rhs.is<int>())
-      return lhs.as<int>() / rhs.as<int>();
-    else if (rhs.is<double>())
-      return lhs.as<int>() / rhs.as<double>();
-  }
-  else if (lhs.is<double>())
-  {
-    if (rhs.is<int>())
-      return lhs.as<double>() / rhs.as<int>();
-    else if (rhs.is<double>())
-      return lhs.as<double>() / rhs.as<double>();
-  }
+  return Arithmetic::apply(Arithmetic::Div, lhs, rhs);
+}
 
-  throw EvaluationException{ "operator / cannot proceed with given operands" };
+liquid::Value Renderer::value_mod(const liquid::Value& lhs, const liquid::Value& rhs) const
+{
+  return Arithmetic::apply(Arithmetic::Mod, lhs, rhs);
 }
 
 liquid::Value Renderer::applyFilter(const std::string& name, const liquid::Value& object, const std::vector<liquid::Value>& args)
@@ -614,31 +780,102 @@ void Renderer::visitTag(const tags::For & tag)
   liquid::Value container = eval(tag.object);
 
   Context::Scope forloop{ context(), Context::ControlBlockScope };
-  forloop["forloop"] = liquid::Map();
+  liquid::Map forloop_data;
+  forloop_data.insert(atom_index, 0);
+  forloop_data.insert(atom_first, true);
+  forloop_data.insert(atom_last, false);
+  forloop[atom_forloop] = forloop_data;
 
   if (container.isArray())
   {
-    for (int i(0); i < container.length(); ++i)
-    {
-      forloop[tag.variable] = container.at(i);
+    // the maps are not modified while iterating, the references stay valid
+    liquid::Value& element = forloop[tag.variable];
+    liquid::Value& index = forloop_data[atom_index];
+    liquid::Value& first = forloop_data[atom_first];
+    liquid::Value& last = forloop_data[atom_last];
 
-      forloop["forloop"].toMap()["index"] = i;
-      forloop["forloop"].toMap()["first"] = (i == 0);
-      forloop["forloop"].toMap()["last"] = (i == container.length() - 1);
+    std::shared_ptr<liquid::IValue> impl = container.impl();
 
-      process(tag.body);
+    if (impl->is_stream())
+    {
+      // the length of a stream is unknown, 'last' is found by reading one element ahead
+      liquid::Value ahead;
+      bool has_next = impl->next(ahead);
 
-      if (context().flags() & (Context::Continue | Context::Break))
+      for (size_t i = 0; has_next; ++i)
       {
-        int rflags = context().flags();
-        context().flags() = 0;
+        element = std::move(ahead);
+        ahead = liquid::Value();
+        has_next = impl->next(ahead);
+
+        index = static_cast<int>(i);
+
+        if (i == 1)
+          first = false;
 
-        if (rflags & Context::Break)
+        if (!has_next)
+          last = true;
+
+        process(tag.body);
+
+        if (context().flags() & (Context::Continue | Context::Break))
+        {
+          int rflags = context().flags();
+          context().flags() = 0;
+
+          if (rflags & Context::Break)
+            return;
+        }
+        else if (context().flags() & Context::Eject)
+        {
           return;
+        }
       }
-      else if (context().flags() & Context::Eject)
+
+      return;
+    }
+
+    const size_t length = container.length();
+    size_t i = 0;
+
+    while (i < length)
+    {
+      // elements that are stored contiguously are read without a virtual call
+      size_t count = 0;
+      const liquid::Value* elements = container.chunk(i, count);
+      const bool contiguous = elements != nullptr && count > 0;
+      const size_t end = contiguous ? std::min(length, i + count) : i + 1;
+
+      for (; i < end; ++i)
       {
-        return;
+        if (contiguous)
+          element = *elements++;
+        else
+          element = container.at(i);
+
+        // 'first' and 'last' are only written when they change
+        index = static_cast<int>(i);
+
+        if (i == 1)
+          first = false;
+
+        if (i == length - 1)
+          last = true;
+
+        process(tag.body);
+
+        if (context().flags() & (Context::Continue | Context::Break))
+        {
+          int rflags = context().flags();
+          context().flags() = 0;
+
+          if (rflags & Context::Break)
+            return;
+        }
+        else if (context().flags() & Context::Eject)
+        {
+          return;
+        }
       }
     }
   }
@@ -654,7 +891,9 @@ void Renderer::visitTag(const tags::If & tag)
   {
     const auto& b = tag.blocks.at(i);
 
-    if (evalCondition(eval(b.condition)))
+    liquid::Value storage;
+
+    if (evalCondition(eval(b.condition, storage)))
     {
       process(b.body);
       return;
@@ -694,16 +933,17 @@ void Renderer::visitTag(const tags::Include& tag)
   const Template& tmplt = it->second;
 
   Context::Scope include_scope{ context(), tmplt };
-  include_scope["include"] = liquid::Map();
-  include_scope["include"].toMap()["__"] = true;
+  liquid::Map include_data;
+  include_data["__"] = true;
 
   for (const auto& e : tag.objects)
   {
     const std::string& var_name = e.first;
-    liquid::Value var_value = eval(e.second);
-    include_scope["include"].toMap()[var_name] = var_value;
+    include_data[var_name] = eval(e.second);
   }
 
+  include_scope[atom_include] = std::move(include_data);
+
   process(tmplt.nodes());
 }
 
@@ -747,6 +987,55 @@ liquid::Value Renderer::visitObject(const objects::Pipe& pipe)
   return eval_pipe(pipe);
 }
 
+const liquid::Value* Renderer::resolveObject(const objects::Value& val)
+{
+  return &val.value;
+}
+
+/*!
+ * \fn const liquid::Value* resolveObject(const objects::Variable& var)
+ * \brief returns a pointer to the value of a variable stored in the context
+ * 
+ * Returns nullptr if the value cannot be borrowed, in which case the 
+ * object must be evaluated.
+ */
+const liquid::Value* Renderer::resolveObject(const objects::Variable& var)
+{
+  for (int i = static_cast<int>(context().scopes().size()) - 1; i >= 0; --i)
+  {
+    const liquid::Value* val = context().scopes().at(i).data.find(var.name);
+
+    if (!val || !val->isNull())
+      return val;
+  }
+
+  return &liquid::Value::null_value;
+}
+
+const liquid::Value* Renderer::resolveObject(const objects::MemberAccess& ma)
+{
+  const liquid::Value* obj = ma.object->resolve(*this);
+  return obj && obj->isMap() ? obj->find(ma.name) : nullptr;
+}
+
+const liquid::Value* Renderer::resolveObject(const objects::ArrayAccess& aa)
+{
+  const liquid::Value* obj = aa.object->resolve(*this);
+  const liquid::Value* index = obj ? aa.index->resolve(*this) : nullptr;
+
+  if (!index)
+    return nullptr;
+
+  // out of range accesses are left to eval_arrayaccess()
+  if (index->kind() == liquid::Value::IntegerKind && obj->isArray()
+    && index->as<int>() >= 0 && static_cast<size_t>(index->as<int>()) < obj->length())
+    return obj->find(static_cast<size_t>(index->as<int>()));
+  else if (index->kind() == liquid::Value::StringKind && obj->isMap())
+    return obj->find(index->as<std::string>());
+  
+  return nullptr;
+}
+
 /*!
  * \endclass
  */
@@ -0,0 +1,357 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "liquid/snapshot.h"
+
+#include "liquid/arena.h"
+
+#include <algorithm>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace liquid
+{
+
+namespace
+{
+
+/*
+ * The nodes of a snapshot are allocated from the arena of the snapshot
+ * and referenced by non-owning shared pointers, i.e. pointers without
+ * a control block; they are destroyed by the snapshot.
+ */
+
+class FrozenString : public IValue
+{
+public:
+  std::string value;
+
+public:
+  explicit FrozenString(std::string str)
+    : value(std::move(str))
+  {
+
+  }
+
+  std::type_index type_index() const override
+  {
+    return std::type_index(typeid(std::string));
+  }
+
+  void* data() override
+  {
+    return &value;
+  }
+};
+
+class FrozenArray : public IValue
+{
+public:
+  FrozenArray(Value* elements, size_t size)
+    : m_elements(elements),
+      m_size(size)
+  {
+
+  }
+
+  ~FrozenArray()
+  {
+    for (size_t i(0); i < m_size; ++i)
+      m_elements[i].~Value();
+  }
+
+  bool is_array() const override
+  {
+    return true;
+  }
+
+  std::type_index type_index() const override
+  {
+    return std::type_index(typeid(FrozenArray));
+  }
+
+  void* data() override
+  {
+    return this;
+  }
+
+  size_t length() const override
+  {
+    return m_size;
+  }
+
+  Value at(size_t index) const override
+  {
+    return *find(index);
+  }
+
+  const Value* find(size_t index) const override
+  {
+    return index < m_size ? m_elements + index : &Value::null_value;
+  }
+
+  const Value* chunk(size_t offset, size_t& count) const override
+  {
+    count = offset < m_size ? m_size - offset : 0;
+    return m_elements + (offset < m_size ? offset : m_size);
+  }
+
+private:
+  Value* m_elements;
+  size_t m_size;
+};
+
+struct FrozenEntry
+{
+  Atom name;
+  Value value;
+};
+
+// entries are sorted by the hash of their name
+class FrozenMap : public IValue
+{
+public:
+  FrozenMap(FrozenEntry* entries, size_t size)
+    : m_entries(entries),
+      m_size(size)
+  {
+
+  }
+
+  ~FrozenMap()
+  {
+    for (size_t i(0); i < m_size; ++i)
+      m_entries[i].~FrozenEntry();
+  }
+
+  bool is_map() const override
+  {
+    return true;
+  }
+
+  std::type_index type_index() const override
+  {
+    return std::type_index(typeid(FrozenMap));
+  }
+
+  void* data() override
+  {
+    return this;
+  }
+
+  std::set<std::string> propertyNames() const override
+  {
+    std::set<std::string> result;
+
+    for (size_t i(0); i < m_size; ++i)
+      result.insert(m_entries[i].name.str());
+
+    return result;
+  }
+
+  void forEachProperty(const PropertyCallback& callback) const override
+  {
+    for (size_t i(0); i < m_size; ++i)
+      callback(m_entries[i].name.str(), m_entries[i].value);
+  }
+
+  Value property(const std::string& name) const override
+  {
+    return *find(name);
+  }
+
+  Value get(const Atom& name) const override
+  {
+    return *find(name);
+  }
+
+  const Value* find(const std::string& name) const override
+  {
+    const size_t h = std::hash<std::string>()(name);
+
+    for (const FrozenEntry* it = lowerBound(h); it != m_entries + m_size && it->name.hash() == h; ++it)
+    {
+      if (it->name.str() == name)
+        return &it->value;
+    }
+
+    return &Value::null_value;
+  }
+
+  const Value* find(const Atom& name) const override
+  {
+    for (const FrozenEntry* it = lowerBound(name.hash()); it != m_entries + m_size && it->name.hash() == name.hash(); ++it)
+    {
+      if (it->name == name)
+        return &it->value;
+    }
+
+    return &Value::null_value;
+  }
+
+private:
+  const FrozenEntry* lowerBound(size_t hash) const
+  {
+    return std::lower_bound(m_entries, m_entries + m_size, hash, [](const FrozenEntry& e, size_t h) {
+      return e.name.hash() < h;
+    });
+  }
+
+private:
+  FrozenEntry* m_entries;
+  size_t m_size;
+};
+
+} // namespace
+
+struct Snapshot::Data
+{
+  Arena arena{ 64 * 1024 };
+  std::vector<IValue*> nodes;
+  Value root;
+
+  ~Data()
+  {
+    for (IValue* node : nodes)
+      node->~IValue();
+  }
+
+  template<typename T, typename...Args>
+  Value create(Args&&... args)
+  {
+    void* mem = arena.allocate(sizeof(T), alignof(T));
+    T* node = new (mem) T(std::forward<Args>(args)...);
+    nodes.push_back(node);
+    return Value(std::shared_ptr<IValue>(std::shared_ptr<IValue>(), node));
+  }
+
+  Value freeze(const Value& val)
+  {
+    switch (val.kind())
+    {
+    case Value::StringKind:
+      return create<FrozenString>(val.as<std::string>());
+    case Value::ArrayKind:
+      return freezeArray(val.toArray());
+    case Value::MapKind:
+      return freezeMap(val);
+    default:
+      // inline values, and user values that are kept shared
+      return val;
+    }
+  }
+
+  Value freezeArray(const Array& array)
+  {
+    const size_t n = array.length();
+    Value* elements = static_cast<Value*>(arena.allocate(n * sizeof(Value), alignof(Value)));
+    size_t i = 0;
+
+    array.forEach([&](const Value& elem) {
+      new (elements + i++) Value(freeze(elem));
+    });
+
+    return create<FrozenArray>(elements, n);
+  }
+
+  Value freezeMap(const Value& map)
+  {
+    // the values passed to the callback may be temporaries
+    std::vector<std::pair<std::string, Value>> properties;
+
+    map.forEachProperty([&properties](const std::string& name, const Value& value) {
+      properties.emplace_back(name, value);
+    });
+
+    FrozenEntry* entries = static_cast<FrozenEntry*>(arena.allocate(properties.size() * sizeof(FrozenEntry), alignof(FrozenEntry)));
+
+    for (size_t i(0); i < properties.size(); ++i)
+      new (entries + i) FrozenEntry{ Atom::transient(properties[i].first), freeze(properties[i].second) };
+
+    std::sort(entries, entries + properties.size(), [](const FrozenEntry& a, const FrozenEntry& b) {
+      return a.name.hash() < b.name.hash();
+    });
+
+    return create<FrozenMap>(entries, properties.size());
+  }
+};
+
+/*!
+ * \class Snapshot
+ */
+
+/*!
+ * \fn Snapshot()
+ * \brief constructs an empty snapshot whose root is null
+ */
+Snapshot::Snapshot()
+  : d(new Data)
+{
+
+}
+
+/*!
+ * \fn Snapshot(const Value& value)
+ * \brief constructs a snapshot of a value
+ *
+ * The value is copied recursively.
+ */
+Snapshot::Snapshot(const Value& value)
+  : d(new Data)
+{
+  d->root = d->freeze(value);
+}
+
+Snapshot::Snapshot(Snapshot&& other) noexcept
+  : d(std::move(other.d))
+{
+
+}
+
+Snapshot::~Snapshot()
+{
+
+}
+
+/*!
+ * \fn const Value& root() const
+ * \brief returns the frozen copy of the value
+ */
+const Value& Snapshot::root() const
+{
+  return d ? d->root : Value::null_value;
+}
+
+/*!
+ * \fn size_t size() const
+ * \brief returns the number of bytes used by the arrays and maps of the snapshot
+ */
+size_t Snapshot::size() const
+{
+  return d ? d->arena.size() : 0;
+}
+
+Snapshot& Snapshot::operator=(Snapshot&& other) noexcept
+{
+  d = std::move(other.d);
+  return *this;
+}
+
+/*!
+ * \endclass
+ */
+
+/*!
+ * \fn Snapshot freeze(const Value& value)
+ * \brief creates an immutable snapshot of a value
+ *
+ * \sa Snapshot
+ */
+Snapshot freeze(const Value& value)
+{
+  return Snapshot(value);
+}
+
+} // namespace liquid
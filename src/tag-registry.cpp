@@ -0,0 +1,202 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the liquid project
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "liquid/tag-registry.h"
+
+#include "liquid/parser.h"
+#include "liquid/tags.h"
+
+#include <cstring>
+
+namespace liquid
+{
+
+namespace
+{
+
+inline size_t hash_name(const char* name, size_t len)
+{
+  size_t h = static_cast<size_t>(14695981039346656037ull);
+
+  for (size_t i(0); i < len; ++i)
+  {
+    h ^= static_cast<unsigned char>(name[i]);
+    h *= static_cast<size_t>(1099511628211ull);
+  }
+
+  return h;
+}
+
+void append_to_if(templates::Node& block, std::shared_ptr<templates::Node> node)
+{
+  block.as<tags::If>().blocks.back().body.push_back(std::move(node));
+}
+
+void append_to_for(templates::Node& block, std::shared_ptr<templates::Node> node)
+{
+  block.as<tags::For>().body.push_back(std::move(node));
+}
+
+void append_to_capture(templates::Node& block, std::shared_ptr<templates::Node> node)
+{
+  block.as<tags::Capture>().body.push_back(std::move(node));
+}
+
+} // namespace
+
+/*!
+ * \class TagRegistry
+ * \brief maps tag names to the functions that parse them
+ *
+ * A tag is defined by a handler that reads the tokens following the
+ * tag name and produces nodes through the Parser.
+ *
+ * A block tag also has an end tag, and a function that appends the
+ * nodes found between the two tags to the block. The handler of a block
+ * tag opens the block with \c{Parser::openBlock()}; the end tag closes it.
+ *
+ * Names are looked up in an open-addressing hash table, without
+ * allocation. A registry must not be modified once it is used by a Parser.
+ */
+
+TagRegistry::TagRegistry()
+{
+
+}
+
+/*!
+ * \fn static std::shared_ptr<const TagRegistry> builtins()
+ * \brief returns the registry of the tags supported by default
+ *
+ * Copy this registry to add custom tags to the built-in ones.
+ */
+std::shared_ptr<const TagRegistry> TagRegistry::builtins()
+{
+  static const std::shared_ptr<const TagRegistry> registry = []() {
+    auto result = std::make_shared<TagRegistry>();
+
+    result->define("assign", [](Parser& p, const Token& k, TokenCursor& t) { p.process_tag_assign(k, t); });
+    result->defineBlock("if", [](Parser& p, const Token& k, TokenCursor& t) { p.process_tag_if(k, t); }, &append_to_if, "endif");
+    result->define("elsif", [](Parser& p, const Token& k, TokenCursor& t) { p.process_tag_elsif(k, t); });
+    result->define("else", [](Parser& p, const Token& k, TokenCursor& t) { p.process_tag_else(k, t); });
+    result->defineBlock("for", [](Parser& p, const Token& k, TokenCursor& t) { p.process_tag_for(k, t); }, &append_to_for, "endfor");
+    result->define("break", [](Parser& p, const Token& k, TokenCursor& t) { p.process_tag_break(k, t); });
+    result->define("continue", [](Parser& p, const Token& k, TokenCursor& t) { p.process_tag_continue(k, t); });
+    result->define("comment", [](Parser& p, const Token&, TokenCursor&) { p.process_tag_comment(); });
+    result->define("eject", [](Parser& p, const Token&, TokenCursor&) { p.process_tag_eject(); });
+    result->define("discard", [](Parser& p, const Token&, TokenCursor&) { p.process_tag_discard(); });
+    result->define("include", [](Parser& p, const Token& k, TokenCursor& t) { p.process_tag_include(k, t); });
+    result->defineBlock("capture", [](Parser& p, const Token& k, TokenCursor& t) { p.process_tag_capture(k, t); }, &append_to_capture, "endcapture");
+    result->define("newline", [](Parser& p, const Token& k, TokenCursor& t) { p.process_tag_newline(k, t); });
+
+    return std::shared_ptr<const TagRegistry>(std::move(result));
+  }();
+
+  return registry;
+}
+
+/*!
+ * \fn void define(std::string name, Handler handler)
+ * \brief defines a tag
+ *
+ * If a tag with the same name exists, it is replaced.
+ */
+void TagRegistry::define(std::string name, Handler handler)
+{
+  Spec spec;
+  spec.name = std::move(name);
+  spec.handler = std::move(handler);
+  insert(std::move(spec));
+}
+
+/*!
+ * \fn void defineBlock(std::string name, Handler handler, Append append, std::string end)
+ * \brief defines a block tag and its end tag
+ */
+void TagRegistry::defineBlock(std::string name, Handler handler, Append append, std::string end)
+{
+  Spec spec;
+  spec.name = std::move(name);
+  spec.handler = std::move(handler);
+  spec.append = std::move(append);
+  const size_t index = insert(std::move(spec));
+
+  Spec end_spec;
+  end_spec.name = std::move(end);
+  end_spec.closes = index;
+  insert(std::move(end_spec));
+}
+
+/*!
+ * \fn const Spec* find(const char* name, size_t len) const
+ * \brief returns the tag with the given name, or nullptr
+ */
+const TagRegistry::Spec* TagRegistry::find(const char* name, size_t len) const
+{
+  if (m_slots.empty())
+    return nullptr;
+
+  const size_t index = m_slots[slot(name, len)];
+  return index == 0 ? nullptr : &m_specs[index - 1];
+}
+
+size_t TagRegistry::insert(Spec spec)
+{
+  const Spec* existing = find(spec.name);
+
+  if (existing)
+  {
+    const size_t index = static_cast<size_t>(existing - m_specs.data());
+    m_specs[index] = std::move(spec);
+    return index;
+  }
+
+  m_specs.push_back(std::move(spec));
+
+  // keeps the table at most half full
+  if (m_slots.size() < 2 * m_specs.size())
+    rehash();
+  else
+    m_slots[slot(m_specs.back().name.data(), m_specs.back().name.size())] = m_specs.size();
+
+  return m_specs.size() - 1;
+}
+
+// returns the slot of the tag with the given name, or the empty slot where it would be inserted
+size_t TagRegistry::slot(const char* name, size_t len) const
+{
+  const size_t mask = m_slots.size() - 1;
+  size_t i = hash_name(name, len) & mask;
+
+  while (m_slots[i] != 0)
+  {
+    const Spec& spec = m_specs[m_slots[i] - 1];
+
+    if (spec.name.size() == len && std::memcmp(spec.name.data(), name, len) == 0)
+      break;
+
+    i = (i + 1) & mask;
+  }
+
+  return i;
+}
+
+void TagRegistry::rehash()
+{
+  size_t capacity = 16;
+
+  while (capacity < 2 * m_specs.size())
+    capacity *= 2;
+
+  m_slots.assign(capacity, 0);
+
+  for (size_t i(0); i < m_specs.size(); ++i)
+    m_slots[slot(m_specs[i].name.data(), m_specs[i].name.size())] = i + 1;
+}
+
+/*!
+ * \endclass
+ */
+
+} // namespace liquid
@@ -10,7 +10,13 @@ namespace liquid
 {
 
 Tag::Tag(size_t off)
-  : Node(off)
+  : Node(UserTagKind, off)
+{
+
+}
+
+Tag::Tag(Kind k, size_t off)
+  : Node(k, off)
 {
 
 }
@@ -19,6 +25,7 @@ namespace tags
 {
 
 Comment::Comment()
+  : Tag(CommentKind)
 {
 
 }
@@ -29,7 +36,7 @@ void Comment::accept(Renderer& /* r */)
 }
 
 Assign::Assign(const std::string& varname, const std::shared_ptr<Object>& expr, size_t off)
-  : Tag(off), 
+  : Tag(AssignKind, off), 
     variable(varname),
     value(expr)
 {
@@ -43,7 +50,7 @@ void Assign::accept(Renderer& r)
 
 
 Capture::Capture(const std::string& varname, size_t off)
-  : Tag(off),
+  : Tag(CaptureKind, off),
     variable(varname)
 {
 
@@ -56,7 +63,7 @@ void Capture::accept(Renderer& r)
 
 
 For::For(const std::string& varname, const std::shared_ptr<Object>& expr, size_t off)
-  : Tag(off),
+  : Tag(ForKind, off),
     variable(varname),
     object(expr)
 {
@@ -69,7 +76,7 @@ void For::accept(Renderer& r)
 }
 
 Break::Break(size_t off)
-  : Tag(off)
+  : Tag(BreakKind, off)
 {
 
 }
@@ -80,7 +87,7 @@ void Break::accept(Renderer& r)
 }
 
 Continue::Continue(size_t off)
-  : Tag(off)
+  : Tag(ContinueKind, off)
 {
 
 }
@@ -91,7 +98,7 @@ void Continue::accept(Renderer& r)
 }
 
 If::If(std::shared_ptr<Object> cond, size_t off)
-  : Tag(off)
+  : Tag(IfKind, off)
 {
   Block b;
   b.condition = cond;
@@ -104,6 +111,7 @@ void If::accept(Renderer& r)
 }
 
 Eject::Eject()
+  : Tag(EjectKind)
 {
 
 }
@@ -114,6 +122,7 @@ void Eject::accept(Renderer& r)
 }
 
 Discard::Discard()
+  : Tag(DiscardKind)
 {
 
 }
@@ -125,7 +134,8 @@ void Discard::accept(Renderer& r)
 
 
 Include::Include(std::string n)
-  : name(std::move(n))
+  : Tag(IncludeKind),
+    name(std::move(n))
 {
 }
 
@@ -135,7 +145,7 @@ void Include::accept(Renderer& r)
 }
 
 Newline::Newline(size_t off)
-  : Tag(off)
+  : Tag(NewlineKind, off)
 {
 
 }
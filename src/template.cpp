@@ -20,31 +20,47 @@ namespace liquid
 namespace templates
 {
 
-bool Node::isText() const
-{
-  return false;
-}
-
-bool Node::isTag() const
-{
-  return false;
-}
+/*!
+ * \class Node
+ * \brief base class for the nodes of a template
+ *
+ * Each node stores its kind, so that the renderer dispatches on a 
+ * single switch, and so that \c{is<T>()} and \c{as<T>()} are a 
+ * comparison and a static cast for the built-in classes, which are final.
+ *
+ * Custom objects and tags use kinds in the ranges that start at 
+ * \c{UserObjectKind} and \c{UserTagKind}. Since several custom classes 
+ * may share a kind, \c{is<T>()} uses a \c{dynamic_cast} for the classes 
+ * whose \c{ClassKind} is in these ranges, or that do not declare one.
+ */
 
-bool Node::isObject() const
-{
-  return false;
-}
+/*!
+ * \endclass
+ */
 
 TextNode::TextNode(std::string str, size_t off)
-  : Node(off),
-    text(std::move(str))
+  : Node(TextKind, off),
+    source(std::make_shared<const std::string>(std::move(str))),
+    position(0),
+    length(source->size())
 {
 
 }
 
-bool TextNode::isText() const
+/*!
+ * \fn TextNode(std::shared_ptr<const std::string> src, size_t pos, size_t len, size_t off)
+ * \brief constructs a text node referencing a range of a shared source
+ *
+ * The text is not copied: the node keeps the source alive and renders
+ * the \c{len} characters that start at \c{pos}.
+ */
+TextNode::TextNode(std::shared_ptr<const std::string> src, size_t pos, size_t len, size_t off)
+  : Node(TextKind, off),
+    source(std::move(src)),
+    position(pos),
+    length(len)
 {
-  return true;
+
 }
 
 } // namespace templates
@@ -59,6 +75,14 @@ Template::Template()
 }
 
 Template::Template(std::string src, std::vector<std::shared_ptr<templates::Node>> nodes, std::string filepath)
+  : mFilePath(std::move(filepath)),
+    mSource(std::make_shared<const std::string>(std::move(src))),
+    mNodes(std::move(nodes))
+{
+
+}
+
+Template::Template(std::shared_ptr<const std::string> src, std::vector<std::shared_ptr<templates::Node>> nodes, std::string filepath)
   : mFilePath(std::move(filepath)),
     mSource(std::move(src)),
     mNodes(std::move(nodes))
@@ -84,11 +108,16 @@ const std::string& Template::filePath() const
 
 /*!
  * \fn const std::string& source() const
- * \brief returns the original source of the template
+ * \brief returns the source of the template
+ *
+ * This is the text the template was parsed from after normalization: 
+ * line endings are converted from \c{"\r\n"} to \c{"\n"}, so it may 
+ * differ from the original text. Node offsets refer to this text.
  */
 const std::string& Template::source() const
 {
-  return mSource;
+  static const std::string empty;
+  return mSource ? *mSource : empty;
 }
 
 /*!
@@ -152,27 +181,37 @@ inline static bool is_space(char c)
   return c == ' ' || c == '\r' || c == '\t';
 }
 
-/*!
- * \fn void lstrip(std::string& str) noexcept
- * \param input string
- * \brief removes whitespaces at the beginning of string
- */
-void Template::lstrip(std::string& str) noexcept
+// returns the number of leading characters removed by lstrip()
+static size_t lstrip_count(const char* str, size_t len) noexcept
 {
   size_t i = 0;
 
-  while (i < str.size() && is_space(str.at(i))) ++i;
+  while (i < len && is_space(str[i])) ++i;
 
-  if (i == str.size() || str.at(i) != '\n')
-  {
-    str.erase(0, i);
-  }
-  else
+  if (i < len && str[i] == '\n')
   {
     ++i;
-    while (i < str.size() && is_space(str.at(i))) ++i;
-    str.erase(0, i);
+    while (i < len && is_space(str[i])) ++i;
   }
+
+  return i;
+}
+
+// returns the length of the string once rstrip() is applied
+static size_t rstrip_length(const char* str, size_t len) noexcept
+{
+  while (len > 0 && is_space(str[len - 1])) --len;
+  return len;
+}
+
+/*!
+ * \fn void lstrip(std::string& str) noexcept
+ * \param input string
+ * \brief removes whitespaces at the beginning of string
+ */
+void Template::lstrip(std::string& str) noexcept
+{
+  str.erase(0, lstrip_count(str.data(), str.size()));
 }
 
 /*!
@@ -182,14 +221,32 @@ void Template::lstrip(std::string& str) noexcept
  */
 void Template::rstrip(std::string& str) noexcept
 {
-  if (str.empty())
-    return;
-
-  size_t i = str.size();
+  str.erase(rstrip_length(str.data(), str.size()));
+}
 
-  while (i > 0 && is_space(str.at(--i)));
+/*!
+ * \fn void lstrip(templates::TextNode& text) noexcept
+ * \param text node
+ * \brief removes whitespaces at the beginning of a text node
+ *
+ * The source of the node is left untouched, only the range of text 
+ * it refers to is reduced.
+ */
+void Template::lstrip(templates::TextNode& text) noexcept
+{
+  const size_t n = lstrip_count(text.data(), text.length);
+  text.position += n;
+  text.length -= n;
+}
 
-  str.erase(is_space(str.at(i)) ? i : i + 1);
+/*!
+ * \fn void rstrip(templates::TextNode& text) noexcept
+ * \param text node
+ * \brief removes trailing whitespaces from a text node
+ */
+void Template::rstrip(templates::TextNode& text) noexcept
+{
+  text.length = rstrip_length(text.data(), text.length);
 }
 
 static void strip_whitespaces_at_tag(const std::vector<std::shared_ptr<templates::Node>>& nodes, bool strip_first, bool strip_last)
@@ -204,8 +261,7 @@ static void strip_whitespaces_at_tag(const std::vector<std::shared_ptr<templates
     {
       if (prev_was_tag)
       {
-        std::string& text = n->as<templates::TextNode>().text;
-        Template::lstrip(text);
+        Template::lstrip(n->as<templates::TextNode>());
       }
 
       prev_was_text = true;
@@ -216,7 +272,7 @@ static void strip_whitespaces_at_tag(const std::vector<std::shared_ptr<templates
     {
       if (prev_was_text)
       {
-        Template::rstrip(prev_text->as<templates::TextNode>().text);
+        Template::rstrip(prev_text->as<templates::TextNode>());
       }
 
       if (n->is<tags::If>())
@@ -243,7 +299,7 @@ static void strip_whitespaces_at_tag(const std::vector<std::shared_ptr<templates
 
   if (prev_was_text && strip_last)
   {
-    Template::rstrip(prev_text->as<templates::TextNode>().text);
+    Template::rstrip(prev_text->as<templates::TextNode>());
   }
 }
 
@@ -269,8 +325,7 @@ static void skip_whitespaces_at_tag(const std::vector<std::shared_ptr<templates:
     {
       if (prev_was_tag)
       {
-        std::string& text = n->as<templates::TextNode>().text;
-        Template::lstrip(text);
+        Template::lstrip(n->as<templates::TextNode>());
       }
 
       prev_was_tag = false;
@@ -323,9 +378,26 @@ void Template::skipWhitespacesAfterTag()
  * This function throws ParserException if parsing fails.
  */
 Template parse(const std::string& str, std::string filepath)
+{
+  return parse(str.data(), str.size(), std::move(filepath));
+}
+
+/*!
+ * \fn Template parse(const char* str, size_t length, std::string filepath = {})
+ * \param template source
+ * \param length of the source
+ * \param optional filepath from which the source was read
+ * \brief parse a template
+ * \relates Template
+ *
+ * The source is copied once, into a buffer that is shared by the 
+ * template and its text nodes.
+ */
+Template parse(const char* str, size_t length, std::string filepath)
 {
   liquid::Parser lp;
-  return Template{ str, lp.parse(str), filepath };
+  auto nodes = lp.parse(str, length);
+  return Template{ lp.source(), std::move(nodes), std::move(filepath) };
 }
 
 /*!
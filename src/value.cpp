@@ -5,7 +5,11 @@
 #include "liquid/value.h"
 #include "liquid/value_p.h"
 
+#include "liquid/arena.h"
+
+#include <algorithm>
 #include <cstring>
+#include <limits>
 #include <stdexcept>
 
 /*!
@@ -16,6 +20,7 @@ namespace liquid
 {
 
 const std::shared_ptr<IValue> Value::null_impl = std::make_shared<NullValue>();
+const Value Value::null_value = Value();
 
 NullValue::NullValue()
 {
@@ -34,6 +39,206 @@ std::type_index NullValue::type_index() const
 }
 
 
+/*!
+ * \class StringValue
+ * \brief an immutable string
+ * 
+ * A StringValue is either a plain string, a slice of another string, or 
+ * the concatenation of two strings (a rope).
+ * Slices and concatenations are created in constant time and are only 
+ * flattened into a contiguous std::string when \c{str()} is called; 
+ * \c{appendTo()} writes them without flattening.
+ */
+
+const size_t StringValue::min_rope_size;
+
+StringValue::StringValue(std::string str)
+  : m_form(Flat),
+    m_size(str.size()),
+    m_str(std::move(str)),
+    m_flat(true)
+{
+
+}
+
+StringValue::StringValue(std::shared_ptr<StringValue> str, size_t pos, size_t len)
+  : m_form(Slice),
+    m_size(len),
+    m_offset(pos),
+    m_left(std::move(str)),
+    m_flat(false)
+{
+  // a slice always refers to a flat string
+  if (m_left->m_form == Slice)
+  {
+    m_offset += m_left->m_offset;
+    m_left = m_left->m_left;
+  }
+
+  m_left->flatten();
+}
+
+StringValue::StringValue(std::shared_ptr<StringValue> lhs, std::shared_ptr<StringValue> rhs)
+  : m_form(Concatenation),
+    m_size(lhs->size() + rhs->size()),
+    m_left(std::move(lhs)),
+    m_right(std::move(rhs)),
+    m_flat(false)
+{
+
+}
+
+StringValue::~StringValue()
+{
+  auto is_owned_concatenation = [](const std::shared_ptr<StringValue>& str) {
+    return str && str->m_form == Concatenation && str.use_count() == 1;
+  };
+
+  if (!is_owned_concatenation(m_left) && !is_owned_concatenation(m_right))
+    return;
+
+  // long concatenation chains are released iteratively, 
+  // to avoid a recursion as deep as the chain
+  std::vector<std::shared_ptr<StringValue>> pending;
+  pending.push_back(std::move(m_left));
+  pending.push_back(std::move(m_right));
+
+  while (!pending.empty())
+  {
+    std::shared_ptr<StringValue> node = std::move(pending.back());
+    pending.pop_back();
+
+    if (node && node.use_count() == 1)
+    {
+      if (node->m_left)
+        pending.push_back(std::move(node->m_left));
+      if (node->m_right)
+        pending.push_back(std::move(node->m_right));
+    }
+  }
+}
+
+/*!
+ * \fn static Value slice(const Value& str, size_t pos, size_t len)
+ * \brief returns a substring that shares the storage of a string value
+ */
+Value StringValue::slice(const Value& str, size_t pos, size_t len)
+{
+  std::shared_ptr<StringValue> base = get(str);
+
+  pos = std::min(pos, base->size());
+  len = std::min(len, base->size() - pos);
+
+  if (pos == 0 && len == base->size())
+    return Value(std::static_pointer_cast<IValue>(base));
+
+  return Value(allocate_value<StringValue>(std::move(base), pos, len));
+}
+
+/*!
+ * \fn static Value concat(const Value& lhs, const Value& rhs)
+ * \brief concatenates two string values
+ * 
+ * Short results are stored as plain strings, longer results 
+ * are stored as a concatenation node that references both operands.
+ */
+Value StringValue::concat(const Value& lhs, const Value& rhs)
+{
+  std::shared_ptr<StringValue> left = get(lhs);
+  std::shared_ptr<StringValue> right = get(rhs);
+
+  if (left->size() + right->size() < min_rope_size)
+  {
+    std::string result;
+    result.reserve(left->size() + right->size());
+    left->appendTo(result);
+    right->appendTo(result);
+    return Value(std::move(result));
+  }
+
+  return Value(allocate_value<StringValue>(std::move(left), std::move(right)));
+}
+
+std::type_index StringValue::type_index() const
+{
+  return std::type_index(typeid(std::string));
+}
+
+void* StringValue::data()
+{
+  return reinterpret_cast<void*>(const_cast<std::string*>(&str()));
+}
+
+/*!
+ * \fn const std::string& str() const
+ * \brief returns the string, flattening it if needed
+ * 
+ * Flattening happens at most once and is thread-safe.
+ */
+const std::string& StringValue::str() const
+{
+  flatten();
+  return m_str;
+}
+
+/*!
+ * \fn void appendTo(std::string& out) const
+ * \brief appends the string to another string without flattening it
+ */
+void StringValue::appendTo(std::string& out) const
+{
+  if (m_flat.load(std::memory_order_acquire))
+  {
+    out.append(m_str);
+    return;
+  }
+  else if (m_form == Slice)
+  {
+    out.append(m_left->m_str, m_offset, m_size);
+    return;
+  }
+
+  std::vector<const StringValue*> pending{ this };
+
+  while (!pending.empty())
+  {
+    const StringValue* node = pending.back();
+    pending.pop_back();
+
+    if (node->m_flat.load(std::memory_order_acquire))
+      out.append(node->m_str);
+    else if (node->m_form == Slice)
+      out.append(node->m_left->m_str, node->m_offset, node->m_size);
+    else
+      pending.push_back(node->m_right.get()), pending.push_back(node->m_left.get());
+  }
+}
+
+std::shared_ptr<StringValue> StringValue::get(const Value& str)
+{
+  std::shared_ptr<StringValue> result = std::dynamic_pointer_cast<StringValue>(str.impl());
+  return result ? result : allocate_value<StringValue>(str.as<std::string>());
+}
+
+void StringValue::flatten() const
+{
+  if (m_flat.load(std::memory_order_acquire))
+    return;
+
+  std::call_once(m_flatten_flag, [this]() {
+
+    std::string result;
+    result.reserve(m_size);
+    appendTo(result);
+    m_str = std::move(result);
+    m_flat.store(true, std::memory_order_release);
+  });
+}
+
+/*!
+ * \endclass
+ */
+
 VectorValue::VectorValue()
 {
 
@@ -70,18 +275,35 @@ Value VectorValue::at(size_t index) const
   return values.at(index);
 }
 
+const Value* VectorValue::find(size_t index) const
+{
+  return index < values.size() ? &values[index] : &Value::null_value;
+}
+
+const Value* VectorValue::chunk(size_t offset, size_t& count) const
+{
+  count = offset < values.size() ? values.size() - offset : 0;
+  return values.data() + (offset < values.size() ? offset : values.size());
+}
+
 
 MapValue::MapValue()
 {
 
 }
 
-MapValue::MapValue(std::map<std::string, Value> m)
+MapValue::MapValue(FlatMap m)
   : dict(std::move(m))
 {
 
 }
 
+MapValue::MapValue(const std::map<std::string, Value>& m)
+  : dict(m.begin(), m.end())
+{
+
+}
+
 bool MapValue::is_map() const
 {
   return true;
@@ -89,7 +311,7 @@ bool MapValue::is_map() const
 
 std::type_index MapValue::type_index() const 
 {
-  return std::type_index(typeid(std::map<std::string, Value>));
+  return std::type_index(typeid(FlatMap));
 }
 
 void* MapValue::data()
@@ -103,18 +325,44 @@ std::set<std::string> MapValue::propertyNames() const
 
   for (const auto& e : dict)
   {
-    names.insert(e.first);
+    names.insert(e.first.str());
   }
 
   return names;
 }
 
+void MapValue::forEachProperty(const PropertyCallback& callback) const
+{
+  for (const auto& e : dict)
+  {
+    callback(e.first.str(), e.second);
+  }
+}
+
 Value MapValue::property(const std::string& name) const
 {
   auto it = dict.find(name);
   return it != dict.end() ? it->second : Value();
 }
 
+Value MapValue::get(const Atom& name) const
+{
+  auto it = dict.find(name);
+  return it != dict.end() ? it->second : Value();
+}
+
+const Value* MapValue::find(const std::string& name) const
+{
+  auto it = dict.find(name);
+  return it != dict.end() ? &it->second : &Value::null_value;
+}
+
+const Value* MapValue::find(const Atom& name) const
+{
+  auto it = dict.find(name);
+  return it != dict.end() ? &it->second : &Value::null_value;
+}
+
 /*!
  * \class IValue
  */
@@ -217,6 +465,25 @@ std::set<std::string> IValue::propertyNames() const
   return {};
 }
 
+/*!
+ * \fn virtual void forEachProperty(const PropertyCallback& callback) const
+ * \brief calls a function for each property of a map
+ *
+ * The default implementation calls \c{property()} for each name returned 
+ * by \c{propertyNames()}.
+ * 
+ * Implementations that store their properties should override this 
+ * function to avoid building the set of names.
+ * The properties may be visited in any order.
+ */
+void IValue::forEachProperty(const PropertyCallback& callback) const
+{
+  for (const std::string& name : propertyNames())
+  {
+    callback(name, property(name));
+  }
+}
+
 /*!
  * \fn virtual Value property(const std::string& name) const
  * \brief the name of the property
@@ -230,6 +497,119 @@ Value IValue::property(const std::string& /* name */) const
   return Value();
 }
 
+/*!
+ * \fn virtual Value get(const Atom& name) const
+ * \brief retrieves a property by its interned name
+ *
+ * The default implementation calls \c{property()} with the 
+ * interned string.
+ * 
+ * The renderer uses this function to access properties; implementations 
+ * that store their properties by Atom can override it to avoid 
+ * string comparisons.
+ */
+Value IValue::get(const Atom& name) const
+{
+  return property(name.str());
+}
+
+/*!
+ * \fn virtual const Value* find(size_t index) const
+ * \brief returns a pointer to an element stored in an array
+ *
+ * The default implementation returns nullptr, meaning that the 
+ * elements are not stored and must be retrieved with \c{at()}.
+ * 
+ * Implementations that store their elements should return a pointer 
+ * to the element, or to \c{Value::null_value} if the index is out 
+ * of range. 
+ * The pointer stays valid as long as the array is not modified.
+ */
+const Value* IValue::find(size_t /* index */) const
+{
+  return nullptr;
+}
+
+/*!
+ * \fn virtual const Value* find(const std::string& name) const
+ * \brief returns a pointer to a property stored in a map
+ *
+ * The default implementation returns nullptr, meaning that the 
+ * properties are not stored and must be retrieved with \c{property()}.
+ * 
+ * Implementations that store their properties should return a pointer 
+ * to the property, or to \c{Value::null_value} if there is no such property.
+ * The pointer stays valid as long as the map is not modified.
+ */
+const Value* IValue::find(const std::string& /* name */) const
+{
+  return nullptr;
+}
+
+/*!
+ * \fn virtual const Value* find(const Atom& name) const
+ * \brief returns a pointer to a property stored in a map
+ *
+ * Same as the string overload but the property is given by 
+ * its interned name.
+ */
+const Value* IValue::find(const Atom& /* name */) const
+{
+  return nullptr;
+}
+
+/*!
+ * \fn virtual const Value* chunk(size_t offset, size_t& count) const
+ * \brief returns a run of contiguous elements of an array
+ *
+ * The default implementation returns nullptr, meaning that the 
+ * elements are not stored and must be retrieved with \c{at()}.
+ * 
+ * Implementations that store their elements should return a pointer 
+ * to the element at \a offset and set \a count to the number of 
+ * elements that directly follow it in memory (including itself).
+ * Arrays stored in several blocks can return one block at a time; 
+ * callers then ask for the next chunk at \c{offset + count}.
+ * The pointer stays valid as long as the array is not modified.
+ * 
+ * This allows loops and filters to iterate over large arrays 
+ * without a virtual call and a copy per element.
+ */
+const Value* IValue::chunk(size_t /* offset */, size_t& count) const
+{
+  count = 0;
+  return nullptr;
+}
+
+/*!
+ * \fn virtual bool is_stream() const
+ * \brief returns whether the array can only be read once, in order
+ *
+ * The elements of a stream are produced on demand by \c{next()}, 
+ * typically from a file that is too large to be loaded in memory.
+ * Its \c{length()} is not known in advance and \c{at()} is not 
+ * supported.
+ *
+ * The default implementation returns false.
+ */
+bool IValue::is_stream() const
+{
+  return false;
+}
+
+/*!
+ * \fn virtual bool next(Value& element)
+ * \brief reads the next element of a stream
+ *
+ * Returns false, leaving \a element unchanged, once the stream is 
+ * exhausted.
+ * The default implementation returns false.
+ */
+bool IValue::next(Value& /* element */)
+{
+  return false;
+}
+
 /*!
  * \endclass
  */
@@ -243,7 +623,7 @@ Value IValue::property(const std::string& /* name */) const
  * \brief constructs a null value
  */
 Value::Value()
-  : d(null_impl)
+  : m_kind(NullKind)
 {
 
 }
@@ -253,7 +633,7 @@ Value::Value()
  * \brief constructs a null value
  */
 Value::Value(std::nullptr_t)
-  : d(null_impl)
+  : m_kind(NullKind)
 {
 
 }
@@ -263,9 +643,9 @@ Value::Value(std::nullptr_t)
  * \brief constructs a boolean value
  */
 Value::Value(bool b)
-  : d(std::make_shared<GenericValue<bool>>(b))
+  : m_kind(BooleanKind)
 {
-
+  m_data.boolean = b;
 }
 
 /*!
@@ -273,19 +653,49 @@ Value::Value(bool b)
  * \brief constructs an integer value
  */
 Value::Value(int n)
-  : d(std::make_shared<GenericValue<int>>(n))
+  : m_kind(IntegerKind)
+{
+  m_data.integer = n;
+}
+
+/*!
+ * \fn Value(long n)
+ * \brief constructs an integer value
+ *
+ * This overload makes \c{int64_t} and \c{long} values constructible 
+ * on platforms where they are not \c{long long}; see Value(long long).
+ */
+Value::Value(long n)
+  : Value(static_cast<long long>(n))
 {
 
 }
 
+/*!
+ * \fn Value(long long n)
+ * \brief constructs a 64-bit integer value
+ *
+ * Integers that fit in an \c{int} are stored as such, so that 
+ * \c{is<int>()} holds for them; the kind of the others is 
+ * \c{Integer64Kind}.
+ */
+Value::Value(long long n)
+  : m_kind(IntegerKind)
+{
+  if (n >= std::numeric_limits<int>::min() && n <= std::numeric_limits<int>::max())
+    m_data.integer = static_cast<int>(n);
+  else
+    m_kind = Integer64Kind, m_data.integer64 = n;
+}
+
 /*!
  * \fn Value(double x)
  * \brief constructs a real value
  */
 Value::Value(double x)
-  : d(std::make_shared<GenericValue<double>>(x))
+  : m_kind(NumberKind)
 {
-
+  m_data.number = x;
 }
 
 /*!
@@ -293,7 +703,8 @@ Value::Value(double x)
  * \brief constructs a string value
  */
 Value::Value(std::string str)
-  : d(std::make_shared<GenericValue<std::string>>(std::move(str)))
+  : m_kind(StringKind),
+    d(allocate_value<StringValue>(std::move(str)))
 {
 
 }
@@ -303,7 +714,8 @@ Value::Value(std::string str)
  * \brief constructs a string value
  */
 Value::Value(const char* str)
-  : d(std::make_shared<GenericValue<std::string>>(std::string(str)))
+  : m_kind(StringKind),
+    d(allocate_value<StringValue>(std::string(str)))
 {
 
 }
@@ -313,7 +725,8 @@ Value::Value(const char* str)
  * \brief constructs an array of values
  */
 Value::Value(std::vector<Value> vals)
-  : d(std::make_shared<VectorValue>(std::move(vals)))
+  : m_kind(ArrayKind),
+    d(allocate_value<VectorValue>(std::move(vals)))
 {
 
 }
@@ -323,7 +736,8 @@ Value::Value(std::vector<Value> vals)
  * \brief constructs a map of values
  */
 Value::Value(std::map<std::string, Value> dict)
-  : d(std::make_shared<MapValue>(std::move(dict)))
+  : m_kind(MapKind),
+    d(allocate_value<MapValue>(dict))
 {
 
 }
@@ -333,18 +747,45 @@ Value::Value(std::map<std::string, Value> dict)
  * \brief constructs a value from an implementation
  */
 Value::Value(std::shared_ptr<IValue> impl)
-  : d(impl != nullptr ? impl : null_impl)
-{
-
+  : m_kind(UserKind),
+    d(std::move(impl))
+{
+  if (d == nullptr || d->is_null())
+    m_kind = NullKind;
+  else if (d->is_array())
+    m_kind = ArrayKind;
+  else if (d->is_map())
+    m_kind = MapKind;
+  else if (d->type_index() == std::type_index(typeid(std::string)))
+    m_kind = StringKind;
+  else if (d->data() != nullptr && d->type_index() == std::type_index(typeid(bool)))
+    m_kind = BooleanKind, m_data.boolean = *static_cast<bool*>(d->data());
+  else if (d->data() != nullptr && d->type_index() == std::type_index(typeid(int)))
+    m_kind = IntegerKind, m_data.integer = *static_cast<int*>(d->data());
+  else if (d->data() != nullptr && d->type_index() == std::type_index(typeid(long long)))
+    *this = Value(*static_cast<long long*>(d->data()));
+  else if (d->data() != nullptr && d->type_index() == std::type_index(typeid(double)))
+    m_kind = NumberKind, m_data.number = *static_cast<double*>(d->data());
+
+  if (m_kind < StringKind)
+    d = nullptr;
 }
 
+/*!
+ * \fn Kind kind() const
+ * \brief returns the kind of the value
+ * 
+ * The kind is computed when the value is constructed, reading it 
+ * does not involve any call to the IValue.
+ */
+
 /*!
  * \fn bool isNull() const
  * \brief returns whether the value is null
  */
 bool Value::isNull() const
 {
-  return d->is_null();
+  return m_kind == NullKind;
 }
 
 /*!
@@ -356,7 +797,7 @@ bool Value::isNull() const
  */
 bool Value::isArray() const
 {
-  return d->is_array();
+  return m_kind == ArrayKind;
 }
 
 /*!
@@ -368,7 +809,7 @@ bool Value::isArray() const
  */
 bool Value::isMap() const
 {
-  return d->is_map();
+  return m_kind == MapKind;
 }
 
 /*!
@@ -415,7 +856,21 @@ Map Value::toMap() const
  */
 std::type_index Value::typeIndex() const
 {
-  return d->type_index();
+  switch (m_kind)
+  {
+  case BooleanKind:
+    return std::type_index(typeid(bool));
+  case IntegerKind:
+    return std::type_index(typeid(int));
+  case Integer64Kind:
+    return std::type_index(typeid(long long));
+  case NumberKind:
+    return std::type_index(typeid(double));
+  case NullKind:
+    return std::type_index(typeid(std::nullptr_t));
+  default:
+    return d->type_index();
+  }
 }
 
 /*!
@@ -427,7 +882,21 @@ std::type_index Value::typeIndex() const
  */
 void* Value::data() const
 {
-  return d->data();
+  switch (m_kind)
+  {
+  case BooleanKind:
+    return &m_data.boolean;
+  case IntegerKind:
+    return &m_data.integer;
+  case Integer64Kind:
+    return &m_data.integer64;
+  case NumberKind:
+    return &m_data.number;
+  case NullKind:
+    return nullptr;
+  default:
+    return d->data();
+  }
 }
 
 /*!
@@ -438,7 +907,7 @@ void* Value::data() const
  */
 size_t Value::length() const
 {
-  return d->length();
+  return d != nullptr ? d->length() : 0;
 }
 
 /*!
@@ -449,7 +918,7 @@ size_t Value::length() const
  */
 Value Value::at(size_t index) const
 {
-  return d->at(index);
+  return d != nullptr ? d->at(index) : Value();
 }
 
 /*!
@@ -466,7 +935,20 @@ Value Value::at(size_t index) const
  */
 std::set<std::string> Value::propertyNames() const
 {
-  return d->propertyNames();
+  return d != nullptr ? d->propertyNames() : std::set<std::string>();
+}
+
+/*!
+ * \fn void forEachProperty(const PropertyCallback& callback) const
+ * \brief calls a function for each property of a map value
+ *
+ * Unlike \c{propertyNames()}, this does not build a set of names.
+ * The properties may be visited in any order.
+ */
+void Value::forEachProperty(const PropertyCallback& callback) const
+{
+  if (d != nullptr)
+    d->forEachProperty(callback);
 }
 
 /*!
@@ -478,16 +960,108 @@ std::set<std::string> Value::propertyNames() const
  */
 Value Value::property(const std::string& name) const
 {
-  return d->property(name);
+  return d != nullptr ? d->property(name) : Value();
 }
 
 /*!
- * \fn const std::shared_ptr<IValue>& impl() const
+ * \fn Value property(const Atom& name) const
+ * \brief retrieves the property of a map by its interned name
+ */
+Value Value::property(const Atom& name) const
+{
+  return d != nullptr ? d->get(name) : Value();
+}
+
+/*!
+ * \fn const Value* find(size_t index) const
+ * \brief returns a pointer to an element of an array without copying it
+ *
+ * Returns nullptr if the array does not store its elements, 
+ * \c{at()} must then be used instead.
+ * 
+ * \sa IValue::find()
+ */
+const Value* Value::find(size_t index) const
+{
+  return d != nullptr ? d->find(index) : &null_value;
+}
+
+/*!
+ * \fn const Value* find(const std::string& name) const
+ * \brief returns a pointer to the property of a map without copying it
+ *
+ * Returns nullptr if the map does not store its properties, 
+ * \c{property()} must then be used instead.
+ * 
+ * \sa IValue::find()
+ */
+const Value* Value::find(const std::string& name) const
+{
+  return d != nullptr ? d->find(name) : &null_value;
+}
+
+/*!
+ * \fn const Value* find(const Atom& name) const
+ * \brief returns a pointer to the property of a map without copying it
+ */
+const Value* Value::find(const Atom& name) const
+{
+  return d != nullptr ? d->find(name) : &null_value;
+}
+
+/*!
+ * \fn const Value* chunk(size_t offset, size_t& count) const
+ * \brief returns a run of contiguous elements of an array
+ *
+ * \sa IValue::chunk()
+ */
+const Value* Value::chunk(size_t offset, size_t& count) const
+{
+  if (d == nullptr)
+  {
+    count = 0;
+    return nullptr;
+  }
+
+  return d->chunk(offset, count);
+}
+
+/*!
+ * \fn std::shared_ptr<IValue> impl() const
  * \brief returns a pointer to the implementation
+ * 
+ * Values that are stored inline do not have an implementation; 
+ * for these, a new one is created by this function.
  */
-const std::shared_ptr<IValue>& Value::impl() const
+std::shared_ptr<IValue> Value::impl() const
 {
-  return d;
+  switch (m_kind)
+  {
+  case BooleanKind:
+    return std::make_shared<GenericValue<bool>>(m_data.boolean);
+  case IntegerKind:
+    return std::make_shared<GenericValue<int>>(m_data.integer);
+  case Integer64Kind:
+    return std::make_shared<GenericValue<long long>>(m_data.integer64);
+  case NumberKind:
+    return std::make_shared<GenericValue<double>>(m_data.number);
+  case NullKind:
+    return null_impl;
+  default:
+    return d;
+  }
+}
+
+/*!
+ * \fn const IValue* get() const
+ * \brief returns the implementation without sharing its ownership
+ *
+ * Returns nullptr for values that are stored inline.
+ * Unlike \c{impl()}, this does not modify any reference count.
+ */
+const IValue* Value::get() const
+{
+  return d.get();
 }
 
 /*!
@@ -503,7 +1077,7 @@ const std::shared_ptr<IValue>& Value::impl() const
  * \brief constructs an empty array
  */
 Array::Array()
-  : d(std::make_shared<VectorValue>())
+  : d(allocate_value<VectorValue>())
 {
 
 }
@@ -513,7 +1087,7 @@ Array::Array()
  * \brief constructs an array from a list of values
  */
 Array::Array(std::vector<Value> vals)
- : d(std::make_shared<VectorValue>(std::move(vals)))
+ : d(allocate_value<VectorValue>(std::move(vals)))
 {
 
 }
@@ -526,7 +1100,7 @@ Array::Array(std::shared_ptr<IValue> impl)
   : d(impl)
 {
   if (!d || !d->is_array())
-    d = std::make_shared<VectorValue>();
+    d = allocate_value<VectorValue>();
 }
 
 /*!
@@ -548,6 +1122,29 @@ Value Array::at(size_t index) const
   return d->at(index);
 }
 
+/*!
+ * \fn const Value* find(size_t index) const
+ * \param index
+ * \brief returns a pointer to an element without copying it
+ *
+ * Returns nullptr if the array does not store its elements.
+ */
+const Value* Array::find(size_t index) const
+{
+  return d->find(index);
+}
+
+/*!
+ * \fn const Value* chunk(size_t offset, size_t& count) const
+ * \brief returns a run of contiguous elements
+ *
+ * \sa IValue::chunk()
+ */
+const Value* Array::chunk(size_t offset, size_t& count) const
+{
+  return d->chunk(offset, count);
+}
+
 /*!
  * \fn bool isWritable() const
  * \brief returns whether an array is writable
@@ -555,11 +1152,13 @@ Value Array::at(size_t index) const
  * You can call \c{push()} on a writable array to add elements to it.
  * 
  * Arrays constructed using the default constructor, or the vector constructor 
- * of this class are writable.
+ * of this class are writable, as well as arrays returned by \c{fork()}.
  */
 bool Array::isWritable() const
 {
-  return d->type_index() == std::type_index(typeid(decltype(VectorValue::values)));
+  // adapters may expose a std::vector<Value> too, the implementation must be checked
+  return dynamic_cast<VectorValue*>(d.get()) != nullptr
+    || dynamic_cast<PersistentArrayValue*>(d.get()) != nullptr;
 }
 
 /*!
@@ -572,11 +1171,52 @@ void Array::push(Value val)
 {
   assert(isWritable());
 
-  if (!isWritable())
+  if (auto* vec = dynamic_cast<VectorValue*>(d.get()))
+    vec->values.push_back(std::move(val));
+  else if (auto* self = dynamic_cast<PersistentArrayValue*>(d.get()))
+    d = self->pushed(std::move(val));
+  else
+    throw std::runtime_error{ "Array is not writable" };
+}
+
+/*!
+ * \fn void pop()
+ * \brief removes the last element of the array, if any
+ *
+ * The array must be writable.
+ */
+void Array::pop()
+{
+  assert(isWritable());
+
+  if (auto* vec = dynamic_cast<VectorValue*>(d.get()))
+  {
+    if (!vec->values.empty())
+      vec->values.pop_back();
+  }
+  else if (auto* self = dynamic_cast<PersistentArrayValue*>(d.get()))
+  {
+    d = self->popped();
+  }
+  else
+  {
     throw std::runtime_error{ "Array is not writable" };
+  }
+}
 
-  auto* vec = static_cast<VectorValue*>(d.get());
-  vec->values.push_back(val);
+/*!
+ * \fn Array fork() const
+ * \brief returns a copy of the array that can be modified independently
+ *
+ * The returned array is persistent: modifying it does not affect the 
+ * arrays it was forked from, or forked into, and only copies 
+ * O(log n) elements.
+ * Forking a persistent array is O(1), forking any other array copies 
+ * its elements once.
+ */
+Array Array::fork() const
+{
+  return Array(PersistentArrayValue::from(*this));
 }
 
 /*!
@@ -585,9 +1225,18 @@ void Array::push(Value val)
  *
  * Note that unlike \c{at()}, this function returns a modifiable reference to 
  * the element.
+ * If the array is persistent, the reference is only valid until the 
+ * array is modified or copied.
  */
 Value& Array::operator[](size_t index)
 {
+  if (auto* self = dynamic_cast<PersistentArrayValue*>(d.get()))
+  {
+    std::shared_ptr<PersistentArrayValue> copy = self->updated(index, self->at(index));
+    d = copy;
+    return const_cast<Value&>(*copy->find(index));
+  }
+
   auto* self = static_cast<VectorValue*>(d.get());
   return self->values[index];
 }
@@ -623,7 +1272,7 @@ const std::shared_ptr<IValue>& Array::impl() const
  * \brief constructs an empty map
  */
 Map::Map()
-  : d(std::make_shared<MapValue>())
+  : d(allocate_value<MapValue>())
 {
 
 }
@@ -633,7 +1282,7 @@ Map::Map()
  * \brief constructs a map from given values
  */
 Map::Map(std::map<std::string, Value> dict)
-  : d(std::make_shared<MapValue>(std::move(dict)))
+  : d(allocate_value<MapValue>(dict))
 {
 
 }
@@ -643,7 +1292,7 @@ Map::Map(std::map<std::string, Value> dict)
  * \brief constructs a map from given values
  */
 Map::Map(std::initializer_list<std::pair<const std::string, Value>>&& pairs)
-  : d(std::make_shared<MapValue>(std::map<std::string, Value>(pairs)))
+  : d(allocate_value<MapValue>(FlatMap(pairs.begin(), pairs.end())))
 {
 
 }
@@ -656,7 +1305,7 @@ Map::Map(std::shared_ptr<IValue> impl)
   : d(impl)
 {
   if (!d || !d->is_map())
-    d = std::make_shared<MapValue>();
+    d = allocate_value<MapValue>();
 }
 
 /*!
@@ -668,6 +1317,15 @@ std::set<std::string> Map::propertyNames() const
   return d->propertyNames();
 }
 
+/*!
+ * \fn void forEachProperty(const PropertyCallback& callback) const
+ * \brief calls a function for each property of the map
+ */
+void Map::forEachProperty(const PropertyCallback& callback) const
+{
+  d->forEachProperty(callback);
+}
+
 /*!
  * \fn Value property(const std::string& name) const
  * \param property name
@@ -678,13 +1336,46 @@ Value Map::property(const std::string& name) const
   return d->property(name);
 }
 
+/*!
+ * \fn Value property(const Atom& name) const
+ * \param property name
+ * \brief retrieves a property by its interned name
+ */
+Value Map::property(const Atom& name) const
+{
+  return d->get(name);
+}
+
+/*!
+ * \fn const Value* find(const std::string& name) const
+ * \param property name
+ * \brief returns a pointer to a property without copying it
+ *
+ * Returns nullptr if the map does not store its properties.
+ */
+const Value* Map::find(const std::string& name) const
+{
+  return d->find(name);
+}
+
+/*!
+ * \fn const Value* find(const Atom& name) const
+ * \param property name
+ * \brief returns a pointer to a property without copying it
+ */
+const Value* Map::find(const Atom& name) const
+{
+  return d->find(name);
+}
+
 /*!
  * \fn bool isWritable() const
  * \brief returns whether the map is writable
  */
 bool Map::isWritable() const
 {
-  return d->type_index() == std::type_index(typeid(decltype(MapValue::dict)));
+  return dynamic_cast<MapValue*>(d.get()) != nullptr
+    || dynamic_cast<PersistentMapValue*>(d.get()) != nullptr;
 }
 
 /*!
@@ -697,13 +1388,44 @@ bool Map::isWritable() const
  */
 void Map::insert(const std::string& name, Value val)
 {
-  assert(isWritable());
+  if (dynamic_cast<PersistentMapValue*>(d.get()))
+    insert(Atom::transient(name), std::move(val));
+  else
+    (*this)[name] = std::move(val);
+}
 
-  if (!isWritable())
-    throw std::runtime_error{ "Map is not writable" };
+/*!
+ * \fn void insert(const Atom& name, Value val)
+ * \param property name
+ * \param property value
+ * \brief inserts a new value into the map
+ *
+ * The map must be writable.
+ */
+void Map::insert(const Atom& name, Value val)
+{
+  if (auto* self = dynamic_cast<PersistentMapValue*>(d.get()))
+    d = self->inserted(name, std::move(val));
+  else
+    (*this)[name] = std::move(val);
+}
 
-  auto* self = static_cast<MapValue*>(d.get());
-  self->dict[name] = val;
+/*!
+ * \fn Map fork() const
+ * \brief returns a copy of the map that can be modified independently
+ *
+ * The returned map is persistent: inserting into it does not affect 
+ * the maps it was forked from, or forked into, and only copies 
+ * O(log n) entries.
+ * Rendering with a fork of the input data therefore keeps 
+ * 'assign global' tags from modifying the data itself.
+ *
+ * Forking a persistent map is O(1), forking any other map copies 
+ * its properties once.
+ */
+Map Map::fork() const
+{
+  return Map(PersistentMapValue::from(*this));
 }
 
 /*!
@@ -713,9 +1435,48 @@ void Map::insert(const std::string& name, Value val)
  *
  * Unlike \c{property()}, this function returns a modifiable reference 
  * to the value.
+ * The reference may be invalidated by the insertion of another property.
+ * 
+ * The map must be writable.
  */
 Value& Map::operator[](const std::string& name)
 {
+  if (dynamic_cast<PersistentMapValue*>(d.get()))
+    return (*this)[Atom::transient(name)];
+
+  assert(isWritable());
+
+  if (!isWritable())
+    throw std::runtime_error{ "Map is not writable" };
+
+  auto* self = static_cast<MapValue*>(d.get());
+  return self->dict[name];
+}
+
+/*!
+ * \fn Value& operator[](const Atom& name)
+ * \param property name
+ * \brief access a property by its interned name
+ *
+ * If the map is persistent, the reference is only valid until the 
+ * map is modified or copied.
+ *
+ * The map must be writable.
+ */
+Value& Map::operator[](const Atom& name)
+{
+  assert(isWritable());
+
+  if (auto* self = dynamic_cast<PersistentMapValue*>(d.get()))
+  {
+    std::shared_ptr<PersistentMapValue> copy = self->inserted(name, self->get(name));
+    d = copy;
+    return const_cast<Value&>(*copy->find(name));
+  }
+
+  if (!isWritable())
+    throw std::runtime_error{ "Map is not writable" };
+
   auto* self = static_cast<MapValue*>(d.get());
   return self->dict[name];
 }
@@ -777,13 +1538,28 @@ inline int array_compare(const Value& lhs, const Value& rhs)
   return 0;
 }
 
+static std::vector<std::pair<std::string, Value>> sorted_properties(const Value& val)
+{
+  std::vector<std::pair<std::string, Value>> result;
+
+  val.forEachProperty([&result](const std::string& name, const Value& v) {
+    result.emplace_back(name, v);
+  });
+
+  std::sort(result.begin(), result.end(), [](const std::pair<std::string, Value>& a, const std::pair<std::string, Value>& b) {
+    return a.first < b.first;
+  });
+
+  return result;
+}
+
 inline int object_compare(const Value& lhs, const Value& rhs)
 {
   if (lhs.data() == rhs.data())
     return 0;
 
-  std::set<std::string> lhs_props = lhs.propertyNames();
-  std::set<std::string> rhs_props = rhs.propertyNames();
+  std::vector<std::pair<std::string, Value>> lhs_props = sorted_properties(lhs);
+  std::vector<std::pair<std::string, Value>> rhs_props = sorted_properties(rhs);
 
   int size_diff = static_cast<int>(lhs_props.size()) - static_cast<int>(rhs_props.size());
 
@@ -795,12 +1571,12 @@ inline int object_compare(const Value& lhs, const Value& rhs)
 
   for (; lhs_it != lhs_props.end(); ++lhs_it, ++rhs_it)
   {
-    int c = lhs_it->compare(*rhs_it);
+    int c = lhs_it->first.compare(rhs_it->first);
 
     if (c != 0)
       return c;
 
-    c = liquid::compare(lhs.property(*lhs_it), rhs.property(*rhs_it));
+    c = liquid::compare(lhs_it->second, rhs_it->second);
 
     if (c != 0)
       return c;
@@ -834,6 +1610,21 @@ inline int comp(double a, int b)
   return sign(a-b);
 }
 
+inline int comp(long long a, long long b)
+{
+  return (a > b) - (a < b);
+}
+
+inline bool is_integer(Value::Kind k)
+{
+  return k == Value::IntegerKind || k == Value::Integer64Kind;
+}
+
+inline long long integer_value(const Value& val)
+{
+  return val.kind() == Value::IntegerKind ? val.as<int>() : val.as<long long>();
+}
+
 inline int comp(const std::string& a, const std::string& b)
 {
   return std::strcmp(a.data(), b.data());
@@ -841,36 +1632,51 @@ inline int comp(const std::string& a, const std::string& b)
 
 int compare(const Value& lhs, const Value& rhs)
 {
-  std::type_index lhs_type = lhs.typeIndex();
-  std::type_index rhs_type = rhs.typeIndex();
+  const Value::Kind lhs_kind = lhs.kind();
+  const Value::Kind rhs_kind = rhs.kind();
 
-  if (lhs_type != rhs_type)
+  if (lhs_kind != rhs_kind)
   {
-    if (lhs.is<int>() && rhs.is<double>())
-      return comp(lhs.as<int>(), rhs.as<double>());
-    else if (lhs.is<double>() && rhs.is<int>())
-      return comp(lhs.as<double>(), rhs.as<int>());
-
-    if (lhs_type < rhs_type)
-      return -1;
-    else
-      return 1;
+    if (is_integer(lhs_kind) && is_integer(rhs_kind))
+      return comp(integer_value(lhs), integer_value(rhs));
+    else if (is_integer(lhs_kind) && rhs_kind == Value::NumberKind)
+      return comp(static_cast<double>(integer_value(lhs)), rhs.as<double>());
+    else if (lhs_kind == Value::NumberKind && is_integer(rhs_kind))
+      return comp(lhs.as<double>(), static_cast<double>(integer_value(rhs)));
+
+    return lhs.typeIndex() < rhs.typeIndex() ? -1 : 1;
   }
-    
-  if (lhs.isArray())
-    return array_compare(lhs, rhs);
-  else if (lhs.isMap())
-    return object_compare(lhs, rhs);
-  else if (lhs.isNull())
+
+  switch (lhs_kind)
+  {
+  case Value::NullKind:
     return 0;
-  else if (lhs.is<bool>())
+  case Value::BooleanKind:
     return comp(lhs.as<bool>(), rhs.as<bool>());
-  else if (lhs.is<int>())
+  case Value::IntegerKind:
     return comp(lhs.as<int>(), rhs.as<int>());
-  else if (lhs.is<double>())
+  case Value::Integer64Kind:
+    return comp(lhs.as<long long>(), rhs.as<long long>());
+  case Value::NumberKind:
     return comp(lhs.as<double>(), rhs.as<double>());
-  else if (lhs.is<std::string>())
-    return comp(lhs.as<std::string>(), rhs.as<std::string>()); 
+  case Value::StringKind:
+    return comp(lhs.as<std::string>(), rhs.as<std::string>());
+  default:
+    break;
+  }
+
+  // arrays and maps are compared element-wise whatever their implementation,
+  // so that a forked container compares equal to its origin
+  if (lhs_kind == Value::ArrayKind)
+    return array_compare(lhs, rhs);
+  else if (lhs_kind == Value::MapKind)
+    return object_compare(lhs, rhs);
+
+  std::type_index lhs_type = lhs.typeIndex();
+  std::type_index rhs_type = rhs.typeIndex();
+
+  if (lhs_type != rhs_type)
+    return lhs_type < rhs_type ? -1 : 1;
 
   assert(false);
   throw std::runtime_error{ "liquid::compare() : values are not comparable" };
@@ -4,10 +4,25 @@
 
 #include "liquid/liquid.h"
 
+#include "liquid/arithmetic.h"
+#include "liquid/binary.h"
+#include "liquid/filters.h"
+#include "liquid/lazy-map.h"
+#include "liquid/parser.h"
+#include "liquid/reflect.h"
 #include "liquid/renderer.h"
+#include "liquid/snapshot.h"
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
 TEST(Liquid, hello) {
 
   std::string str = "Hello {{ name }}!";
@@ -115,6 +130,132 @@ TEST(Liquid, math) {
   ASSERT_EQ(result, "13");
 }
 
+TEST(Liquid, arithmetic) {
+
+  std::string str = "{{ 7 % 3 }} {{ 0 - 7 % 3 }} {{ price * quantity }} {{ price * quantity / quantity }} {{ huge + huge }}";
+
+  liquid::Template tmplt = liquid::parse(str);
+
+  liquid::Map data = {};
+  data["price"] = 2000000000;
+  data["quantity"] = 3;
+  data["huge"] = liquid::Value(9223372036854775807LL);
+  std::string result = tmplt.render(data);
+
+  ASSERT_EQ(result, "1 -1 6000000000 2000000000 18446744073709551616.000000");
+
+  tmplt = liquid::parse("{{ 3000000000 }} {{ 3000000000 * 2 }} {% if 3000000000 > 2147483647 %}yes{% endif %}");
+  ASSERT_EQ(tmplt.render(data), "3000000000 6000000000 yes");
+  ASSERT_THROW(liquid::parse("{{ 99999999999999999999 }}"), liquid::ParserException);
+
+  ASSERT_TRUE(liquid::Value(5LL).is<int>());
+  ASSERT_EQ(liquid::Value(1LL << 40).kind(), liquid::Value::Integer64Kind);
+  ASSERT_EQ(liquid::compare(liquid::Value(1LL << 40), liquid::Value(1 << 30)), 1);
+  ASSERT_EQ(liquid::compare(liquid::Value(1LL << 40), liquid::Value(1099511627776.0)), 0);
+
+  liquid::Value product = liquid::Arithmetic::apply(liquid::Arithmetic::Mul, 65536, 65536);
+  ASSERT_EQ(product.as<long long>(), 1LL << 32);
+  ASSERT_EQ(liquid::Arithmetic::apply(liquid::Arithmetic::Mod, 7.5, 2).as<double>(), 1.5);
+  ASSERT_THROW(liquid::Arithmetic::apply(liquid::Arithmetic::Div, 1, 0), liquid::EvaluationException);
+  ASSERT_THROW(liquid::Arithmetic::apply(liquid::Arithmetic::Mod, 1, liquid::Value(0LL)), liquid::EvaluationException);
+  ASSERT_THROW(liquid::Arithmetic::apply(liquid::Arithmetic::Sub, "a", "b"), liquid::EvaluationException);
+
+  liquid::Map totals;
+  totals["total"] = product;
+  liquid::binary::Document doc = liquid::binary::Document::fromBuffer(liquid::binary::serialize(totals));
+  ASSERT_EQ(doc.root().property("total").as<long long>(), 1LL << 32);
+}
+
+TEST(Liquid, expressions) {
+
+  std::string str = "{{ 10 - 4 - 3 }} {{ 2 + 3 * 4 - 6 / 2 }} {{ 20 / 2 / 5 }} {{ [1, 2] + [3] | last }}"
+    "{% if 1 < 2 and 3 <> 4 or false %} yes{% endif %}";
+
+  liquid::Template tmplt = liquid::parse(str);
+
+  liquid::Map data = {};
+  std::string result = tmplt.render(data);
+
+  ASSERT_EQ(result, "3 11 2 3 yes");
+
+  std::string nots;
+  for (int i(0); i < 1000; ++i)
+    nots += "not ";
+
+  ASSERT_THROW(liquid::parse("{% if " + nots + "x %}{% endif %}"), liquid::ParserException);
+
+  // left-associative chains are as deep as they are long
+  std::string sum = "1";
+  for (int i(1); i < 200; ++i)
+    sum += " + 1";
+
+  ASSERT_EQ(liquid::parse("{{ " + sum + " }}").render(liquid::Map()), "200");
+
+  for (int i(200); i < 30000; ++i)
+    sum += " + 1";
+
+  std::string filters = "x";
+  std::string members = "x";
+  for (int i(0); i < 1000; ++i)
+    filters += " | first", members += ".y";
+
+  ASSERT_THROW(liquid::parse("{{ " + sum + " }}"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{% if " + sum + " > 2 %}{% endif %}"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{{ " + filters + " }}"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{{ " + members + " }}"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{{ 1 + }}"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{{ 1 = 2 }}"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{{ }}"), liquid::ParserException);
+}
+
+TEST(Liquid, token_cursor) {
+
+  std::string str = "price | times: 2, 3";
+  liquid::Tokenizer tokenizer;
+  std::vector<liquid::Token> tokens = tokenizer.tokenize(liquid::StringView(&str, 0, str.size()));
+
+  liquid::TokenCursor cursor{ tokens };
+  ASSERT_EQ(cursor.size(), 7);
+  ASSERT_TRUE(cursor.front() == "price");
+  ASSERT_TRUE(cursor.back() == "3");
+  ASSERT_EQ(cursor.endOffset(), str.size());
+
+  ASSERT_TRUE(cursor.takeFirst() == "price");
+  ASSERT_TRUE(cursor.takeLast() == "3");
+  ASSERT_EQ(cursor.size(), 5);
+  ASSERT_EQ(cursor.front().kind, liquid::Token::Pipe);
+
+  liquid::TokenCursor args = cursor.mid(2, 2);
+  ASSERT_TRUE(args.front() == ":" && args.back() == "2");
+  ASSERT_EQ(args.endOffset(), str.size() - 3);
+
+  cursor.advance(3);
+  ASSERT_TRUE(cursor.at(0) == "2");
+  ASSERT_EQ(cursor.at(1).kind, liquid::Token::Comma);
+  ASSERT_THROW(cursor.at(2), liquid::ParserException);
+  cursor.advance(2);
+  ASSERT_TRUE(cursor.empty());
+  ASSERT_THROW(cursor.takeFirst(), liquid::ParserException);
+  ASSERT_THROW(cursor.back(), liquid::ParserException);
+
+  // tags whose tokens end too early
+  ASSERT_THROW(liquid::parse("{% %}"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{% assign x %}"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{% assign x = %}"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{% if %}{% endif %}"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{{ x | }}"), liquid::ParserException);
+
+  liquid::Template tmplt = liquid::parse("{% include card with title = 'a' and count = 1 + 2 %}");
+  const auto& include = tmplt.nodes().front()->as<liquid::tags::Include>();
+  ASSERT_EQ(include.name, "card");
+  ASSERT_EQ(include.objects.size(), 2);
+  ASSERT_TRUE(include.objects.at("count")->is<liquid::objects::BinOp>());
+
+  ASSERT_THROW(liquid::parse("{% include card title = 'a' %}"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{% include card with title 'a' %}"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{% include card with title = %}"), liquid::ParserException);
+}
+
 TEST(Liquid, arrayaccess) {
 
   std::string str = "{% assign index = 1 %}{{ numbers[index] }}";
@@ -293,6 +434,54 @@ TEST(Liquid, filters) {
   ASSERT_EQ(result, "Hello BOB, your account now contains 10 dollars.");
 }
 
+class QuotingRenderer : public liquid::Renderer
+{
+protected:
+  void writeString(const liquid::Value& str) override
+  {
+    write("'" + str.as<std::string>() + "'");
+  }
+};
+
+class EscapingRenderer : public liquid::Renderer
+{
+public:
+  std::string stringify(const liquid::Value& val) override
+  {
+    std::string str = Renderer::stringify(val);
+    std::string result;
+
+    for (char c : str)
+      result += c == '<' ? std::string("&lt;") : c == '>' ? std::string("&gt;") : std::string(1, c);
+
+    return result;
+  }
+};
+
+class ZeroCopyRenderer : public liquid::Renderer
+{
+protected:
+  void writeString(const liquid::Value& str) override
+  {
+    appendString(str);
+  }
+};
+
+TEST(Liquid, write_string) {
+
+  liquid::Template tmplt = liquid::parse("{{ name }} is {{ age }}");
+
+  liquid::Map data = { { "name", "Bob" }, { "age", 18 } };
+  ASSERT_EQ(tmplt.render<QuotingRenderer>(data), "'Bob' is 18");
+  ASSERT_EQ(tmplt.render(data), "Bob is 18");
+
+  // overriding stringify() alone applies to strings too
+  liquid::Map html = { { "name", "<b>Bob</b>" }, { "age", 18 } };
+  ASSERT_EQ(tmplt.render<EscapingRenderer>(html), "&lt;b&gt;Bob&lt;/b&gt; is 18");
+  ASSERT_EQ(liquid::parse("{{ name + '<i>' }}").render<EscapingRenderer>(html), "&lt;b&gt;Bob&lt;/b&gt;&lt;i&gt;");
+  ASSERT_EQ(tmplt.render<ZeroCopyRenderer>(html), "<b>Bob</b> is 18");
+}
+
 TEST(Liquid, array_push_pop) {
 
   std::string str = 
@@ -346,6 +535,66 @@ TEST(Liquid, array_filters) {
   ASSERT_EQ(result, "SpongeBob Squidward Plankton|SpongeBob|Patrick|Squidward");
 }
 
+TEST(Liquid, persistent) {
+
+  liquid::Array base;
+
+  for (int i(0); i < 2000; ++i)
+    base.push(i);
+
+  liquid::Array a = base.fork();
+  liquid::Array b = a;
+
+  for (int i(0); i < 1000; ++i)
+    a.pop();
+
+  b.push(-1);
+  b[5] = "five";
+
+  ASSERT_EQ(base.length(), 2000);
+  ASSERT_EQ(a.length(), 1000);
+  ASSERT_EQ(b.length(), 2001);
+  ASSERT_EQ(a.at(999).as<int>(), 999);
+  ASSERT_EQ(a.at(5).as<int>(), 5);
+  ASSERT_EQ(b.at(5).as<std::string>(), "five");
+  ASSERT_EQ(b.at(2000).as<int>(), -1);
+  ASSERT_EQ(liquid::compare(liquid::Value(base), liquid::Value(base.fork())), 0);
+
+  size_t count = 0;
+  b.forEach([&count](const liquid::Value&) { ++count; });
+  ASSERT_EQ(count, 2001);
+
+  while (a.length() > 0)
+    a.pop();
+
+  a.pop();
+  a.push(1);
+  ASSERT_EQ(a.length(), 1);
+  ASSERT_EQ(a.at(0).as<int>(), 1);
+
+  liquid::Map data;
+  data["name"] = "Bob";
+
+  for (int i(0); i < 100; ++i)
+    data[std::to_string(i)] = i;
+
+  liquid::Map fork = data.fork();
+  fork["name"] = "Alice";
+  fork.insert("extra", true);
+
+  ASSERT_EQ(data.property("name").as<std::string>(), "Bob");
+  ASSERT_TRUE(data.property("extra").isNull());
+  ASSERT_EQ(fork.property("name").as<std::string>(), "Alice");
+  ASSERT_EQ(fork.property(liquid::Atom("42")).as<int>(), 42);
+  ASSERT_EQ(fork.propertyNames().size(), 102);
+
+  liquid::Template tmplt = liquid::parse("{% assign name = 'Patrick' global %}{% assign list = list | push: name | push: 2 | pop %}{{ list | join: ',' }}");
+  liquid::Map input = fork.fork();
+  input["list"] = liquid::Array(std::vector<liquid::Value>{ "SpongeBob" });
+  ASSERT_EQ(liquid::Renderer().render(tmplt, input), "SpongeBob,Patrick");
+  ASSERT_EQ(input.property("name").as<std::string>(), "Alice");
+}
+
 TEST(Liquid, manual_whitespace_control) {
 
   {
@@ -392,6 +641,145 @@ TEST(Liquid, manual_whitespace_control) {
   }
 }
 
+TEST(Liquid, text_nodes) {
+
+  std::string str = "Hello\r\n  {% if x %}  big\r\n{% endif %}world!";
+
+  liquid::Template tmplt = liquid::parse(str.data(), str.size() - 1);
+
+  ASSERT_EQ(tmplt.source(), "Hello\n  {% if x %}  big\n{% endif %}world");
+
+  const auto& first = tmplt.nodes().front()->as<liquid::templates::TextNode>();
+  ASSERT_EQ(first.source.get(), &tmplt.source());
+  ASSERT_EQ(first.text(), "Hello\n  ");
+
+  liquid::Map data = {};
+  data["x"] = true;
+  ASSERT_EQ(tmplt.render(data), "Hello\n    big\nworld");
+
+  tmplt.stripWhitespacesAtTag();
+  ASSERT_EQ(tmplt.render(data), "Hello\nbig\nworld");
+  ASSERT_EQ(tmplt.source(), "Hello\n  {% if x %}  big\n{% endif %}world");
+  ASSERT_EQ(first.text(), "Hello\n");
+}
+
+TEST(Liquid, delimiters) {
+
+  std::string doc;
+  for (int i(0); i < 40; ++i)
+    doc += std::string(i % 7, ' ') + (i % 3 ? "{{ x }}" : "{% if x %}%}}") + (i % 5 ? "{" : "%");
+
+  liquid::DelimiterIndex index;
+  index.build(doc);
+
+  std::vector<size_t> expected;
+  for (size_t i(0); i + 1 < doc.size(); ++i)
+  {
+    const std::string d = doc.substr(i, 2);
+    if (d == "{{" || d == "{%" || d == "}}" || d == "%}")
+      expected.push_back(i);
+  }
+
+  ASSERT_EQ(index.entries().size(), expected.size());
+  for (size_t i(0); i < expected.size(); ++i)
+    ASSERT_EQ(index.entries().at(i).offset, expected.at(i));
+
+  liquid::Template tmplt = liquid::parse("a { b }} {{ x }}%} {");
+  liquid::Map data = {};
+  data["x"] = 1;
+  ASSERT_EQ(tmplt.render(data), "a { b }} 1%} {");
+
+  ASSERT_THROW(liquid::parse("{{ x } }"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{% if x }}"), liquid::ParserException);
+}
+
+class Repeat : public liquid::Tag
+{
+public:
+  explicit Repeat(size_t off) : liquid::Tag(off) { }
+
+  void accept(liquid::Renderer& r) override
+  {
+    const int n = r.eval(count).as<int>();
+
+    for (int i(0); i < n; ++i)
+      r.process(body);
+  }
+
+public:
+  std::shared_ptr<liquid::Object> count;
+  std::vector<std::shared_ptr<liquid::templates::Node>> body;
+};
+
+TEST(Liquid, custom_tags) {
+
+  auto registry = std::make_shared<liquid::TagRegistry>(*liquid::TagRegistry::builtins());
+
+  registry->defineBlock("repeat",
+    [](liquid::Parser& parser, const liquid::Token& keyword, liquid::TokenCursor& tokens) {
+      auto tag = std::make_shared<Repeat>(keyword.text.offset_);
+      tag->count = parser.parseObject(tokens);
+      parser.openBlock(tag);
+    },
+    [](liquid::templates::Node& block, std::shared_ptr<liquid::templates::Node> node) {
+      static_cast<Repeat&>(block).body.push_back(std::move(node));
+    },
+    "endrepeat");
+
+  liquid::Parser parser{ registry };
+  auto nodes = parser.parse("{% repeat n %}{% if x %}a{% else %}b{% endif %}{% endrepeat %}!");
+  liquid::Template tmplt{ parser.source(), nodes };
+
+  liquid::Map data = {};
+  data["n"] = 3;
+  data["x"] = false;
+  ASSERT_EQ(tmplt.render(data), "bbb!");
+
+  ASSERT_THROW(parser.parse("{% repeat 2 %}{% endif %}"), liquid::ParserException);
+  ASSERT_THROW(parser.parse("{% if x %}{% endrepeat %}"), liquid::ParserException);
+  ASSERT_THROW(parser.parse("{% repeat 2 %}{% else %}{% endrepeat %}"), liquid::ParserException);
+  ASSERT_THROW(liquid::parse("{% repeat 2 %}x{% endrepeat %}"), liquid::ParserException);
+
+  // handlers may carry state
+  int seen = 0;
+  registry->define("mark", [&seen](liquid::Parser&, const liquid::Token&, liquid::TokenCursor&) { ++seen; });
+  liquid::Parser marking{ registry };
+  marking.parse("{% mark %}a{% mark %}");
+  ASSERT_EQ(seen, 2);
+}
+
+TEST(Liquid, node_kinds) {
+
+  liquid::Template tmplt = liquid::parse("a{{ x | join: ',' }}{% if x %}{% endif %}{% comment %}");
+
+  const auto& nodes = tmplt.nodes();
+  ASSERT_EQ(nodes.size(), 4);
+  ASSERT_EQ(nodes.at(0)->kind(), liquid::templates::Node::TextKind);
+  ASSERT_EQ(nodes.at(1)->kind(), liquid::templates::Node::PipeKind);
+  ASSERT_EQ(nodes.at(2)->kind(), liquid::templates::Node::IfKind);
+  ASSERT_EQ(nodes.at(3)->kind(), liquid::templates::Node::CommentKind);
+
+  ASSERT_TRUE(nodes.at(0)->isText() && !nodes.at(0)->isObject() && !nodes.at(0)->isTag());
+  ASSERT_TRUE(nodes.at(1)->isObject() && !nodes.at(1)->isTag());
+  ASSERT_TRUE(nodes.at(2)->isTag() && nodes.at(3)->isTag());
+
+  ASSERT_TRUE(nodes.at(1)->is<liquid::objects::Pipe>());
+  ASSERT_FALSE(nodes.at(1)->is<liquid::objects::Variable>());
+  ASSERT_EQ(nodes.at(1)->as<liquid::objects::Pipe>().filterName, "join");
+  ASSERT_EQ(nodes.at(2)->as<liquid::tags::If>().blocks.size(), 1);
+
+  Repeat custom{ 0 };
+  ASSERT_EQ(custom.kind(), liquid::templates::Node::UserTagKind);
+  ASSERT_TRUE(custom.isTag() && !custom.isObject());
+
+  // custom classes without a ClassKind are tested with dynamic_cast
+  ASSERT_TRUE(custom.is<Repeat>());
+  ASSERT_EQ(&custom.as<Repeat>(), &custom);
+  ASSERT_FALSE(nodes.at(2)->is<Repeat>());
+  ASSERT_TRUE(nodes.at(2)->is<liquid::Tag>() && custom.is<liquid::Tag>());
+  ASSERT_FALSE(custom.is<liquid::tags::If>());
+}
+
 TEST(Liquid, include) {
 
   liquid::Renderer renderer;
@@ -472,3 +860,865 @@ TEST(Liquid, error) {
 
   ASSERT_EQ(tmplt.getLine(renderer.errors().front().offset), "{% assign age = 20 %}{{ age.bad_property }}");
 }
+
+TEST(Liquid, values) {
+
+  liquid::Value null;
+  ASSERT_TRUE(null.isNull());
+  ASSERT_TRUE(null.is<std::nullptr_t>());
+  ASSERT_TRUE(null.impl()->is_null());
+
+  liquid::Value b = true;
+  ASSERT_TRUE(b.is<bool>());
+  ASSERT_TRUE(b.isSimple());
+  ASSERT_TRUE(b.as<bool>());
+
+  liquid::Value n = 42;
+  ASSERT_TRUE(n.is<int>());
+  ASSERT_FALSE(n.is<double>());
+  n.as<int>() += 1;
+  ASSERT_EQ(n.as<int>(), 43);
+  ASSERT_EQ(n.impl()->type_index(), std::type_index(typeid(int)));
+
+  liquid::Value x = 3.5;
+  ASSERT_TRUE(x.is<double>());
+  ASSERT_EQ(x.as<double>(), 3.5);
+  ASSERT_EQ(liquid::compare(n, x), 1);
+
+  liquid::Value y{ std::make_shared<liquid::GenericValue<int>>(43) };
+  ASSERT_TRUE(y.is<int>());
+  ASSERT_EQ(liquid::compare(n, y), 0);
+}
+
+struct KindNameVisitor
+{
+  std::string operator()(std::nullptr_t) const { return "null"; }
+  std::string operator()(bool) const { return "bool"; }
+  std::string operator()(int) const { return "int"; }
+  std::string operator()(long long) const { return "long long"; }
+  std::string operator()(double) const { return "double"; }
+  std::string operator()(const std::string&) const { return "string"; }
+  std::string operator()(const liquid::Array&) const { return "array"; }
+  std::string operator()(const liquid::Map&) const { return "map"; }
+  std::string operator()(const liquid::Value&) const { return "user"; }
+};
+
+TEST(Liquid, kinds) {
+
+  ASSERT_EQ(liquid::Value().kind(), liquid::Value::NullKind);
+  ASSERT_EQ(liquid::Value(false).kind(), liquid::Value::BooleanKind);
+  ASSERT_EQ(liquid::Value(1).kind(), liquid::Value::IntegerKind);
+  ASSERT_EQ(liquid::Value(1.5).kind(), liquid::Value::NumberKind);
+  ASSERT_EQ(liquid::Value("str").kind(), liquid::Value::StringKind);
+  ASSERT_EQ(liquid::Value(liquid::Array()).kind(), liquid::Value::ArrayKind);
+  ASSERT_EQ(liquid::Value(liquid::Map()).kind(), liquid::Value::MapKind);
+
+  liquid::Value user{ std::make_shared<liquid::GenericValue<std::vector<int>>>(std::vector<int>{ 1, 2 }) };
+  ASSERT_EQ(user.kind(), liquid::Value::UserKind);
+  ASSERT_TRUE(user.is<std::vector<int>>());
+  ASSERT_EQ(user.as<std::vector<int>>().size(), 2);
+
+  liquid::Value wrapped_int{ std::make_shared<liquid::GenericValue<int>>(5) };
+  ASSERT_EQ(wrapped_int.kind(), liquid::Value::IntegerKind);
+
+  ASSERT_EQ(liquid::Value().visit(KindNameVisitor()), "null");
+  ASSERT_EQ(liquid::Value(true).visit(KindNameVisitor()), "bool");
+  ASSERT_EQ(liquid::Value(2).visit(KindNameVisitor()), "int");
+  ASSERT_EQ(liquid::Value(1LL << 40).visit(KindNameVisitor()), "long long");
+  ASSERT_EQ(liquid::Value(2.0).visit(KindNameVisitor()), "double");
+  ASSERT_EQ(liquid::Value("two").visit(KindNameVisitor()), "string");
+  ASSERT_EQ(liquid::Value(liquid::Array()).visit(KindNameVisitor()), "array");
+  ASSERT_EQ(liquid::Value(liquid::Map()).visit(KindNameVisitor()), "map");
+  ASSERT_EQ(user.visit(KindNameVisitor()), "user");
+}
+
+#include "liquid/value_p.h"
+
+TEST(Liquid, flatmap) {
+
+  liquid::FlatMap map;
+
+  for (int i(0); i < 100; ++i)
+  {
+    ASSERT_TRUE(map.emplace(liquid::Atom("key" + std::to_string(i)), i).second);
+    ASSERT_FALSE(map.emplace(liquid::Atom("key" + std::to_string(i)), -1).second);
+  }
+
+  ASSERT_EQ(map.size(), 100);
+
+  for (int i(0); i < 100; ++i)
+  {
+    auto it = map.find("key" + std::to_string(i));
+    ASSERT_NE(it, map.end());
+    ASSERT_EQ(it->second.as<int>(), i);
+  }
+
+  ASSERT_EQ(map.find("key100"), map.end());
+  ASSERT_EQ(map.count("key"), 0);
+
+  int i = 0;
+  for (const auto& e : map)
+    ASSERT_EQ(e.first.str(), "key" + std::to_string(i++));
+
+  map["key50"] = "fifty";
+  ASSERT_EQ(map.find("key50")->second.as<std::string>(), "fifty");
+  ASSERT_EQ(map.size(), 100);
+
+  std::string str = "{{ m.key3 }} {{ m.key42 }} {{ m.none }}";
+  liquid::Template tmplt = liquid::parse(str);
+  liquid::Map data;
+  data["m"] = liquid::Value(std::make_shared<liquid::MapValue>(map));
+
+  ASSERT_EQ(tmplt.render(data), "3 42 ");
+}
+
+#include <thread>
+
+TEST(Liquid, atoms) {
+
+  liquid::Atom a{ "product" };
+  liquid::Atom b{ std::string("prod") + "uct" };
+
+  ASSERT_TRUE(a == b);
+  ASSERT_FALSE(a == liquid::Atom("products"));
+  ASSERT_EQ(a.str(), "product");
+  ASSERT_EQ(liquid::Atom().str(), "");
+
+  std::vector<liquid::Atom> atoms(4);
+  std::vector<std::thread> threads;
+
+  for (size_t i(0); i < atoms.size(); ++i)
+  {
+    threads.emplace_back([&atoms, i]() {
+      for (int j(0); j < 1000; ++j)
+        liquid::Atom("name" + std::to_string(j));
+      atoms[i] = liquid::Atom("name500");
+    });
+  }
+
+  for (std::thread& t : threads)
+    t.join();
+
+  for (const liquid::Atom& atom : atoms)
+    ASSERT_TRUE(atom == liquid::Atom("name500"));
+
+  liquid::Map map;
+  map.insert(a, 42);
+  ASSERT_EQ(map.property(b).as<int>(), 42);
+  ASSERT_EQ(map.property(std::string("product")).as<int>(), 42);
+  ASSERT_TRUE(liquid::Value(map).property(liquid::Atom("none")).isNull());
+
+  liquid::Atom t = liquid::Atom::transient("product");
+  liquid::Atom copy = t;
+  ASSERT_TRUE(copy.isTransient());
+  ASSERT_FALSE(a.isTransient());
+  ASSERT_TRUE(copy == a && a == t);
+  ASSERT_FALSE(t == liquid::Atom::transient("products"));
+  ASSERT_EQ(t.hash(), a.hash());
+
+  // transient strings are released and interned again concurrently
+  threads.clear();
+
+  for (size_t i(0); i < 4; ++i)
+  {
+    threads.emplace_back([]() {
+      for (int j(0); j < 1000; ++j)
+      {
+        liquid::Atom key = liquid::Atom::transient("key" + std::to_string(j % 10));
+        liquid::Atom other = key;
+        other = liquid::Atom::transient("key" + std::to_string(j % 7));
+      }
+    });
+  }
+
+  for (std::thread& th : threads)
+    th.join();
+
+  ASSERT_EQ(liquid::Atom::transient("key3").str(), "key3");
+
+  liquid::Map dynamic;
+  dynamic["sku-1234"] = 1;
+  dynamic.insert(std::string("sku-5678"), 2);
+  ASSERT_EQ(dynamic.property(liquid::Atom("sku-1234")).as<int>(), 1);
+  ASSERT_EQ(dynamic.fork().property(liquid::Atom("sku-5678")).as<int>(), 2);
+  ASSERT_EQ(liquid::freeze(dynamic).root().property(liquid::Atom("sku-5678")).as<int>(), 2);
+}
+
+class ComputedMap : public liquid::IValue
+{
+public:
+  bool is_map() const override { return true; }
+  std::type_index type_index() const override { return std::type_index(typeid(ComputedMap)); }
+
+  liquid::Value property(const std::string& name) const override
+  {
+    return name == "answer" ? liquid::Value(42) : liquid::Value();
+  }
+};
+
+TEST(Liquid, find) {
+
+  liquid::Map map;
+  map["a"] = "A";
+  map["list"] = liquid::Array({ 1, 2, 3 });
+
+  const liquid::Value* a = map.find(liquid::Atom("a"));
+  ASSERT_NE(a, nullptr);
+  ASSERT_EQ(a, map.find("a"));
+  ASSERT_EQ(a->as<std::string>(), "A");
+  ASSERT_TRUE(map.find("b")->isNull());
+
+  const liquid::Value* list = map.find("list");
+  ASSERT_EQ(list->find(1)->as<int>(), 2);
+  ASSERT_TRUE(list->find(3)->isNull());
+
+  liquid::Value computed{ std::make_shared<ComputedMap>() };
+  ASSERT_EQ(computed.find("answer"), nullptr);
+  ASSERT_EQ(computed.property("answer").as<int>(), 42);
+
+  map["computed"] = computed;
+  map["people"] = liquid::Array({ liquid::Map{ { "name", "Bob" } }, liquid::Map{ { "name", "Alice" } }, computed });
+
+  std::string str = "{{ a }} {{ list[1] }} {{ computed.answer }} {{ people | map: 'name' | join: ',' }} {{ people[2].answer }}";
+  liquid::Template tmplt = liquid::parse(str);
+  ASSERT_EQ(tmplt.render(map), "A 2 42 Bob,Alice 42");
+}
+
+class ChunkedArray : public liquid::IValue
+{
+public:
+  std::vector<std::vector<liquid::Value>> blocks;
+  mutable int calls_to_at = 0;
+
+  bool is_array() const override { return true; }
+  std::type_index type_index() const override { return std::type_index(typeid(ChunkedArray)); }
+
+  size_t length() const override
+  {
+    size_t n = 0;
+    for (const auto& b : blocks)
+      n += b.size();
+    return n;
+  }
+
+  liquid::Value at(size_t index) const override
+  {
+    ++calls_to_at;
+    size_t count = 0;
+    const liquid::Value* elements = chunk(index, count);
+    return count > 0 ? *elements : liquid::Value();
+  }
+
+  const liquid::Value* chunk(size_t offset, size_t& count) const override
+  {
+    for (const auto& b : blocks)
+    {
+      if (offset < b.size())
+      {
+        count = b.size() - offset;
+        return b.data() + offset;
+      }
+
+      offset -= b.size();
+    }
+
+    count = 0;
+    return nullptr;
+  }
+};
+
+TEST(Liquid, chunks) {
+
+  liquid::Array array{ { 1, 2, 3 } };
+  size_t count = 0;
+  const liquid::Value* elements = array.chunk(1, count);
+  ASSERT_EQ(count, 2);
+  ASSERT_EQ(elements[0].as<int>(), 2);
+  ASSERT_EQ(elements[1].as<int>(), 3);
+  array.chunk(3, count);
+  ASSERT_EQ(count, 0);
+
+  auto chunked = std::make_shared<ChunkedArray>();
+  chunked->blocks.push_back({ 1, 2 });
+  chunked->blocks.push_back({ 3 });
+  chunked->blocks.push_back({ "4", 5 });
+
+  liquid::Map data;
+  data["list"] = liquid::Value(chunked);
+
+  std::string str = "{% for n in list %}{{ n }}{% if forloop.last %}.{% else %},{% endif %}{% endfor %} "
+    "{{ list | push: 6 | join: '' }} {{ list | pop | concat: list | join: '' }} {{ list | join: '' }}";
+  liquid::Template tmplt = liquid::parse(str);
+  ASSERT_EQ(tmplt.render(data), "1,2,3,4,5. 4 44 4");
+  ASSERT_EQ(chunked->calls_to_at, 0);
+
+  liquid::Value pushed = liquid::ArrayFilters::push(liquid::Array(chunked), 6);
+  ASSERT_EQ(pushed.length(), 6);
+  ASSERT_EQ(pushed.at(5).as<int>(), 6);
+  ASSERT_EQ(liquid::ArrayFilters::pop(liquid::Array()).length(), 0);
+}
+
+struct Order
+{
+  int number;
+  std::string customer;
+};
+
+namespace liquid
+{
+
+template<>
+struct Converter<Order>
+{
+  template<typename O>
+  static Value convert(const std::shared_ptr<O>& /* owner */, const Order& order)
+  {
+    liquid::Map result;
+    result["number"] = order.number;
+    result["customer"] = order.customer;
+    return result;
+  }
+};
+
+} // namespace liquid
+
+TEST(Liquid, adapters) {
+
+  std::vector<int> numbers{ 1, 2, 3 };
+  liquid::Value value = liquid::borrow(numbers);
+  ASSERT_TRUE(value.isArray());
+  ASSERT_EQ(value.length(), 3);
+  ASSERT_EQ(value.at(2).as<int>(), 3);
+  ASSERT_EQ(&value.as<std::vector<int>>(), &numbers);
+
+  ASSERT_EQ(liquid::Value(int64_t{ 5 }).as<int>(), 5);
+  ASSERT_EQ(liquid::Value(int64_t{ 3000000000 }).kind(), liquid::Value::Integer64Kind);
+
+  std::vector<int64_t> sizes{ 1, 3000000000 };
+  std::vector<uint64_t> hashes{ 3000000000, 18446744073709551615ull };
+  ASSERT_EQ(liquid::borrow(sizes).at(1).as<long long>(), 3000000000);
+  ASSERT_EQ(liquid::borrow(hashes).at(0).as<long long>(), 3000000000);
+  ASSERT_TRUE(liquid::borrow(hashes).at(1).is<double>());
+
+  std::vector<liquid::Value> values{ 1, "two" };
+  ASSERT_FALSE(liquid::Array(liquid::borrow(values).impl()).isWritable());
+  ASSERT_TRUE(liquid::Array().isWritable());
+
+  auto names = std::make_shared<const std::unordered_map<std::string, std::vector<std::string>>>(
+    std::unordered_map<std::string, std::vector<std::string>>{ { "fruits", { "apple", "pear" } }, { "vegetables", { "leek" } } });
+  liquid::Value groups = liquid::share(names);
+  ASSERT_TRUE(groups.isMap());
+  ASSERT_EQ(groups.propertyNames().size(), 2);
+  ASSERT_EQ(&groups.property("fruits").at(1).as<std::string>(), &names->at("fruits").at(1));
+  ASSERT_TRUE(groups.property("meat").isNull());
+
+  std::vector<Order> orders{ { 1, "Bob" }, { 2, "Alice" } };
+  std::vector<std::vector<int>> matrix{ { 1, 2 }, { 3, 4 } };
+
+  liquid::Map data;
+  data["numbers"] = value;
+  data["groups"] = groups;
+  data["orders"] = liquid::borrow(orders);
+  data["matrix"] = liquid::borrow(matrix);
+
+  std::string str = "{% for n in numbers %}{{ n }}{% endfor %} {{ groups.fruits | join: ',' }} {{ groups.vegetables | concat: groups.fruits | last }} "
+    "{{ orders | map: 'customer' | join: ',' }} {{ orders[1].number }} {% for row in matrix %}{% for x in row %}{{ x }}{% endfor %};{% endfor %}";
+  liquid::Template tmplt = liquid::parse(str);
+  ASSERT_EQ(tmplt.render(data), "123 apple,pear pear Bob,Alice 2 12;34;");
+}
+
+namespace shop
+{
+
+struct Category
+{
+  std::string title;
+};
+
+LIQUID_REFLECT(Category, title)
+
+struct Product
+{
+  int id;
+  std::string name;
+  double price;
+  bool available;
+  Category category;
+  std::vector<std::string> tags;
+};
+
+LIQUID_REFLECT(Product, id, name, price, available, category, tags)
+
+} // namespace shop
+
+TEST(Liquid, reflection) {
+
+  std::vector<shop::Product> products;
+  products.push_back(shop::Product{ 1, "Apple", 0.5, true, { "Fruits" }, { "red", "sweet" } });
+  products.push_back(shop::Product{ 2, "Leek", 2.25, false, { "Vegetables" }, {} });
+
+  liquid::Value value = liquid::reflect(products);
+  ASSERT_TRUE(value.isArray());
+  ASSERT_EQ(value.length(), 2);
+
+  liquid::Value apple = value.at(0);
+  ASSERT_TRUE(apple.isMap());
+  ASSERT_TRUE(apple.is<shop::Product>());
+  ASSERT_EQ(apple.property("id").as<int>(), 1);
+  ASSERT_EQ(apple.property(liquid::Atom("price")).as<double>(), 0.5);
+  ASSERT_TRUE(apple.property("unknown").isNull());
+  ASSERT_EQ(apple.propertyNames().size(), 6);
+
+  // members are shared with the reflected object, not copied
+  liquid::Value name = apple.property("name");
+  ASSERT_EQ(&name.as<std::string>(), &value.as<std::vector<shop::Product>>().front().name);
+
+  liquid::Map data;
+  data["products"] = value;
+
+  std::string str = "{% for p in products %}{{ p.name }} ({{ p.category.title }}, {{ p.tags | join: '/' }}){% if p.available %} #{{ p.id }}{% endif %};{% endfor %}";
+  liquid::Template tmplt = liquid::parse(str);
+  ASSERT_EQ(tmplt.render(data), "Apple (Fruits, red/sweet) #1;Leek (Vegetables, );");
+}
+
+TEST(Liquid, lazy_properties) {
+
+  std::atomic<int> calls{ 0 };
+
+  auto product = std::make_shared<liquid::LazyMapValue>();
+  product->insert(liquid::Atom("name"), "Apple");
+  product->insertLazy(liquid::Atom("url"), [&calls]() -> liquid::Value {
+    ++calls;
+    return "/products/apple";
+  });
+
+  liquid::Map data;
+  data["product"] = liquid::Value(product);
+  data["numbers"] = liquid::Array({ 1, 2, 3 });
+
+  std::string str = "{% for n in numbers %}{{ product.name }}:{{ product.url }}{{ product.url }};{% endfor %}";
+  liquid::Template tmplt = liquid::parse(str);
+  ASSERT_EQ(tmplt.render(data), "Apple:/products/apple/products/apple;Apple:/products/apple/products/apple;Apple:/products/apple/products/apple;");
+  ASSERT_EQ(calls.load(), 1);
+  ASSERT_TRUE(product->property("none").isNull());
+  ASSERT_EQ(product->propertyNames().size(), 2);
+
+  auto shared = std::make_shared<liquid::LazyMapValue>();
+  shared->insertLazy(liquid::Atom("slow"), [&calls]() -> liquid::Value {
+    ++calls;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return 42;
+  });
+
+  std::vector<std::thread> threads;
+
+  for (int i(0); i < 4; ++i)
+  {
+    threads.emplace_back([shared]() {
+      ASSERT_EQ(shared->get(liquid::Atom("slow")).as<int>(), 42);
+    });
+  }
+
+  for (std::thread& t : threads)
+    t.join();
+
+  ASSERT_EQ(calls.load(), 2);
+
+  int failures = 0;
+  auto flaky = std::make_shared<liquid::LazyMapValue>();
+  flaky->insertLazy(liquid::Atom("value"), [&failures]() -> liquid::Value {
+    if (failures++ == 0)
+      throw std::runtime_error("not yet");
+    return 1;
+  });
+
+  ASSERT_THROW(flaky->property("value"), std::runtime_error);
+  ASSERT_EQ(flaky->property("value").as<int>(), 1);
+
+  // cached values are not allocated from the arena of the render that computes them
+  liquid::Arena* thunk_arena = nullptr;
+  auto cached = std::make_shared<liquid::LazyMapValue>();
+  cached->insertLazy(liquid::Atom("tags"), [&thunk_arena]() -> liquid::Value {
+    thunk_arena = liquid::Arena::current();
+    return liquid::Array({ "red", "sweet" });
+  });
+
+  liquid::Renderer renderer;
+  renderer.setArenaEnabled();
+  liquid::Map lazy_data;
+  lazy_data["p"] = liquid::Value(cached);
+  ASSERT_EQ(renderer.render(liquid::parse("{{ p.tags | join: '/' }}"), lazy_data), "red/sweet");
+  ASSERT_EQ(thunk_arena, nullptr);
+}
+
+class NamedMap : public ComputedMap
+{
+public:
+  std::set<std::string> propertyNames() const override { return { "answer" }; }
+};
+
+TEST(Liquid, snapshot) {
+
+  liquid::Map catalog;
+  catalog["title"] = "Catalog";
+  catalog["products"] = liquid::Array({ liquid::Map{ { "name", "Apple" }, { "price", 1 } }, liquid::Map{ { "name", "Leek" }, { "price", 2 } } });
+  catalog["computed"] = liquid::Value(std::make_shared<NamedMap>());
+
+  liquid::Snapshot snapshot = liquid::freeze(catalog);
+  const liquid::Value& root = snapshot.root();
+  ASSERT_TRUE(root.isMap());
+  ASSERT_GT(snapshot.size(), 0);
+  ASSERT_EQ(root.property("title").as<std::string>(), "Catalog");
+  ASSERT_EQ(root.find(liquid::Atom("computed"))->property("answer").as<int>(), 42);
+  ASSERT_TRUE(root.property("none").isNull());
+
+  liquid::Value products = root.property("products");
+  ASSERT_TRUE(products.isArray());
+  ASSERT_EQ(products.length(), 2);
+  ASSERT_EQ(products.at(1).property("name").as<std::string>(), "Leek");
+  ASSERT_FALSE(products.toArray().isWritable());
+
+  // frozen values are not reference counted
+  ASSERT_EQ(products.impl().use_count(), 0);
+
+  // the snapshot is a copy
+  catalog["title"] = "Changed";
+  ASSERT_EQ(root.property("title").as<std::string>(), "Catalog");
+
+  liquid::Template tmplt = liquid::parse("{{ catalog.title }}:{% for p in catalog.products %} {{ p.name }}={{ p.price }}{% endfor %} {{ catalog.computed.answer }}");
+  std::vector<std::string> results(4);
+  std::vector<std::thread> threads;
+
+  for (size_t i(0); i < results.size(); ++i)
+  {
+    threads.emplace_back([&tmplt, &root, &results, i]() {
+      liquid::Map data;
+      data["catalog"] = root;
+      results[i] = tmplt.render(data);
+    });
+  }
+
+  for (std::thread& t : threads)
+    t.join();
+
+  for (const std::string& r : results)
+    ASSERT_EQ(r, "Catalog: Apple=1 Leek=2 42");
+
+  liquid::Snapshot moved = std::move(snapshot);
+  ASSERT_EQ(moved.root().property("title").as<std::string>(), "Catalog");
+  ASSERT_TRUE(snapshot.root().isNull());
+}
+
+TEST(Liquid, properties) {
+
+  liquid::Map map;
+  map["b"] = 2;
+  map["a"] = 1;
+
+  std::vector<std::string> names;
+  map.forEachProperty([&names](const std::string& name, const liquid::Value&) {
+    names.push_back(name);
+  });
+
+  ASSERT_EQ(names, std::vector<std::string>({ "b", "a" }));
+  ASSERT_EQ(map.propertyNames(), std::set<std::string>({ "a", "b" }));
+  ASSERT_EQ(liquid::Renderer::defaultStringify(map), "{\"a\": 1, \"b\": 2}");
+
+  liquid::Value named{ std::make_shared<NamedMap>() };
+  int sum = 0;
+  named.forEachProperty([&sum](const std::string&, const liquid::Value& val) {
+    sum += val.as<int>();
+  });
+
+  ASSERT_EQ(sum, 42);
+
+  liquid::Map other;
+  other["a"] = 1;
+  other["b"] = 2;
+  ASSERT_EQ(liquid::compare(map, other), 0);
+
+  other["b"] = 3;
+  ASSERT_LT(liquid::compare(map, other), 0);
+}
+
+TEST(Liquid, strings) {
+
+  liquid::Value hello{ "Hello World!" };
+  liquid::Value world = liquid::StringValue::slice(hello, 6, 5);
+  ASSERT_EQ(world.as<std::string>(), "World");
+  ASSERT_EQ(liquid::StringValue::slice(world, 1, 100).as<std::string>(), "orld");
+
+  liquid::Value str{ "" };
+  std::string expected;
+
+  for (int i(0); i < 100000; ++i)
+  {
+    str = liquid::StringValue::concat(str, world);
+    expected += "World";
+  }
+
+  ASSERT_EQ(str.as<std::string>(), expected);
+  ASSERT_EQ(liquid::StringValue::slice(str, 5, 10).as<std::string>(), "WorldWorld");
+
+  std::string tmplt_str = 
+    "{% assign s = '' %}"
+    "{% for w in words %}{% assign s = s + w + '-' %}{% endfor %}"
+    "{{ s }} {{ s.size }}"
+    "{% capture c %}[{{ s }}]{% endcapture %} {{ c }}";
+  liquid::Template tmplt = liquid::parse(tmplt_str);
+
+  liquid::Array words;
+  expected.clear();
+
+  for (int i(0); i < 50; ++i)
+  {
+    words.push("word" + std::to_string(i));
+    expected += "word" + std::to_string(i) + "-";
+  }
+
+  liquid::Map data;
+  data["words"] = words;
+
+  ASSERT_EQ(tmplt.render(data), expected + " " + std::to_string(expected.size()) + " [" + expected + "]");
+}
+
+TEST(Liquid, arena) {
+
+  liquid::Arena arena{ 64 };
+  void* a = arena.allocate(24, 8);
+  void* b = arena.allocate(24, 8);
+  ASSERT_EQ(static_cast<char*>(b) - static_cast<char*>(a), 24);
+  arena.allocate(200, 8);
+  ASSERT_EQ(arena.size(), 248);
+  arena.reset();
+  ASSERT_EQ(arena.allocate(8, 8), a);
+
+  std::string str =
+    "{% for p in products %}{% assign name = p.name + '!' %}{{ name }}{% endfor %}"
+    "{% capture msg %}{{ products.size }} products{% endcapture %}"
+    "{% assign last = msg + ' rendered' global %}";
+  liquid::Template tmplt = liquid::parse(str);
+
+  liquid::Array products;
+  products.push(liquid::Map{ { "name", "Apple" } });
+  products.push(liquid::Map{ { "name", "Banana" } });
+
+  liquid::Renderer renderer;
+  ASSERT_FALSE(renderer.isArenaEnabled());
+  renderer.setArenaEnabled();
+  ASSERT_TRUE(renderer.isArenaEnabled());
+
+  liquid::Map data;
+  data["products"] = products;
+
+  ASSERT_EQ(renderer.render(tmplt, data), "Apple!Banana!");
+  ASSERT_GT(renderer.arena()->size(), 0);
+
+  // 'last' escaped the first rendering and keeps its arena alive
+  liquid::Arena* first_arena = renderer.arena();
+  first_arena->ref();
+  ASSERT_TRUE(first_arena->isShared());
+
+  liquid::Map other;
+  other["products"] = liquid::Array();
+  ASSERT_EQ(renderer.render(tmplt, other), "");
+  ASSERT_NE(renderer.arena(), first_arena);
+  ASSERT_EQ(data["last"].as<std::string>(), "2 products rendered");
+
+  data = liquid::Map();
+  ASSERT_FALSE(first_arena->isShared());
+  first_arena->deref();
+
+  // the arena is reused when nothing escapes
+  liquid::Template local = liquid::parse("{% assign x = 'x' + 'y' %}{{ x }}");
+  renderer.render(local, other);
+  liquid::Arena* second_arena = renderer.arena();
+  ASSERT_EQ(renderer.render(local, other), "xy");
+  ASSERT_EQ(renderer.arena(), second_arena);
+}
+
+#include "liquid/json.h"
+#include "liquid/parser.h"
+
+TEST(Liquid, binary) {
+
+  liquid::Map catalog;
+  catalog["title"] = "Catalog";
+  catalog["version"] = 3;
+  catalog["ratio"] = 0.25;
+  catalog["open"] = true;
+  catalog["none"] = nullptr;
+  catalog["products"] = liquid::Array({ liquid::Map{ { "name", "Apple" }, { "price", -1 } }, liquid::Map{ { "name", "Leek" }, { "price", 2 } } });
+
+  std::string data = liquid::binary::serialize(catalog);
+  liquid::binary::Document doc = liquid::binary::Document::fromBuffer(data);
+  ASSERT_EQ(doc.size(), data.size());
+
+  const liquid::Value& root = doc.root();
+  ASSERT_TRUE(root.isMap());
+  ASSERT_EQ(root.propertyNames().size(), 6);
+  ASSERT_EQ(root.property("title").as<std::string>(), "Catalog");
+  ASSERT_EQ(root.property("version").as<int>(), 3);
+  ASSERT_EQ(root.property("ratio").as<double>(), 0.25);
+  ASSERT_TRUE(root.property("open").as<bool>());
+  ASSERT_TRUE(root.property("none").isNull());
+  ASSERT_TRUE(root.property("missing").isNull());
+  ASSERT_EQ(root.property("products").length(), 2);
+  ASSERT_EQ(root.property("products").at(0).property("price").as<int>(), -1);
+
+  liquid::Template tmplt = liquid::parse("{{ catalog.title }}:{% for p in catalog.products %} {{ p.name }}={{ p.price }}{% endfor %}");
+  liquid::Map render_data;
+  render_data["catalog"] = root;
+  ASSERT_EQ(tmplt.render(render_data), "Catalog: Apple=-1 Leek=2");
+
+  const std::string path = "liquid-test-snapshot.bin";
+  liquid::binary::save(catalog, path);
+
+  {
+    liquid::binary::Document file = liquid::binary::Document::open(path);
+    ASSERT_EQ(file.root().property("products").at(1).property("name").as<std::string>(), "Leek");
+  }
+
+  std::remove(path.c_str());
+
+  ASSERT_THROW(liquid::binary::Document::fromBuffer("not a snapshot"), liquid::ParserException);
+  ASSERT_THROW(liquid::binary::Document::fromBuffer(data.substr(0, data.size() - 8)), liquid::ParserException);
+
+  // a reference that points forward
+  std::string corrupted = data;
+  corrupted[16] = static_cast<char>(corrupted[16] + 8);
+  ASSERT_THROW(liquid::binary::Document::fromBuffer(corrupted), liquid::ParserException);
+
+  // a corrupted key hash
+  std::string bad_key = data;
+  uint64_t root_ref;
+  std::memcpy(&root_ref, &bad_key[16], 8);
+  bad_key[(root_ref & ~uint64_t(7)) + 8] ^= 1;
+  ASSERT_THROW(liquid::binary::Document::fromBuffer(bad_key), liquid::ParserException);
+}
+
+TEST(Liquid, json) {
+
+  std::string text = R"({
+    "name": "Bob", "age": 42, "height": 1.85, "big": 12345678901,
+    "tags": ["a", "b\"c", "é😀"], "empty": {}, "none": null,
+    "nested": { "ok": true, "ko": false, "list": [] }
+  })";
+
+  liquid::Value doc = liquid::json::parse(text);
+
+  ASSERT_TRUE(doc.isMap());
+  ASSERT_EQ(doc.property("name").as<std::string>(), "Bob");
+  ASSERT_EQ(doc.property("age").as<int>(), 42);
+  ASSERT_EQ(doc.property("height").as<double>(), 1.85);
+  ASSERT_EQ(doc.property("big").as<long long>(), 12345678901LL);
+  ASSERT_EQ(liquid::json::parse("9223372036854775807").as<long long>(), 9223372036854775807LL);
+  ASSERT_EQ(liquid::json::parse("-9223372036854775807").as<long long>(), -9223372036854775807LL);
+  ASSERT_EQ(liquid::json::parse("9223372036854775808").as<double>(), 9223372036854775808.0);
+  ASSERT_EQ(liquid::json::parse("123456789012345678901234567890").as<double>(), 123456789012345678901234567890.0);
+  ASSERT_EQ(liquid::json::parse("-99999999999999999999.5").as<double>(), -99999999999999999999.5);
+  ASSERT_EQ(doc.property("tags").length(), 3);
+  ASSERT_EQ(doc.property("tags").at(1).as<std::string>(), "b\"c");
+  ASSERT_EQ(doc.property("tags").at(2).as<std::string>(), "\xC3\xA9\xF0\x9F\x98\x80");
+  ASSERT_TRUE(doc.property("empty").isMap());
+  ASSERT_TRUE(doc.property("none").isNull());
+  ASSERT_EQ(doc.property("nested").property("ok").as<bool>(), true);
+  ASSERT_EQ(doc.property("nested").property("list").length(), 0);
+
+  // keys are not interned, but are found by atom
+  liquid::Value keys = liquid::json::parse(R"({ "product": 1, "sk\u0075-9": 2 })");
+  ASSERT_EQ(keys.property(liquid::Atom("product")).as<int>(), 1);
+  ASSERT_EQ(keys.property(liquid::Atom("sku-9")).as<int>(), 2);
+  ASSERT_EQ(liquid::parse("{{ product }}").render(keys.toMap()), "1");
+
+  liquid::json::ParseOptions options;
+  options.stringSlices = true;
+  liquid::Value sliced = liquid::json::parse(text, options);
+  ASSERT_EQ(liquid::compare(doc, sliced), 0);
+
+  liquid::Arena* arena = new liquid::Arena;
+  options.arena = arena;
+  sliced = liquid::json::parse(std::string(R"([{"long string value that is not short": "x"}])"), options);
+  ASSERT_TRUE(arena->isShared());
+  ASSERT_EQ(sliced.at(0).property("long string value that is not short").as<std::string>(), "x");
+  sliced = liquid::Value();
+  ASSERT_FALSE(arena->isShared());
+  arena->deref();
+
+  ASSERT_THROW(liquid::json::parse("{\"a\": }"), liquid::ParserException);
+  ASSERT_THROW(liquid::json::parse("[1, 2"), liquid::ParserException);
+  ASSERT_THROW(liquid::json::parse("\"abc"), liquid::ParserException);
+  ASSERT_THROW(liquid::json::parse("[1] 2"), liquid::ParserException);
+  ASSERT_THROW(liquid::json::parse(std::string(1000, '[') + std::string(1000, ']')), liquid::ParserException);
+
+  try
+  {
+    liquid::json::parse("[1, tru]");
+  }
+  catch (const liquid::ParserException& ex)
+  {
+    ASSERT_EQ(ex.offset_, 4);
+  }
+}
+
+TEST(Liquid, json_stream) {
+
+  liquid::Template tmplt = liquid::parse("{% for p in products %}{{ p.name }}{% if forloop.last %}.{% else %},{% endif %}{% endfor %}");
+
+  auto input = std::make_shared<std::istringstream>("{\"name\": \"Apple\"}\n\n{\"name\": \"Pear\"}\r\n{\"name\": \"Plum\"}\n");
+
+  liquid::Map data;
+  data["products"] = liquid::json::stream(input);
+  ASSERT_TRUE(data["products"].isArray());
+  ASSERT_EQ(liquid::Renderer().render(tmplt, data), "Apple,Pear,Plum.");
+
+  // a stream can only be read once
+  ASSERT_EQ(liquid::Renderer().render(tmplt, data), "");
+
+  input = std::make_shared<std::istringstream>("1\n2\n3\n4\n");
+  data["products"] = liquid::json::stream(input);
+  tmplt = liquid::parse("{% for n in products %}{% if n == 3 %}{% break %}{% endif %}{{ n }}{% endfor %}|{{ products | join: ',' }}");
+  ASSERT_EQ(liquid::Renderer().render(tmplt, data), "12|");
+
+  input = std::make_shared<std::istringstream>("\"a\"\n\"b\"\n");
+  data["products"] = liquid::json::stream(input);
+  tmplt = liquid::parse("{{ products | join: ',' }}");
+  ASSERT_EQ(liquid::Renderer().render(tmplt, data), "a,b");
+
+  input = std::make_shared<std::istringstream>("1\n2\n3\n");
+  data["products"] = liquid::json::stream(input);
+  tmplt = liquid::parse("{{ products }}");
+  ASSERT_EQ(liquid::Renderer().render(tmplt, data), "[1, 2, 3]");
+
+  input = std::make_shared<std::istringstream>("");
+  data["products"] = liquid::json::stream(input);
+  ASSERT_EQ(liquid::Renderer().render(tmplt, data), "[]");
+
+  input = std::make_shared<std::istringstream>("[1]\n[1, tru]\n");
+  liquid::Array broken{ liquid::json::stream(input).impl() };
+  size_t count = 0;
+
+  try
+  {
+    broken.forEach([&count](const liquid::Value&) { ++count; });
+    FAIL();
+  }
+  catch (const liquid::ParserException& ex)
+  {
+    ASSERT_EQ(count, 1);
+    ASSERT_EQ(ex.offset_, 8);
+  }
+
+  // the line after a bad line does not see its partial containers
+  input = std::make_shared<std::istringstream>("[1,2,\n[3]\n{\"a\": [4, {\"b\": 5\n{\"c\": [6]}\n");
+  std::shared_ptr<liquid::IValue> lines = liquid::json::stream(input).impl();
+  liquid::Value line;
+  ASSERT_THROW(lines->next(line), liquid::ParserException);
+  ASSERT_TRUE(lines->next(line));
+  ASSERT_EQ(liquid::Renderer::defaultStringify(line), "[3]");
+  ASSERT_THROW(lines->next(line), liquid::ParserException);
+  ASSERT_TRUE(lines->next(line));
+  ASSERT_EQ(liquid::Renderer::defaultStringify(line), "{\"c\": [6]}");
+
+  ASSERT_THROW(liquid::json::streamFile("this-file-does-not-exist.ndjson"), std::runtime_error);
+}